@@ -0,0 +1,315 @@
+﻿#pragma once
+
+//
+// メモリ確保の計測
+// NGS_ALLOC_TRACKを定義してビルドした時だけ operator new/delete を置き換え、
+// 名前付きの区間(load save draw panel など)ごとに確保回数とバイト数を数える
+//
+//   {
+//     AllocTrack::Scope scope("load");
+//     ...
+//   }
+//
+// TIPS:区間はメインスレッドだけで有効。他のスレッドの確保は "(threads)" にまとめる
+//      確保した区間を覚えておき、解放もその区間で数える(liveは区間で確保して残っている量)
+//      resetより前に確保した領域の解放は数えない(resetの世代を領域に書いておく)
+//
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#if defined(NGS_ALLOC_TRACK)
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#endif
+
+
+namespace ngs {
+namespace AllocTrack {
+
+struct Result {
+  std::string name;
+  size_t entries;
+  size_t allocs;
+  size_t bytes;
+  size_t frees;
+  size_t live_bytes;
+};
+
+
+#if defined(NGS_ALLOC_TRACK)
+
+enum {
+  MAX_SCOPES = 32,
+
+  // 区間外と他スレッド
+  SCOPE_NONE    = 0,
+  SCOPE_THREADS = 1,
+
+  // 確保した領域の前に置くサイズと区間番号とresetの世代
+  // TIPS:返すアドレスのアラインメントを保つため16バイト取る
+  HEADER_SIZE = 16,
+};
+
+static_assert((sizeof(size_t) + sizeof(int) + sizeof(uint32_t)) <= HEADER_SIZE, "AllocTrack: header is too small");
+
+struct Counter {
+  const char* name;
+  std::atomic<size_t> entries;
+  std::atomic<size_t> allocs;
+  std::atomic<size_t> bytes;
+  std::atomic<size_t> frees;
+  std::atomic<size_t> freed_bytes;
+};
+
+// TIPS:静的初期化より前にnewされても使えるよう、ゼロ初期化だけで済む配列にしておく
+Counter counters[MAX_SCOPES];
+std::atomic<int> num_scopes;
+std::atomic<uint32_t> generation;
+int current_scope;
+std::mutex register_mutex;
+const std::thread::id main_thread = std::this_thread::get_id();
+
+
+bool isEnabled() {
+  return true;
+}
+
+// 名前から区間番号を探す(無ければ登録する)
+// TIPS:ここで確保すると数がずれるので、名前は文字列リテラルのまま持つ
+int findScope(const char* name) {
+  std::lock_guard<std::mutex> lock(register_mutex);
+
+  if (num_scopes == 0) {
+    counters[SCOPE_NONE].name    = "(none)";
+    counters[SCOPE_THREADS].name = "(threads)";
+    num_scopes = 2;
+  }
+
+  for (int i = 0; i < num_scopes; ++i) {
+    if (std::strcmp(counters[i].name, name) == 0) return i;
+  }
+  if (num_scopes == MAX_SCOPES) return SCOPE_NONE;
+
+  counters[num_scopes].name = name;
+  return num_scopes++;
+}
+
+
+class Scope {
+public:
+  explicit Scope(const char* name) :
+    prev_(SCOPE_NONE),
+    active_(std::this_thread::get_id() == main_thread)
+  {
+    if (!active_) return;
+
+    prev_ = current_scope;
+    current_scope = findScope(name);
+    counters[current_scope].entries += 1;
+  }
+
+  ~Scope() {
+    if (active_) current_scope = prev_;
+  }
+
+
+private:
+  int prev_;
+  bool active_;
+
+  Scope(const Scope&);
+  Scope& operator=(const Scope&);
+
+};
+
+
+void* allocate(const size_t size) {
+  auto* block = static_cast<char*>(std::malloc(size + HEADER_SIZE));
+  if (!block) return nullptr;
+
+  // TIPS:main_threadの初期化前(静的初期化中)の確保は区間外とする
+  auto id = std::this_thread::get_id();
+  int scope = ((id == main_thread) || (main_thread == std::thread::id())) ? current_scope : int(SCOPE_THREADS);
+  uint32_t gen = generation;
+  std::memcpy(block, &size, sizeof(size));
+  std::memcpy(block + sizeof(size), &scope, sizeof(scope));
+  std::memcpy(block + sizeof(size) + sizeof(scope), &gen, sizeof(gen));
+
+  counters[scope].allocs += 1;
+  counters[scope].bytes  += size;
+  return block + HEADER_SIZE;
+}
+
+void deallocate(void* ptr) {
+  if (!ptr) return;
+
+  auto* block = static_cast<char*>(ptr) - HEADER_SIZE;
+  size_t size;
+  int scope;
+  uint32_t gen;
+  std::memcpy(&size, block, sizeof(size));
+  std::memcpy(&scope, block + sizeof(size), sizeof(scope));
+  std::memcpy(&gen, block + sizeof(size) + sizeof(scope), sizeof(gen));
+
+  // TIPS:resetより前の確保は数え直した中に無いので、解放も数えない(liveが負にならないように)
+  if (gen == generation) {
+    counters[scope].frees       += 1;
+    counters[scope].freed_bytes += size;
+  }
+  std::free(block);
+}
+
+
+std::vector<Result> getResults() {
+  // TIPS:数え終わってから結果を作る(resultsの確保は呼び出し元の区間に入る)
+  Result values[MAX_SCOPES];
+  int num = num_scopes;
+  for (int i = 0; i < num; ++i) {
+    const auto& counter = counters[i];
+    values[i].entries    = counter.entries;
+    values[i].allocs     = counter.allocs;
+    values[i].bytes      = counter.bytes;
+    values[i].frees      = counter.frees;
+    // TIPS:別スレッドの確保と解放を読む間に数が進むことがあるので、負なら0にする
+    size_t bytes = counter.bytes;
+    size_t freed = counter.freed_bytes;
+    values[i].live_bytes = (bytes > freed) ? bytes - freed : 0;
+  }
+
+  std::vector<Result> results(values, values + num);
+  for (int i = 0; i < num; ++i) {
+    results[i].name = counters[i].name;
+  }
+  return results;
+}
+
+// 回数を0に戻す(区間の登録は残す)
+void reset() {
+  generation += 1;
+  for (int i = 0; i < num_scopes; ++i) {
+    auto& counter = counters[i];
+    counter.entries     = 0;
+    counter.allocs      = 0;
+    counter.bytes       = 0;
+    counter.frees       = 0;
+    counter.freed_bytes = 0;
+  }
+}
+
+#else
+
+// 計測しないビルドでは何もしない
+bool isEnabled() {
+  return false;
+}
+
+class Scope {
+public:
+  explicit Scope(const char*) {}
+};
+
+std::vector<Result> getResults() {
+  return std::vector<Result>();
+}
+
+void reset() {}
+
+#endif
+
+
+// 1区間1行の文字列にする
+std::vector<std::string> format(const std::vector<Result>& results) {
+  std::vector<std::string> lines;
+  for (const auto& result : results) {
+    if (result.allocs == 0) continue;
+
+    std::ostringstream line;
+    line << std::left << std::setw(10) << result.name << std::right
+         << " entries " << result.entries
+         << " allocs " << result.allocs
+         << " bytes " << result.bytes
+         << " live " << result.live_bytes;
+    if (result.entries > 0) {
+      line << " (" << result.allocs / result.entries
+           << " allocs " << result.bytes / result.entries << " bytes /entry)";
+    }
+    lines.push_back(line.str());
+  }
+  return lines;
+}
+
+void write(std::ostream& stream, const std::vector<Result>& results) {
+  if (!isEnabled()) {
+    stream << "alloc tracking: build with NGS_ALLOC_TRACK" << std::endl;
+    return;
+  }
+
+  for (const auto& line : format(results)) {
+    stream << line << std::endl;
+  }
+}
+
+}
+}
+
+
+#if defined(NGS_ALLOC_TRACK)
+
+// 置き換え可能なoperator new/delete
+// TIPS:ヘッダだけのプロジェクトなので、このヘッダは実行ファイル1つにつき1つのcppからだけincludeされる
+
+void* operator new(size_t size) {
+  auto* ptr = ngs::AllocTrack::allocate(size);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  auto* ptr = ngs::AllocTrack::allocate(size);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+  return ngs::AllocTrack::allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw() {
+  return ngs::AllocTrack::allocate(size);
+}
+
+void operator delete(void* ptr) throw() {
+  ngs::AllocTrack::deallocate(ptr);
+}
+
+void operator delete[](void* ptr) throw() {
+  ngs::AllocTrack::deallocate(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) throw() {
+  ngs::AllocTrack::deallocate(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) throw() {
+  ngs::AllocTrack::deallocate(ptr);
+}
+
+// C++14からはサイズ付きのdeleteも呼ばれる(サイズはヘッダに書いたものを使う)
+void operator delete(void* ptr, size_t) throw() {
+  ngs::AllocTrack::deallocate(ptr);
+}
+
+void operator delete[](void* ptr, size_t) throw() {
+  ngs::AllocTrack::deallocate(ptr);
+}
+
+#endif
@@ -0,0 +1,148 @@
+﻿#pragma once
+
+//
+// キューブの種類ごとの定義
+// 種類を増やす時は Stage::Cube に値を足し、ここに特殊化を書いて CubeTypes に並べる
+//
+// TIPS:VS2013はconstexprが使えないので、コンパイル時の値はenumで持つ
+//
+
+#include <vector>
+#include "cinder/Color.h"
+#include "Stage.hpp"
+
+
+namespace ngs {
+
+template <int TYPE>
+struct CubeTraits;
+
+template <>
+struct CubeTraits<Stage::Cube::ITEM> {
+  enum { TYPE = Stage::Cube::ITEM, INDEX = 0 };
+
+  static const char* name() { return "item"; }
+  // JSONの項目名
+  static const char* key()  { return "items"; }
+  // エディタで切り替えるキー
+  static char editKey()     { return 'i'; }
+  static ci::ColorA color() { return ci::ColorA(1, 1, 0, 1); }
+};
+
+template <>
+struct CubeTraits<Stage::Cube::MOVING> {
+  enum { TYPE = Stage::Cube::MOVING, INDEX = 1 };
+
+  static const char* name() { return "moving"; }
+  static const char* key()  { return "moving"; }
+  static char editKey()     { return 'm'; }
+  static ci::ColorA color() { return ci::ColorA(0, 1, 0, 1); }
+};
+
+template <>
+struct CubeTraits<Stage::Cube::SWITCH> {
+  enum { TYPE = Stage::Cube::SWITCH, INDEX = 2 };
+
+  static const char* name() { return "switch"; }
+  static const char* key()  { return "switches"; }
+  static char editKey()     { return 's'; }
+  static ci::ColorA color() { return ci::ColorA(1, 0, 1, 1); }
+};
+
+template <>
+struct CubeTraits<Stage::Cube::FALLING> {
+  enum { TYPE = Stage::Cube::FALLING, INDEX = 3 };
+
+  static const char* name() { return "falling"; }
+  static const char* key()  { return "falling"; }
+  static char editKey()     { return 'f'; }
+  static ci::ColorA color() { return ci::ColorA(1, 0.5f, 0, 1); }
+};
+
+template <>
+struct CubeTraits<Stage::Cube::ONEWAY> {
+  enum { TYPE = Stage::Cube::ONEWAY, INDEX = 4 };
+
+  static const char* name() { return "oneway"; }
+  static const char* key()  { return "oneways"; }
+  static char editKey()     { return 'o'; }
+  static ci::ColorA color() { return ci::ColorA(0, 0.5f, 1, 1); }
+};
+
+
+// 全種類の並び(JSONの書き出し順でもある)
+template <int... TYPES>
+struct CubeTypeList {};
+
+using CubeTypes = CubeTypeList<Stage::Cube::ITEM,
+                               Stage::Cube::MOVING,
+                               Stage::Cube::SWITCH,
+                               Stage::Cube::FALLING,
+                               Stage::Cube::ONEWAY>;
+
+
+// visitor.apply<TYPE>() を全種類について順番に呼ぶ
+template <typename Visitor>
+void visitCubeTypes(CubeTypeList<>, Visitor&) {}
+
+template <typename Visitor, int TYPE, int... REST>
+void visitCubeTypes(CubeTypeList<TYPE, REST...>, Visitor& visitor) {
+  // Stageの種類別リストの添字とビットが合っていること
+  static_assert(int(CubeTraits<TYPE>::TYPE) == (1 << CubeTraits<TYPE>::INDEX), "CubeTraits: INDEX mismatch");
+  static_assert(int(CubeTraits<TYPE>::INDEX) < int(Stage::NUM_CUBE_TYPES), "CubeTraits: too many types");
+
+  visitor.template apply<TYPE>();
+  visitCubeTypes(CubeTypeList<REST...>(), visitor);
+}
+
+template <typename Visitor>
+void forEachCubeType(Visitor& visitor) {
+  visitCubeTypes(CubeTypes(), visitor);
+}
+
+
+// 実行時に種類から引くための表
+struct CubeTypeInfo {
+  int type;
+  const char* name;
+  const char* key;
+  char edit_key;
+  ci::ColorA color;
+};
+
+struct CubeTypeInfoBuilder {
+  std::vector<CubeTypeInfo> infos;
+
+  CubeTypeInfoBuilder() :
+    infos(Stage::NUM_CUBE_TYPES)
+  {}
+
+  template <int TYPE>
+  void apply() {
+    typedef CubeTraits<TYPE> Traits;
+    CubeTypeInfo info = { TYPE, Traits::name(), Traits::key(), Traits::editKey(), Traits::color() };
+    infos[Traits::INDEX] = info;
+  }
+};
+
+std::vector<CubeTypeInfo> makeCubeTypeInfo() {
+  CubeTypeInfoBuilder builder;
+  forEachCubeType(builder);
+  return builder.infos;
+}
+
+// TIPS:ワーカースレッドからも引くので、関数内staticではなく起動時に作っておく
+const std::vector<CubeTypeInfo> cube_type_info = makeCubeTypeInfo();
+
+// 添字はStage::getTypeIndexと同じ
+const std::vector<CubeTypeInfo>& getCubeTypeInfo() {
+  return cube_type_info;
+}
+
+// NONEや複数の種類が混ざったものはnullptr
+const CubeTypeInfo* findCubeTypeInfo(const int type) {
+  int index = Stage::getTypeIndex(type);
+  return (index >= 0) ? &cube_type_info[index] : nullptr;
+}
+
+}
@@ -0,0 +1,152 @@
+﻿#pragma once
+
+//
+// エディタ設定
+// params.jsonを起動時と更新時に一度だけ読んで型付きで保持する
+//
+
+#include <string>
+#include <vector>
+#include "cinder/Vector.h"
+#include "JsonUtil.hpp"
+
+
+namespace ngs {
+
+struct EditorConfig {
+  ci::Vec2i size;
+
+  float frame_rate;
+  float frame_rate_low;
+
+  int grid;
+
+  ci::Vec2i settings_size;
+  ci::Vec2i settings_position;
+
+  ci::Vec2i property_size;
+  ci::Vec2i property_position;
+
+  std::string copy_path;
+  std::string pack_name;
+  bool auto_backup;
+  // bodyをランレングスで保存する(ゲームへのコピーは数値の配列に戻す)
+  bool body_rle;
+
+  int course_length;
+
+  std::string thumbnail_cache;
+  int thumbnail_cell;
+  ci::Vec2i thumbnail_box;
+
+  std::string manifest_path;
+
+  bool journal;
+  std::string journal_path;
+  int journal_checkpoint;
+
+  std::string record_path;
+  std::string trace_path;
+
+  // 検査結果のパネルと、ゲームが知っている名前(空なら組み込みの名前)
+  ci::Vec2i lint_size;
+  ci::Vec2i lint_position;
+  std::vector<std::string> lint_camera;
+  std::vector<std::string> lint_light_tween;
+  std::vector<std::string> lint_direction;
+
+  // movingの1歩の秒数と、時刻のスライダーの長さ
+  float timeline_step;
+  float timeline_length;
+
+  // タイルに分けた巨大なステージの場所と、読み込んでおく量(MB)
+  std::string chunks_path;
+  int chunks_budget;
+
+  // 画像から作る時の条件(StageHeightmap::parseの書式)
+  std::string heightmap_params;
+
+  std::vector<std::string> stage;
+};
+
+
+std::vector<std::string> getStringList(const ci::JsonTree& params, const std::string& key) {
+  std::vector<std::string> values;
+  if (params.hasChild(key)) {
+    for (const auto& value : params[key]) {
+      values.push_back(value.getValue<std::string>());
+    }
+  }
+  return values;
+}
+
+
+// 項目が欠けていたら例外を投げる
+// TIPS:読み込みに失敗しても現在の設定は壊さない
+EditorConfig makeEditorConfig(const ci::JsonTree& params) {
+  const auto& app = params["app"];
+
+  EditorConfig config;
+
+  config.size = Json::getVec2<int>(app["size"]);
+
+  config.frame_rate     = app["frame_rate"].getValue<float>();
+  config.frame_rate_low = app["frame_rate_low"].getValue<float>();
+
+  config.grid = app["grid"].getValue<int>();
+
+  config.settings_size     = Json::getVec2<int>(app["settings.size"]);
+  config.settings_position = Json::getVec2<int>(app["settings.position"]);
+
+  config.property_size     = Json::getVec2<int>(app["property.size"]);
+  config.property_position = Json::getVec2<int>(app["property.position"]);
+
+  config.copy_path   = app["copy_path"].getValue<std::string>();
+  config.pack_name   = Json::getValue(app, "pack_name", std::string("stages.pack"));
+  config.auto_backup = app["auto_backup"].getValue<bool>();
+  config.body_rle    = Json::getValue(app, "body_rle", false);
+
+  config.course_length = Json::getValue(app, "course_length", 30);
+
+  config.thumbnail_cache = Json::getValue(app, "thumbnail.cache", std::string("thumbnail/"));
+  config.thumbnail_cell  = Json::getValue(app, "thumbnail.cell", 4);
+  config.thumbnail_box   = app.hasChild("thumbnail.box") ? Json::getVec2<int>(app["thumbnail.box"])
+                                                         : ci::Vec2i(64, 160);
+
+  config.manifest_path = Json::getValue(app, "manifest", std::string("manifest.txt"));
+
+  config.journal            = Json::getValue(app, "journal.enable", true);
+  config.journal_path       = Json::getValue(app, "journal.path", std::string("journal/"));
+  config.journal_checkpoint = Json::getValue(app, "journal.checkpoint", 200);
+
+  config.record_path = Json::getValue(app, "record_path", std::string("record/"));
+  config.trace_path  = Json::getValue(app, "trace_path", std::string("trace/"));
+
+  config.lint_size     = app.hasChild("lint.size") ? Json::getVec2<int>(app["lint.size"])
+                                                   : ci::Vec2i(280, 160);
+  config.lint_position = app.hasChild("lint.position") ? Json::getVec2<int>(app["lint.position"])
+                                                       : ci::Vec2i(10, 20);
+  config.lint_camera      = getStringList(app, "lint.camera");
+  config.lint_light_tween = getStringList(app, "lint.light_tween");
+  config.lint_direction   = getStringList(app, "lint.direction");
+
+  config.timeline_step   = Json::getValue(app, "timeline.step", 0.5f);
+  config.timeline_length = Json::getValue(app, "timeline.length", 20.0f);
+
+  config.chunks_path   = Json::getValue(app, "chunks.path", std::string("chunks/"));
+  config.chunks_budget = Json::getValue(app, "chunks.budget", 64);
+
+  config.heightmap_params = Json::getValue(app, "heightmap.params", std::string("height=3;hole=0.1"));
+
+  for (const auto& path : app["stage"]) {
+    config.stage.push_back(path.getValue<std::string>());
+  }
+
+  return config;
+}
+
+EditorConfig readEditorConfig(const std::string& path) {
+  return makeEditorConfig(Json::readFromFile(path));
+}
+
+}
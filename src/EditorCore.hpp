@@ -0,0 +1,194 @@
+﻿#pragma once
+
+//
+// エディタの操作のうち、ウインドウやパネルに依存しない部分
+// StageEditorAppと入力の再生(StageTool replay)で共有する
+//
+
+#include <string>
+#include "cinder/Vector.h"
+#include "cinder/Matrix22.h"
+#include "Stage.hpp"
+#include "CubeTraits.hpp"
+
+
+namespace ngs {
+namespace EditorCore {
+
+// 画面の表示位置・回転・拡大率
+struct View {
+  ci::Vec2f offset;
+  float rotate;
+  ci::Vec2f scale;
+};
+
+ci::Vec2f screenToWorld(const View& view, const ci::Vec2f& screen_pos) {
+  ci::Matrix22f matrix;
+
+  matrix.rotate(ci::toRadians(view.rotate));
+  matrix.scale(view.scale);
+  return matrix.inverted() * (screen_pos - view.offset);
+}
+
+// ホイールでスクロールする量(長いコースを見るため)
+ci::Vec2f getWheelScroll(const View& view, const float increment) {
+  return ci::Vec2f(0.0f, increment * view.scale.y * 2.0f);
+}
+
+// ワールド座標がステージ上ならカーソル位置を返す
+bool findCursor(const Stage& stage, const ci::Vec2f& pos, ci::Vec2i& cursor_pos) {
+  if ((pos.x < 0.0f) || (pos.x >= stage.size.x)) return false;
+  if ((pos.y < 0.0f) || (pos.y >= stage.size.y)) return false;
+
+  cursor_pos.x = pos.x;
+  cursor_pos.y = pos.y;
+  return true;
+}
+
+
+// カーソル位置のキューブを編集する
+// 編集したらtrueを返す
+bool editCube(Stage& stage, const ci::Vec2i& pos, const char chara) {
+  for (const auto& info : getCubeTypeInfo()) {
+    if (chara != info.edit_key) continue;
+
+    stage.toggleType(pos, info.type);
+    return true;
+  }
+
+  switch (chara) {
+  case '-':
+    stage.changeHeight(pos, -1);
+    return true;
+
+  case '^':
+    stage.changeHeight(pos, 1);
+    return true;
+
+  case '0':
+    stage.setHeight(pos, 0);
+    return true;
+  }
+
+  return false;
+}
+
+// 選択中のスイッチの対象の数を変える
+bool editSwitchTarget(Stage& stage, const ci::Vec2i& pos, const char chara) {
+  if (!stage.isType(pos, Stage::Cube::SWITCH)) return false;
+
+  switch (chara) {
+  case '[':
+    stage.reduceSwitchTarget(pos);
+    return true;
+
+  case ']':
+    stage.addSwitchTarget(pos);
+    return true;
+  }
+
+  return false;
+}
+
+// カーソル位置で行や列を挿入・削除する
+// 編集したらジャーナルの記号(r+ r- c+ c-)を返し、indexに位置を入れる
+std::string editStructure(Stage& stage, const ci::Vec2i& pos, const char chara, int& index) {
+  switch (chara) {
+  case 'I':
+    stage.insertRow(pos.y);
+    index = pos.y;
+    return "r+";
+
+  case 'X':
+    stage.deleteRow(pos.y);
+    index = pos.y;
+    return "r-";
+
+  case 'Y':
+    stage.insertColumn(pos.x);
+    index = pos.x;
+    return "c+";
+
+  case 'Z':
+    stage.deleteColumn(pos.x);
+    index = pos.x;
+    return "c-";
+  }
+
+  return std::string();
+}
+
+
+// ステージ1つ分の編集状態
+// StageEditorAppの通常表示と同じ手順で入力を処理する
+struct Session {
+  Stage stage;
+  View view;
+
+  bool on_cursor;
+  ci::Vec2i cursor_pos;
+
+  bool selected;
+  ci::Vec2i selected_pos;
+
+  ci::Vec2f prev_drag_pos;
+
+  Session(const Stage& start_stage, const View& start_view) :
+    stage(start_stage),
+    view(start_view),
+    on_cursor(false),
+    cursor_pos(ci::Vec2i::zero()),
+    selected(false),
+    selected_pos(ci::Vec2i::zero())
+  {}
+
+
+  void mouseMove(const ci::Vec2f& pos) {
+    on_cursor = findCursor(stage, screenToWorld(view, pos), cursor_pos);
+  }
+
+  void mouseDown(const ci::Vec2f& pos) {
+    prev_drag_pos = pos;
+
+    if (on_cursor) {
+      selected = true;
+      selected_pos = cursor_pos;
+    }
+  }
+
+  void mouseDrag(const ci::Vec2f& pos) {
+    if (!on_cursor) {
+      view.offset += pos - prev_drag_pos;
+      prev_drag_pos = pos;
+    }
+  }
+
+  void mouseWheel(const float increment) {
+    view.offset += getWheelScroll(view, increment);
+  }
+
+  // 編集したらtrueを返す
+  bool keyDown(const char chara) {
+    if (chara == 'K') {
+      stage.clear();
+      on_cursor = false;
+      selected  = false;
+      return true;
+    }
+
+    int index;
+    if (on_cursor && !editStructure(stage, cursor_pos, chara, index).empty()) {
+      on_cursor = false;
+      selected  = false;
+      return true;
+    }
+
+    bool edited = on_cursor && editCube(stage, cursor_pos, chara);
+    if (selected && editSwitchTarget(stage, selected_pos, chara)) edited = true;
+
+    return edited;
+  }
+};
+
+}
+}
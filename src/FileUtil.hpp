@@ -0,0 +1,50 @@
+﻿#pragma once
+
+//
+// ファイルの書き出し
+// 一時ファイルに書いてから置き換えるので、途中で失敗しても元のファイルは壊れない
+//
+//   FileUtil::writeAtomic(path, [&text](std::ostream& file) { file << text; });
+//
+// TIPS:書けなかった時(容量不足など)は一時ファイルを消して例外を投げる
+//      置き換えは書き終えたことを確かめてから行う
+//
+
+#include <string>
+#include <fstream>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+
+
+namespace ngs {
+namespace FileUtil {
+
+// 閉じる時に書き残しを出し切り、失敗していたら例外
+void closeChecked(std::ofstream& file, const std::string& path) {
+  file.flush();
+  file.close();
+  if (!file) throw std::runtime_error("write failed " + path);
+}
+
+// funcに渡したストリームへ書いた内容でpathを置き換える
+// TIPS:ゲームが読むファイルは改行を変えないようテキストモードで書く(modeにstd::ios::outを渡す)
+template <typename Func>
+void writeAtomic(const std::string& path, Func func, const std::ios::openmode mode = std::ios::binary) {
+  auto temp_path = path + ".tmp";
+  try {
+    std::ofstream file(temp_path, mode);
+    if (!file) throw std::runtime_error("can't write " + temp_path);
+
+    func(file);
+    closeChecked(file, temp_path);
+    boost::filesystem::rename(temp_path, path);
+  }
+  catch (...) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(temp_path, ec);
+    throw;
+  }
+}
+
+}
+}
@@ -0,0 +1,153 @@
+﻿#pragma once
+
+//
+// ファイル更新監視
+// Linuxはinotify、それ以外は更新時刻をポーリングする
+//
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+namespace ngs {
+
+class FileWatcher : private boost::noncopyable {
+  std::string directory_;
+  std::set<std::string> files_;
+
+  // 自分で書き込んだ時の更新時刻(この時刻の変更は無視する)
+  std::map<std::string, std::time_t> ignore_;
+
+#if defined(__linux__)
+  int fd_;
+  int wd_;
+#else
+  std::map<std::string, std::time_t> mtime_;
+  std::chrono::steady_clock::time_point next_poll_;
+#endif
+
+
+  std::time_t getModifiedTime(const std::string& file) const {
+    boost::system::error_code ec;
+    auto t = boost::filesystem::last_write_time(directory_ + file, ec);
+    return ec ? 0 : t;
+  }
+
+  bool isIgnored(const std::string& file) {
+    auto it = ignore_.find(file);
+    if (it == ignore_.end()) return false;
+
+    bool ignored = it->second == getModifiedTime(file);
+    ignore_.erase(it);
+    return ignored;
+  }
+
+
+public:
+  // directoryは末尾に区切り文字を含むこと
+  FileWatcher(const std::string& directory, const std::vector<std::string>& files) :
+    directory_(directory)
+  {
+    setFiles(files);
+
+#if defined(__linux__)
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    // TIPS:エディタやgitはrenameで置き換えるのでIN_MOVED_TOも監視
+    wd_ = (fd_ < 0) ? -1
+                    : inotify_add_watch(fd_, directory_.c_str(),
+                                        IN_CLOSE_WRITE | IN_MOVED_TO);
+#else
+    next_poll_ = std::chrono::steady_clock::now();
+#endif
+  }
+
+  ~FileWatcher() {
+#if defined(__linux__)
+    if (fd_ >= 0) close(fd_);
+#endif
+  }
+
+
+  void setFiles(const std::vector<std::string>& files) {
+    files_.clear();
+    files_.insert(files.begin(), files.end());
+
+#if !defined(__linux__)
+    mtime_.clear();
+    for (const auto& file : files_) {
+      mtime_[file] = getModifiedTime(file);
+    }
+#endif
+  }
+
+  // 自分で書き込んだファイルを次の変更通知から除外する
+  void ignore(const std::string& file) {
+    ignore_[file] = getModifiedTime(file);
+
+#if !defined(__linux__)
+    mtime_[file] = ignore_[file];
+#endif
+  }
+
+  // 前回から変更のあったファイル名(directory相対)を返す
+  std::vector<std::string> poll() {
+    std::vector<std::string> changed;
+
+#if defined(__linux__)
+    if (wd_ < 0) return changed;
+
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+      auto length = read(fd_, buffer, sizeof(buffer));
+      if (length <= 0) break;
+
+      for (char* p = buffer; p < buffer + length; ) {
+        const auto* event = reinterpret_cast<const inotify_event*>(p);
+        if (event->len > 0) {
+          std::string file(event->name);
+          if (files_.count(file)
+              && (std::find(changed.begin(), changed.end(), file) == changed.end())) {
+            changed.push_back(file);
+          }
+        }
+        p += sizeof(inotify_event) + event->len;
+      }
+    }
+#else
+    // 毎フレーム調べるとファイルアクセスが多すぎるので間引く
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_poll_) return changed;
+    next_poll_ = now + std::chrono::seconds(1);
+
+    for (auto& m : mtime_) {
+      auto t = getModifiedTime(m.first);
+      if (t != m.second) {
+        m.second = t;
+        changed.push_back(m.first);
+      }
+    }
+#endif
+
+    changed.erase(std::remove_if(changed.begin(), changed.end(),
+                                 [this](const std::string& file) {
+                                   return isIgnored(file);
+                                 }),
+                  changed.end());
+
+    return changed;
+  }
+
+};
+
+}
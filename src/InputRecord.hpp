@@ -0,0 +1,183 @@
+﻿#pragma once
+
+//
+// 入力の記録と読み込み
+// 記録開始時のステージとあわせて保存し、StageTool replayで再生する
+//
+//   ngsr <version>
+//   stage <ステージのファイル名>
+//   view <offset.x> <offset.y> <rotate> <scale.x> <scale.y>
+//   json <バイト数>
+//   <ステージのJSON>
+//   k <時刻> <文字コード>     keyDown
+//   d <時刻> <x> <y>          mouseDown
+//   m <時刻> <x> <y>          mouseMove
+//   g <時刻> <x> <y>          mouseDrag
+//   w <時刻> <量>             mouseWheel
+//
+// 時刻は記録開始からの秒数
+// TIPS:ステージのファイル名は空白を含んでもよい(行末まで)
+//      version 1はmouseWheelを記録していない(読めるが、スクロールした記録は再生がずれる)
+//
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <stdexcept>
+#include <boost/noncopyable.hpp>
+#include "EditorCore.hpp"
+#include "NumberFormat.hpp"
+
+
+namespace ngs {
+namespace InputRecord {
+
+enum {
+  VERSION = 2,
+};
+
+struct Event {
+  enum Type {
+    KEY_DOWN   = 'k',
+    MOUSE_DOWN = 'd',
+    MOUSE_MOVE = 'm',
+    MOUSE_DRAG = 'g',
+    MOUSE_WHEEL = 'w',
+  };
+
+  double time;
+  Type type;
+  int chara;
+  ci::Vec2f pos;
+  float wheel;
+};
+
+struct Recording {
+  std::string stage_file;
+  std::string stage_text;
+  EditorCore::View view;
+  std::vector<Event> events;
+};
+
+
+class Recorder : private boost::noncopyable {
+public:
+  Recorder(const std::string& path,
+           const std::string& stage_file, const std::string& stage_text,
+           const EditorCore::View& view) :
+    stream_(path, std::ios::binary),
+    start_(std::chrono::steady_clock::now()),
+    num_events_(0)
+  {
+    if (!stream_) throw std::runtime_error("InputRecord: can't write " + path);
+
+    stream_ << "ngsr " << int(VERSION) << "\n"
+            << "stage " << stage_file << "\n"
+            << "view "
+            << NumberFormat::toString(view.offset.x) << " " << NumberFormat::toString(view.offset.y) << " "
+            << NumberFormat::toString(view.rotate) << " "
+            << NumberFormat::toString(view.scale.x) << " " << NumberFormat::toString(view.scale.y) << "\n"
+            << "json " << stage_text.size() << "\n"
+            << stage_text << "\n";
+  }
+
+  void key(const int chara) {
+    stream_ << "k " << NumberFormat::toString(getTime()) << " " << chara << "\n";
+  }
+
+  void mouse(const Event::Type type, const ci::Vec2f& pos) {
+    stream_ << char(type) << " " << NumberFormat::toString(getTime())
+            << " " << NumberFormat::toString(pos.x) << " " << NumberFormat::toString(pos.y) << "\n";
+  }
+
+  void wheel(const float increment) {
+    stream_ << "w " << NumberFormat::toString(getTime()) << " " << NumberFormat::toString(increment) << "\n";
+  }
+
+  size_t getNumEvents() const {
+    return num_events_;
+  }
+
+
+private:
+  std::ofstream stream_;
+  std::chrono::steady_clock::time_point start_;
+  size_t num_events_;
+
+  double getTime() {
+    num_events_ += 1;
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  }
+
+};
+
+
+template <typename T>
+T readNumber(std::istream& stream) {
+  std::string text;
+  stream >> text;
+
+  T value;
+  if (!NumberFormat::fromString(text, value)) throw std::runtime_error("InputRecord: bad number " + text);
+  return value;
+}
+
+Recording read(const std::string& path) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) throw std::runtime_error("InputRecord: can't open " + path);
+
+  std::string tag;
+  int version = 0;
+  stream >> tag >> version;
+  if ((tag != "ngsr") || (version < 1) || (version > VERSION)) throw std::runtime_error("InputRecord: not a recording " + path);
+
+  Recording recording;
+  stream >> tag;
+  stream.get();
+  std::getline(stream, recording.stage_file);
+
+  stream >> tag;
+  recording.view.offset.x = readNumber<float>(stream);
+  recording.view.offset.y = readNumber<float>(stream);
+  recording.view.rotate   = readNumber<float>(stream);
+  recording.view.scale.x  = readNumber<float>(stream);
+  recording.view.scale.y  = readNumber<float>(stream);
+
+  size_t length = 0;
+  stream >> tag >> length;
+  stream.get();
+  recording.stage_text.resize(length);
+  stream.read(&recording.stage_text[0], length);
+
+  while (stream >> tag) {
+    Event event;
+    try {
+      event.type = Event::Type(tag[0]);
+      event.time = readNumber<double>(stream);
+      event.chara = 0;
+      event.wheel = 0.0f;
+      if (event.type == Event::KEY_DOWN) {
+        event.chara = readNumber<int>(stream);
+      }
+      else if (event.type == Event::MOUSE_WHEEL) {
+        event.wheel = readNumber<float>(stream);
+      }
+      else {
+        event.pos.x = readNumber<float>(stream);
+        event.pos.y = readNumber<float>(stream);
+      }
+    }
+    catch (const std::runtime_error&) {
+      // TIPS:記録中に落ちた時の書きかけの行
+      break;
+    }
+    recording.events.push_back(event);
+  }
+
+  return recording;
+}
+
+}
+}
@@ -8,18 +8,62 @@
 #include "cinder/Vector.h"
 #include "cinder/Json.h"
 #include <sstream>
+#include <stdexcept>
+#include "NumberFormat.hpp"
 
 
 namespace ngs {
 namespace Json {
 
+// 数値はロケールに依存しない変換を使う
+template<typename T>
+struct ValueReader {
+  static T read(const ci::JsonTree& json) {
+    return json.getValue<T>();
+  }
+};
+
+// 数値として読めなければ例外(0にして読み進めると、そのまま保存されてしまう)
+template<typename T>
+struct NumberReader {
+  static T read(const ci::JsonTree& json) {
+    const auto& text = json.getValue();
+    T value = T();
+    if (!NumberFormat::fromString(text, value)) {
+      // 整数欄に小数が書かれていた場合など
+      double real = 0.0;
+      if (!NumberFormat::fromString(text, real)) {
+        throw std::invalid_argument("Json: not a number " + json.getKey() + ":" + text);
+      }
+      value = T(real);
+    }
+    return value;
+  }
+};
+
+template<>
+struct ValueReader<int> : NumberReader<int> {};
+
+template<>
+struct ValueReader<float> : NumberReader<float> {};
+
+template<>
+struct ValueReader<double> : NumberReader<double> {};
+
+
+template<typename T>
+T toValue(const ci::JsonTree& json) {
+  return ValueReader<T>::read(json);
+}
+
+
 template<typename T>
 std::vector<T> getArray(const ci::JsonTree& json) {
   size_t num = json.getNumChildren();
 
   std::vector<T> array(num);
   for (size_t i = 0; i < num; ++i) {
-    array[i] = json[i].getValue<T>();
+    array[i] = toValue<T>(json[i]);
   }
 
   return array;
@@ -28,46 +72,51 @@ std::vector<T> getArray(const ci::JsonTree& json) {
 
 template<typename T>
 ci::Vec2<T> getVec2(const ci::JsonTree& json) {
-  return ci::Vec2<T>(json[0].getValue<T>(), json[1].getValue<T>());
+  return ci::Vec2<T>(toValue<T>(json[0]), toValue<T>(json[1]));
 }
 
 template<typename T>
 ci::Vec3<T> getVec3(const ci::JsonTree& json) {
-  return ci::Vec3<T>(json[0].getValue<T>(), json[1].getValue<T>(), json[2].getValue<T>());
+  return ci::Vec3<T>(toValue<T>(json[0]), toValue<T>(json[1]), toValue<T>(json[2]));
 }
 
 template<typename T>
 ci::Vec4<T> getVec4(const ci::JsonTree& json) {
-  return ci::Vec4<T>(json[0].getValue<T>(), json[1].getValue<T>(), json[2].getValue<T>(), json[3].getValue<T>());
+  return ci::Vec4<T>(toValue<T>(json[0]), toValue<T>(json[1]), toValue<T>(json[2]), toValue<T>(json[3]));
 }
 
 template<typename T>
 ci::Quaternion<T> getQuaternion(const ci::JsonTree& json) {
-  return ci::Quaternion<T>(getVec3<T>(json[0]), ci::toRadians(json[1].getValue<T>()));
+  return ci::Quaternion<T>(getVec3<T>(json[0]), ci::toRadians(toValue<T>(json[1])));
 }
 
 template<typename T>
 ci::ColorT<T> getColor(const ci::JsonTree& json) {
-  return ci::ColorT<T>(json[0].getValue<T>(), json[1].getValue<T>(), json[2].getValue<T>());
+  return ci::ColorT<T>(toValue<T>(json[0]), toValue<T>(json[1]), toValue<T>(json[2]));
 }
 
 ci::Vec3f getHsvColor(const ci::JsonTree& json) {
-  return ci::Vec3f(json[0].getValue<float>() / 360.0f, json[1].getValue<float>(), json[2].getValue<float>());
+  return ci::Vec3f(toValue<float>(json[0]) / 360.0f, toValue<float>(json[1]), toValue<float>(json[2]));
 }
 
 template<typename T>
 ci::ColorAT<T> getColorA(const ci::JsonTree& json) {
-  return ci::ColorAT<T>(json[0].getValue<T>(), json[1].getValue<T>(), json[2].getValue<T>(), json[3].getValue<T>());
+  return ci::ColorAT<T>(toValue<T>(json[0]), toValue<T>(json[1]), toValue<T>(json[2]), toValue<T>(json[3]));
 }
 
 
 template<typename T>
 T getValue(const ci::JsonTree& json, const std::string& name, const T& default_value) {
-  return (json.hasChild(name)) ? json[name].getValue<T>()
+  return (json.hasChild(name)) ? toValue<T>(json[name])
                                : default_value;
 }
 
 
+// パスをそのまま使って読み込む(ツールやバックアップ用)
+ci::JsonTree readFromPath(const std::string& full_path) {
+  return ci::JsonTree(ci::loadFile(full_path));
+}
+
 ci::JsonTree readFromFile(const std::string& path) {
 #if defined (CINDER_MAC)
   // DEBUG時、OSXはプロジェクトの場所からfileを読み込む
@@ -0,0 +1,287 @@
+﻿#pragma once
+
+//
+// JSON書き出し
+// ci::JsonTree::write(jsoncppのStyledWriter)と同じ整形で書き出すが、
+// 数値は NumberFormat で最短表記にする
+//
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include "NumberFormat.hpp"
+
+
+namespace ngs {
+namespace JsonWriter {
+
+class Value {
+public:
+  enum Type {
+    NUMBER,
+    STRING,
+    ARRAY,
+    OBJECT,
+  };
+
+  Value(const int value) :
+    type_(NUMBER),
+    text_(NumberFormat::toString(value))
+  {}
+
+  Value(const float value) :
+    type_(NUMBER),
+    text_(NumberFormat::toString(value))
+  {}
+
+  Value(const std::string& value) :
+    type_(STRING),
+    text_(value)
+  {}
+
+  Value(const char* value) :
+    type_(STRING),
+    text_(value)
+  {}
+
+  static Value makeArray() {
+    return Value(ARRAY);
+  }
+
+  static Value makeObject() {
+    return Value(OBJECT);
+  }
+
+  template <typename T>
+  static Value makeArray(const T& values) {
+    Value array(ARRAY);
+    for (const auto& v : values) {
+      array.pushBack(Value(v));
+    }
+    return array;
+  }
+
+
+  Value& pushBack(const Value& value) {
+    elements_.push_back(value);
+    return *this;
+  }
+
+  // TIPS:キーは書き出し時に辞書順に並ぶ
+  Value& addChild(const std::string& key, const Value& value) {
+    members_.erase(key);
+    members_.insert(std::make_pair(key, value));
+    return *this;
+  }
+
+  bool hasChildren() const {
+    return !elements_.empty() || !members_.empty();
+  }
+
+  Type getType() const {
+    return type_;
+  }
+
+  size_t getNumChildren() const {
+    return (type_ == OBJECT) ? members_.size() : elements_.size();
+  }
+
+
+  std::string write() const {
+    Writer writer;
+    writer.writeValue(*this);
+    writer.document += "\n";
+    return writer.document;
+  }
+
+  void write(const std::string& path) const {
+    std::ofstream file(path);
+    file << write();
+  }
+
+
+private:
+  Type type_;
+  std::string text_;
+
+  std::vector<Value> elements_;
+  std::map<std::string, Value> members_;
+
+  explicit Value(const Type type) :
+    type_(type)
+  {}
+
+
+  static std::string quote(const std::string& text) {
+    std::string result("\"");
+    for (char c : text) {
+      switch (c) {
+      case '"':  result += "\\\""; break;
+      case '\\': result += "\\\\"; break;
+      case '\b': result += "\\b";  break;
+      case '\f': result += "\\f";  break;
+      case '\n': result += "\\n";  break;
+      case '\r': result += "\\r";  break;
+      case '\t': result += "\\t";  break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char code[8];
+          NumberFormat::formatText(code, sizeof(code), "\\u%04x", c);
+          result += code;
+        }
+        else {
+          result += c;
+        }
+        break;
+      }
+    }
+    result += "\"";
+    return result;
+  }
+
+
+  // StyledWriterの整形規則をそのまま移植したもの
+  struct Writer {
+    enum {
+      RIGHT_MARGIN = 74,
+      INDENT_SIZE  = 3,
+    };
+
+    std::string document;
+    std::string indent_string;
+    std::vector<std::string> child_values;
+    bool add_child_values = false;
+
+
+    void pushValue(const std::string& value) {
+      if (add_child_values) child_values.push_back(value);
+      else                  document += value;
+    }
+
+    void writeIndent() {
+      if (!document.empty()) {
+        char last = document[document.size() - 1];
+        if (last == ' ') return;
+        if (last != '\n') document += '\n';
+      }
+      document += indent_string;
+    }
+
+    void writeWithIndent(const std::string& value) {
+      writeIndent();
+      document += value;
+    }
+
+    void indent() {
+      indent_string += std::string(INDENT_SIZE, ' ');
+    }
+
+    void unindent() {
+      indent_string.resize(indent_string.size() - INDENT_SIZE);
+    }
+
+
+    void writeValue(const Value& value) {
+      switch (value.type_) {
+      case NUMBER:
+        pushValue(value.text_);
+        break;
+
+      case STRING:
+        pushValue(quote(value.text_));
+        break;
+
+      case ARRAY:
+        writeArrayValue(value);
+        break;
+
+      case OBJECT:
+        if (value.members_.empty()) {
+          pushValue("{}");
+          break;
+        }
+
+        writeWithIndent("{");
+        indent();
+        {
+          size_t index = 0;
+          for (const auto& member : value.members_) {
+            writeWithIndent(quote(member.first));
+            document += " : ";
+            writeValue(member.second);
+
+            index += 1;
+            if (index < value.members_.size()) document += ',';
+          }
+        }
+        unindent();
+        writeWithIndent("}");
+        break;
+      }
+    }
+
+    void writeArrayValue(const Value& value) {
+      size_t size = value.elements_.size();
+      if (size == 0) {
+        pushValue("[]");
+        return;
+      }
+
+      if (isMultiLineArray(value)) {
+        writeWithIndent("[");
+        indent();
+        bool has_child_value = !child_values.empty();
+        for (size_t index = 0; index < size; ++index) {
+          if (has_child_value) {
+            writeWithIndent(child_values[index]);
+          }
+          else {
+            writeIndent();
+            writeValue(value.elements_[index]);
+          }
+          if ((index + 1) < size) document += ',';
+        }
+        unindent();
+        writeWithIndent("]");
+      }
+      else {
+        document += "[ ";
+        for (size_t index = 0; index < size; ++index) {
+          if (index > 0) document += ", ";
+          document += child_values[index];
+        }
+        document += " ]";
+      }
+    }
+
+    bool isMultiLineArray(const Value& value) {
+      size_t size = value.elements_.size();
+      bool multi_line = (size * 3) >= RIGHT_MARGIN;
+
+      child_values.clear();
+      for (size_t index = 0; (index < size) && !multi_line; ++index) {
+        const auto& child = value.elements_[index];
+        multi_line = ((child.type_ == ARRAY) || (child.type_ == OBJECT)) && child.hasChildren();
+      }
+
+      if (!multi_line) {
+        child_values.reserve(size);
+        add_child_values = true;
+        size_t line_length = 4 + (size - 1) * 2;
+        for (size_t index = 0; index < size; ++index) {
+          writeValue(value.elements_[index]);
+          line_length += child_values[index].size();
+        }
+        add_child_values = false;
+        multi_line = line_length >= RIGHT_MARGIN;
+      }
+
+      return multi_line;
+    }
+  };
+
+};
+
+}
+}
@@ -0,0 +1,247 @@
+﻿#pragma once
+
+//
+// ロケールに依存しない数値と文字列の変換
+// 浮動小数は読み戻して同じ値になる最短の桁数で書き出す
+// ツールの条件指定に使う "name=value;..." の読み込みもここに置く
+//
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <clocale>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+// TIPS:std::to_chars/from_charsが使える環境ではそちらを使う
+#if defined(__has_include)
+#if __has_include(<charconv>) && ((__cplusplus >= 201703L) || (defined(_MSVC_LANG) && (_MSVC_LANG >= 201703L)))
+#include <charconv>
+#endif
+#endif
+
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+#define NGS_USE_CHARCONV
+#endif
+
+
+namespace ngs {
+namespace NumberFormat {
+
+// snprintfの代わり(入りきらない分は切り捨てる)
+// TIPS:VS2013のCRTにはsnprintfが無いので_vsnprintf_sを使う
+int formatText(char* text, const size_t size, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+  int length = _vsnprintf_s(text, size, _TRUNCATE, format, args);
+#else
+  int length = std::vsnprintf(text, size, format, args);
+#endif
+  va_end(args);
+  return length;
+}
+
+
+#if !defined(NGS_USE_CHARCONV)
+
+// printf/strtodが使う小数点をC言語の'.'と入れ替える
+char getLocalePoint() {
+  const auto* conv = std::localeconv();
+  return (conv && conv->decimal_point && conv->decimal_point[0]) ? conv->decimal_point[0] : '.';
+}
+
+template <typename T>
+std::string formatReal(const T value, const int max_precision) {
+  const char point = getLocalePoint();
+
+  // TIPS:整数部の桁数から始めて指数表記を避ける
+  const double magnitude = std::fabs(double(value));
+  int start = (magnitude >= 1.0) ? int(std::log10(magnitude)) + 1 : 1;
+  start = std::min(std::max(start, 1), max_precision);
+
+  char text[32];
+  for (int precision = start; precision <= max_precision; ++precision) {
+    formatText(text, sizeof(text), "%.*g", precision, double(value));
+    if (T(std::strtod(text, nullptr)) == value) break;
+  }
+
+  if (point != '.') {
+    char* p = std::strchr(text, point);
+    if (p) *p = '.';
+  }
+  return text;
+}
+
+template <typename T>
+bool parseReal(const char* first, const char* last, T& value) {
+  const char point = getLocalePoint();
+
+  char text[64];
+  size_t length = size_t(last - first);
+  if ((length == 0) || (length >= sizeof(text))) return false;
+
+  std::memcpy(text, first, length);
+  text[length] = '\0';
+  if (point != '.') {
+    char* p = std::strchr(text, '.');
+    if (p) *p = point;
+  }
+
+  char* end = nullptr;
+  double result = std::strtod(text, &end);
+  if (end != (text + length)) return false;
+
+  value = T(result);
+  return true;
+}
+
+#endif
+
+
+std::string toString(const int value) {
+  char text[16];
+#if defined(NGS_USE_CHARCONV)
+  auto result = std::to_chars(text, text + sizeof(text), value);
+  return std::string(text, result.ptr);
+#else
+  formatText(text, sizeof(text), "%d", value);
+  return text;
+#endif
+}
+
+std::string toString(const float value) {
+#if defined(NGS_USE_CHARCONV)
+  char text[32];
+  auto result = std::to_chars(text, text + sizeof(text), value);
+  return std::string(text, result.ptr);
+#else
+  return formatReal(value, 9);
+#endif
+}
+
+std::string toString(const double value) {
+#if defined(NGS_USE_CHARCONV)
+  char text[32];
+  auto result = std::to_chars(text, text + sizeof(text), value);
+  return std::string(text, result.ptr);
+#else
+  return formatReal(value, 17);
+#endif
+}
+
+
+// 全体が数値として読めた時だけtrue
+bool fromString(const char* first, const char* last, int& value) {
+#if defined(NGS_USE_CHARCONV)
+  auto result = std::from_chars(first, last, value);
+  return (result.ec == std::errc()) && (result.ptr == last);
+#else
+  if (first == last) return false;
+
+  char* end = nullptr;
+  std::string text(first, last);
+  errno = 0;
+  long result = std::strtol(text.c_str(), &end, 10);
+  if (end != (text.c_str() + text.size())) return false;
+  // TIPS:longが64ビットの環境ではintの範囲も調べる
+  if ((errno == ERANGE) || (result < INT_MIN) || (result > INT_MAX)) return false;
+
+  value = int(result);
+  return true;
+#endif
+}
+
+bool fromString(const char* first, const char* last, float& value) {
+#if defined(NGS_USE_CHARCONV)
+  auto result = std::from_chars(first, last, value);
+  return (result.ec == std::errc()) && (result.ptr == last);
+#else
+  return parseReal(first, last, value);
+#endif
+}
+
+bool fromString(const char* first, const char* last, double& value) {
+#if defined(NGS_USE_CHARCONV)
+  auto result = std::from_chars(first, last, value);
+  return (result.ec == std::errc()) && (result.ptr == last);
+#else
+  return parseReal(first, last, value);
+#endif
+}
+
+template <typename T>
+bool fromString(const std::string& text, T& value) {
+  return fromString(text.data(), text.data() + text.size(), value);
+}
+
+
+// "4, 0, 6, 0" のようなカンマ区切りの整数列を読む
+// 読めない要素は無視する
+std::vector<int> parseIntList(const std::string& text) {
+  std::vector<int> values;
+
+  const char* p   = text.data();
+  const char* end = p + text.size();
+  while (p < end) {
+    while ((p < end) && ((*p == ' ') || (*p == ',') || (*p == '\t'))) ++p;
+
+    const char* first = p;
+    while ((p < end) && (*p != ' ') && (*p != ',') && (*p != '\t')) ++p;
+
+    int value;
+    if ((first < p) && fromString(first, p, value)) {
+      values.push_back(value);
+    }
+  }
+
+  return values;
+}
+
+std::string joinIntList(const std::vector<int>& values) {
+  std::string text;
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (i > 0) text += ", ";
+    text += toString(values[i]);
+  }
+  return text;
+}
+
+
+// 読めなければ項目名を付けて例外
+template <typename T>
+T parseValue(const std::string& name, const std::string& text) {
+  T value;
+  if (!fromString(text, value)) throw std::invalid_argument(name + ": not a number " + text);
+  return value;
+}
+
+// "name=value;name=value" を分けてfunc(name, value)に渡す
+// funcは知らない項目名の時にfalseを返す
+template <typename Func>
+void parseParams(const std::string& text, Func func) {
+  size_t first = 0;
+  while (first <= text.size()) {
+    auto last = text.find(';', first);
+    auto param = text.substr(first, last - first);
+    if (!param.empty()) {
+      auto separator = param.find('=');
+      if (separator == std::string::npos) throw std::invalid_argument("name=value: " + param);
+
+      auto name = param.substr(0, separator);
+      if (!func(name, param.substr(separator + 1))) throw std::invalid_argument("unknown parameter: " + name);
+    }
+
+    if (last == std::string::npos) break;
+    first = last + 1;
+  }
+}
+
+}
+}
@@ -5,13 +5,19 @@
 //
 
 #include <vector>
+#include <algorithm>
 #include <boost/algorithm/clamp.hpp>
+#include "NumberFormat.hpp"
 
 
 namespace ngs {
 
 struct Stage {
-  
+  enum {
+    // NONE以外の種類の数(Cubeの種類は 1 << 添字)
+    NUM_CUBE_TYPES = 5,
+  };
+
   struct Cube {
     enum {
       NONE    = 0,
@@ -57,6 +63,17 @@ struct Stage {
       direction = std::string("up");
       power = 0;
     }
+
+    bool isSame(const Cube& rhs) const {
+      return (pos == rhs.pos)
+        && (type == rhs.type)
+        && (pattern == rhs.pattern)
+        && (target == rhs.target)
+        && (interval == rhs.interval)
+        && (delay == rhs.delay)
+        && (direction == rhs.direction)
+        && (power == rhs.power);
+    }
   };
   
   std::vector<std::vector<Cube> > body;
@@ -77,44 +94,67 @@ struct Stage {
 
   ci::Vec2i size;
 
-  
-  void toggleItem(const ci::Vec2i& pos) {
-    auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    if (cube) {
-      if (cube->type & ~Cube::ITEM) return;
-      cube->type ^= Cube::ITEM;
+  // 種類ごとの特殊なキューブの位置(x, z)。行優先の順に並ぶ
+  // TIPS:typeはsetTypeで書き換える。bodyをまとめて書き換えた時はupdateSpecialCubesで作り直す
+  std::vector<ci::Vec2i> special_cubes[NUM_CUBE_TYPES];
+
+
+  // 種類の添字(NONEや複数の種類が混ざったものは-1)
+  static int getTypeIndex(const int type) {
+    for (int i = 0; i < NUM_CUBE_TYPES; ++i) {
+      if (type == (1 << i)) return i;
     }
+    return -1;
   }
-  
-  void toggleMoving(const ci::Vec2i& pos) {
+
+  void setType(const ci::Vec2i& pos, const int type) {
     auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    if (cube) {
-      if (cube->type & ~Cube::MOVING) return;
-      cube->type ^= Cube::MOVING;
+    if (!cube || (cube->type == type)) return;
+
+    int index = getTypeIndex(cube->type);
+    if (index >= 0) {
+      auto& cubes = special_cubes[index];
+      auto it = std::lower_bound(cubes.begin(), cubes.end(), pos, lessPosition);
+      if ((it != cubes.end()) && (*it == pos)) cubes.erase(it);
     }
-  }
 
-  void toggleSwitch(const ci::Vec2i& pos) {
-    auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    if (cube) {
-      if (cube->type & ~Cube::SWITCH) return;
-      cube->type ^= Cube::SWITCH;
+    cube->type = type;
+
+    index = getTypeIndex(type);
+    if (index >= 0) {
+      auto& cubes = special_cubes[index];
+      cubes.insert(std::lower_bound(cubes.begin(), cubes.end(), pos, lessPosition), pos);
     }
   }
 
-  void toggleFalling(const ci::Vec2i& pos) {
-    auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    if (cube) {
-      if (cube->type & ~Cube::FALLING) return;
-      cube->type ^= Cube::FALLING;
+  // bodyの内容から種類ごとのリストを作り直す
+  void updateSpecialCubes() {
+    for (auto& cubes : special_cubes) {
+      cubes.clear();
+    }
+
+    for (const auto& row : body) {
+      for (const auto& cube : row) {
+        int index = getTypeIndex(cube.type);
+        if (index >= 0) special_cubes[index].push_back(ci::Vec2i(cube.pos.x, cube.pos.z));
+      }
     }
   }
-  
-  void toggleOneway(const ci::Vec2i& pos) {
+
+  const std::vector<ci::Vec2i>& getSpecialCubes(const int type) const {
+    static const std::vector<ci::Vec2i> empty;
+
+    int index = getTypeIndex(type);
+    return (index >= 0) ? special_cubes[index] : empty;
+  }
+
+
+  // 他の種類になっていなければ切り替える
+  void toggleType(const ci::Vec2i& pos, const int type) {
     auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
     if (cube) {
-      if (cube->type & ~Cube::ONEWAY) return;
-      cube->type ^= Cube::ONEWAY;
+      if (cube->type & ~type) return;
+      setType(pos, cube->type ^ type);
     }
   }
 
@@ -194,6 +234,14 @@ struct Stage {
   }
   
 
+  void renumberRows(const int first) {
+    for (size_t z = first; z < body.size(); ++z) {
+      for (auto& cube : body[z]) {
+        cube.pos.z = z;
+      }
+    }
+  }
+
   void resize() {
     body.resize(size.y);
     
@@ -209,43 +257,93 @@ struct Stage {
       }
       z += 1.0f;
     }
+
+    updateSpecialCubes();
   }
 
 
-  bool isItemCube(const ci::Vec2i& pos) const {
-    auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    return cube && (cube->type & Cube::ITEM);
+  // z行目の手前に1行挿入する
+  // TIPS:行の入れ替えは内側のvectorのmoveだけで済む。
+  //      後ろの行はcube.posを振り直す(位置をキューブ自身が持つので避けられない)
+  //      種類ごとのリストとスイッチの対象は、ずれた分だけを直す
+  void insertRow(const int z) {
+    if ((z < 0) || (z > int(body.size()))) return;
+
+    std::vector<Cube> row;
+    row.reserve(size.x);
+    for (int x = 0; x < size.x; ++x) {
+      row.emplace_back(ci::Vec3f(x, 0, z));
+    }
+    body.insert(body.begin() + z, std::move(row));
+    size.y += 1;
+
+    renumberRows(z + 1);
+    shiftSpecialRows(z, 1);
+    fixTargets(2, z, 1);
   }
 
-  bool isMovingCube(const ci::Vec2i& pos) const {
-    auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    return cube && (cube->type & Cube::MOVING);
+  void deleteRow(const int z) {
+    if ((z < 0) || (z >= int(body.size())) || (body.size() <= 1)) return;
+
+    body.erase(body.begin() + z);
+    size.y -= 1;
+
+    renumberRows(z);
+    shiftSpecialRows(z, -1);
+    fixTargets(2, z, -1);
   }
-  
-  bool isSwitchCube(const ci::Vec2i& pos) const {
-    auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    return cube && (cube->type & Cube::SWITCH);
+
+  // x列目の手前に1列挿入する
+  // TIPS:各行の要素をずらすので行の数×列の後ろ側の手間がかかる
+  void insertColumn(const int x) {
+    if ((x < 0) || (x > size.x)) return;
+
+    for (size_t z = 0; z < body.size(); ++z) {
+      auto& row = body[z];
+      if (x > int(row.size())) continue;
+
+      row.emplace(row.begin() + x, ci::Vec3f(x, 0, z));
+      for (size_t i = x + 1; i < row.size(); ++i) {
+        row[i].pos.x = i;
+      }
+    }
+    size.x += 1;
+
+    shiftSpecialColumns(x, 1);
+    fixTargets(0, x, 1);
   }
 
-  bool isFallingCube(const ci::Vec2i& pos) const {
-    auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    return cube && (cube->type & Cube::FALLING);
+  void deleteColumn(const int x) {
+    if ((x < 0) || (x >= size.x) || (size.x <= 1)) return;
+
+    for (auto& row : body) {
+      if (x >= int(row.size())) continue;
+
+      row.erase(row.begin() + x);
+      for (size_t i = x; i < row.size(); ++i) {
+        row[i].pos.x = i;
+      }
+    }
+    size.x -= 1;
+
+    shiftSpecialColumns(x, -1);
+    fixTargets(0, x, -1);
   }
 
-  bool isOnewayCube(const ci::Vec2i& pos) const {
+
+  bool isType(const ci::Vec2i& pos, const int type) const {
     auto* cube = getCube(ci::Vec3i(pos.x, 0, pos.y));
-    return cube && (cube->type & Cube::ONEWAY);
+    return cube && (cube->type & type);
   }
 
+  // TIPS:cube.posのx,zは常にbodyの添字と同じなので直接引ける(高さは無視)
   const Cube* const getCube(const ci::Vec3i& pos) const {
-    for (auto& rows : body) {
-      for (auto& cube : rows) {
-        // 高さは無視
-        if ((cube.pos.x == pos.x) && (cube.pos.z == pos.z)) return &cube;
-      }
-    }
+    if ((pos.z < 0) || (pos.z >= int(body.size()))) return nullptr;
+
+    const auto& row = body[pos.z];
+    if ((pos.x < 0) || (pos.x >= int(row.size()))) return nullptr;
 
-    return nullptr;
+    return &row[pos.x];
   }
 
   // TODO:constの有無でメソッドを使い分ける作戦
@@ -262,8 +360,115 @@ struct Stage {
         cube.cleanup();
       }
     }
+
+    for (auto& cubes : special_cubes) {
+      cubes.clear();
+    }
   }
   
+  // 別のStageとの差分だけを書き換える
+  // 書き換えたセルの数を返す
+  size_t applyDiff(const Stage& other) {
+    size_t changed = 0;
+
+    body.resize(other.body.size());
+    for (size_t z = 0; z < body.size(); ++z) {
+      auto& row = body[z];
+      const auto& other_row = other.body[z];
+
+      if (row.size() > other_row.size()) {
+        changed += row.size() - other_row.size();
+      }
+      row.resize(other_row.size());
+      for (size_t x = 0; x < row.size(); ++x) {
+        if (!row[x].isSame(other_row[x])) {
+          row[x] = other_row[x];
+          changed += 1;
+        }
+      }
+    }
+    size = other.size;
+    copyParams(other);
+
+    updateSpecialCubes();
+    return changed;
+  }
+
+  // 色や速度などのステージ全体の値を写す(bodyと大きさはそのまま)
+  void copyParams(const Stage& other) {
+    color    = other.color;
+    bg_color = other.bg_color;
+
+    x_offset = other.x_offset;
+    pickable = other.pickable;
+
+    build_speed    = other.build_speed;
+    collapse_speed = other.collapse_speed;
+    auto_collapse  = other.auto_collapse;
+
+    camera      = other.camera;
+    light_tween = other.light_tween;
+  }
+
+  // 行の挿入・削除に合わせて種類ごとのリストをずらす(削除した行にあったものは外す)
+  // TIPS:行優先に並んでいるので、z行目より後ろだけを見ればよい。並び順も崩れない
+  void shiftSpecialRows(const int z, const int delta) {
+    for (auto& cubes : special_cubes) {
+      auto first = std::lower_bound(cubes.begin(), cubes.end(), ci::Vec2i(0, z), lessPosition);
+      if (delta < 0) {
+        auto last = std::lower_bound(first, cubes.end(), ci::Vec2i(0, z + 1), lessPosition);
+        first = cubes.erase(first, last);
+      }
+      for (auto it = first; it != cubes.end(); ++it) {
+        it->y += delta;
+      }
+    }
+  }
+
+  // 列の挿入・削除に合わせて種類ごとのリストをずらす(削除した列にあったものは外す)
+  // TIPS:同じ行の中でずらすだけなので並び順は崩れない
+  void shiftSpecialColumns(const int x, const int delta) {
+    for (auto& cubes : special_cubes) {
+      if (delta < 0) {
+        cubes.erase(std::remove_if(cubes.begin(), cubes.end(),
+                                   [x](const ci::Vec2i& pos) { return pos.x == x; }),
+                    cubes.end());
+      }
+      for (auto& pos : cubes) {
+        if (pos.x >= x) pos.x += delta;
+      }
+    }
+  }
+
+  // 行や列の挿入・削除に合わせてスイッチの対象を付け替える
+  // axisは座標の要素(0:x 2:z)。削除した行や列を指す対象は消す
+  // 消した対象の数を返す
+  // TIPS:スイッチのリストをずらした後に呼ぶ(スイッチだけを見る)
+  size_t fixTargets(const int axis, const int index, const int delta) {
+    size_t removed = 0;
+    for (const auto& switch_pos : getSpecialCubes(Cube::SWITCH)) {
+      auto& cube = body[switch_pos.y][switch_pos.x];
+
+      std::vector<std::string> targets;
+      for (const auto& target : cube.target) {
+        auto pos = NumberFormat::parseIntList(target);
+        if (int(pos.size()) <= axis) {
+          targets.push_back(target);
+          continue;
+        }
+
+        if ((delta < 0) && (pos[axis] == index)) {
+          removed += 1;
+          continue;
+        }
+        if (pos[axis] >= index) pos[axis] += delta;
+        targets.push_back(NumberFormat::joinIntList(pos));
+      }
+      cube.target = std::move(targets);
+    }
+    return removed;
+  }
+
   void validate() {
     for (auto& row : body) {
       for (auto& cube : row) {
@@ -272,6 +477,13 @@ struct Stage {
         }
       }
     }
+    updateSpecialCubes();
+  }
+
+
+  // special_cubesの並び順
+  static bool lessPosition(const ci::Vec2i& a, const ci::Vec2i& b) {
+    return (a.y < b.y) || ((a.y == b.y) && (a.x < b.x));
   }
 
 };
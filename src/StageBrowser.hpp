@@ -0,0 +1,300 @@
+﻿#pragma once
+
+//
+// 全ステージのサムネイル一覧
+// サムネイルはワーカースレッドで作り、ステージ内容のハッシュ名でディスクにキャッシュする
+// 未保存の編集は写し(StageSnapshot)から描く(キャッシュしない)
+//
+// TIPS:ステージが変わって使わなくなったキャッシュは消す
+//      終了時には、どのステージからも使われていないファイルをまとめて消す
+//
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <future>
+#include <thread>
+#include <fstream>
+#include <iterator>
+#include <functional>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/Surface.h"
+#include "Stage.hpp"
+#include "StageSerializer.hpp"
+#include "StageRasterizer.hpp"
+#include "StageSnapshot.hpp"
+#include "NumberFormat.hpp"
+#include "Trace.hpp"
+
+
+namespace ngs {
+
+class StageBrowser {
+public:
+  // 描いたサムネイルと、保存したキャッシュのファイル名(写しから描いた時は空)
+  struct Thumbnail {
+    StageRasterizer::Image image;
+    std::string cache_name;
+  };
+
+  struct Entry {
+    std::string path;
+
+    ci::gl::TextureRef texture;
+    std::future<Thumbnail> making;
+    // 今使っているキャッシュのファイル名
+    std::string cache_name;
+    // 作り直しが必要
+    bool dirty;
+    // 未保存の編集(あればファイルの代わりに描く)
+    std::shared_ptr<const StageSnapshot> snapshot;
+
+    explicit Entry(const std::string& entry_path) :
+      path(entry_path),
+      dirty(true)
+    {}
+  };
+
+
+  // directory, cache_directoryは末尾に区切り文字を含むこと
+  StageBrowser(const std::vector<std::string>& stage_path,
+               const std::string& directory, const std::string& cache_directory,
+               const int cell_size) :
+    directory_(directory),
+    cache_directory_(cache_directory),
+    cell_size_(cell_size),
+    max_tasks_(std::max(1u, std::thread::hardware_concurrency())),
+    scroll_(0.0f)
+  {
+    for (const auto& path : stage_path) {
+      entries_.emplace_back(new Entry(path));
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(cache_directory_, ec);
+  }
+
+  ~StageBrowser() {
+    for (auto& entry : entries_) {
+      if (entry->making.valid()) entry->making.wait();
+    }
+    pruneCache();
+  }
+
+
+  // 出来上がったサムネイルをテクスチャにして、空いたスレッドで次を作る
+  // TIPS:テクスチャの生成はGLの都合でメインスレッドでおこなう
+  void update() {
+    size_t running = 0;
+    for (auto& entry : entries_) {
+      if (!entry->making.valid()) continue;
+
+      if (entry->making.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        running += 1;
+        continue;
+      }
+
+      try {
+        auto thumbnail = entry->making.get();
+        auto& image = thumbnail.image;
+        ci::Surface8u surface(image.pixels.data(), image.width, image.height, image.width * 4,
+                              ci::SurfaceChannelOrder::RGBA);
+        entry->texture = ci::gl::Texture::create(surface);
+
+        if (!thumbnail.cache_name.empty() && (thumbnail.cache_name != entry->cache_name)) {
+          auto old_name = entry->cache_name;
+          entry->cache_name = thumbnail.cache_name;
+          removeCache(old_name);
+        }
+      }
+      catch (const std::exception& e) {
+        ci::app::console() << "thumbnail failed:" << entry->path << " " << e.what() << std::endl;
+      }
+    }
+
+    for (auto& entry : entries_) {
+      if (running >= max_tasks_) break;
+      if (!entry->dirty || entry->making.valid()) continue;
+
+      const auto path  = directory_ + entry->path;
+      const auto cache = cache_directory_;
+      const int cell_size = cell_size_;
+      const auto snapshot = entry->snapshot;
+      entry->making = std::async(std::launch::async, [path, cache, cell_size, snapshot]() -> Thumbnail {
+          Trace::ThreadScope thread_scope;
+          if (snapshot) {
+            Trace::Scope trace_scope("thumbnail", path);
+            return Thumbnail{ StageRasterizer::rasterize(snapshot->toStage(), cell_size), std::string() };
+          }
+          return makeThumbnail(path, cache, cell_size);
+        });
+      entry->dirty = false;
+      running += 1;
+    }
+  }
+
+  // ステージが書き換えられたので作り直す
+  // TIPS:保存した時もここを通るので、未保存の編集の写しは捨ててファイルから描く
+  void invalidate(const std::string& path) {
+    for (auto& entry : entries_) {
+      if (entry->path != path) continue;
+
+      entry->dirty = true;
+      entry->snapshot.reset();
+    }
+  }
+
+  // 未保存の編集を描く
+  // 同じ写しなら作り直さない
+  void assign(const std::string& path, const std::shared_ptr<const StageSnapshot>& snapshot) {
+    for (auto& entry : entries_) {
+      if ((entry->path != path) || (entry->snapshot == snapshot)) continue;
+
+      entry->dirty = true;
+      entry->snapshot = snapshot;
+    }
+  }
+
+
+  // 画面上の並び
+  // 幅box.xの枠を左上から横に並べ、縦長のステージは枠の高さに収める
+  ci::Rectf getRect(const size_t index, const ci::Vec2i& box, const float window_width) const {
+    const int margin = 8;
+    int columns = std::max(1, int(window_width - margin) / (box.x + margin));
+
+    float x = margin + (index % columns) * (box.x + margin);
+    float y = margin + (index / columns) * (box.y + margin + 14) + scroll_;
+    return ci::Rectf(x, y, x + box.x, y + box.y);
+  }
+
+  // 枠の縦横比に合わせたサムネイルの表示位置
+  ci::Rectf getImageRect(const size_t index, const ci::Vec2i& box, const float window_width) const {
+    auto rect = getRect(index, box, window_width);
+
+    const auto& texture = entries_[index]->texture;
+    if (!texture) return rect;
+
+    float scale = std::min(rect.getWidth() / texture->getWidth(), rect.getHeight() / texture->getHeight());
+    float w = texture->getWidth() * scale;
+    float h = texture->getHeight() * scale;
+    return ci::Rectf(rect.x1 + (rect.getWidth() - w) / 2, rect.y1,
+                     rect.x1 + (rect.getWidth() + w) / 2, rect.y1 + h);
+  }
+
+  // 画面位置のステージ番号(無ければ-1)
+  int findEntry(const ci::Vec2f& pos, const ci::Vec2i& box, const float window_width) const {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      if (getRect(i, box, window_width).contains(pos)) return int(i);
+    }
+    return -1;
+  }
+
+  void scroll(const float amount) {
+    scroll_ = std::min(scroll_ + amount, 0.0f);
+  }
+
+
+  const std::vector<std::unique_ptr<Entry> >& getEntries() const {
+    return entries_;
+  }
+
+
+  // ファイル内容のハッシュ(FNV-1a 64bit)
+  static uint64_t hash(const std::string& data, uint64_t value = 14695981039346656037ULL) {
+    for (unsigned char c : data) {
+      value ^= c;
+      value *= 1099511628211ULL;
+    }
+    return value;
+  }
+
+  // キャッシュが無ければ描いて保存する
+  static Thumbnail makeThumbnail(const std::string& path, const std::string& cache_directory,
+                                              const int cell_size) {
+    Trace::Scope trace_scope("thumbnail", path);
+
+    std::string text;
+    {
+      std::ifstream file(path, std::ios::binary);
+      if (!file) throw std::runtime_error("can't read " + path);
+      text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    Trace::counter("read bytes", text.size());
+
+    // TIPS:描画サイズもキーに含める
+    char name[32];
+    NumberFormat::formatText(name, sizeof(name), "%016llx-%d.png",
+                             (unsigned long long)hash(text), cell_size);
+    auto cache_path = cache_directory + name;
+
+    {
+      std::ifstream file(cache_path, std::ios::binary);
+      if (file) {
+        std::vector<uint8_t> png((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        StageRasterizer::Image image(1, 1);
+        if (StageRasterizer::decodePng(png, image)) return Thumbnail{ image, name };
+      }
+    }
+
+    auto image = StageRasterizer::rasterize(StageSerializer::makeStage(ci::JsonTree(text)), cell_size);
+
+    // 書き込み途中のファイルを他から読ませない
+    auto temp_path = cache_path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    StageRasterizer::writePng(image, temp_path);
+    boost::system::error_code ec;
+    boost::filesystem::rename(temp_path, cache_path, ec);
+    if (ec) boost::filesystem::remove(temp_path, ec);
+
+    return Thumbnail{ image, name };
+  }
+
+
+private:
+  std::vector<std::unique_ptr<Entry> > entries_;
+
+  std::string directory_;
+  std::string cache_directory_;
+  int cell_size_;
+
+  size_t max_tasks_;
+  float scroll_;
+
+
+  bool isCacheUsed(const std::string& name) const {
+    return std::any_of(entries_.begin(), entries_.end(), [&name](const std::unique_ptr<Entry>& entry) {
+        return entry->cache_name == name;
+      });
+  }
+
+  // 使われなくなったキャッシュを消す
+  // TIPS:内容が同じステージは同じファイルを使うので、他が使っていれば残す
+  void removeCache(const std::string& name) {
+    if (name.empty() || isCacheUsed(name)) return;
+
+    boost::system::error_code ec;
+    boost::filesystem::remove(cache_directory_ + name, ec);
+  }
+
+  // どのステージも使っていないファイルを消す
+  // TIPS:まだ描いていないステージがある時は、使うキャッシュが分からないので何もしない
+  void pruneCache() {
+    for (const auto& entry : entries_) {
+      if (entry->cache_name.empty()) return;
+    }
+
+    boost::system::error_code ec;
+    std::vector<boost::filesystem::path> files;
+    for (boost::filesystem::directory_iterator it(cache_directory_, ec), end; !ec && (it != end); it.increment(ec)) {
+      if (!isCacheUsed(it->path().filename().string())) files.push_back(it->path());
+    }
+    for (const auto& file : files) {
+      boost::filesystem::remove(file, ec);
+    }
+  }
+
+};
+
+}
@@ -0,0 +1,472 @@
+﻿#pragma once
+
+//
+// 巨大なステージをタイルに分けて保存し、表示範囲のタイルだけを読み込む
+//
+//   <directory>/chunks.json   大きさ・タイルの大きさ・色や速度などのステージ全体の値
+//   <directory>/<x>_<z>.json  1タイル分のbody(ランレングス)と特殊なキューブ(位置はタイル内の座標)
+//
+// 開く時は見出しだけを読む。表示範囲のタイルを別スレッドで読み込み、
+// 使用量がbudgetを超えたら表示範囲外の古いタイルから破棄する
+// 編集したタイルは破棄する時かflushで、そのタイルだけを書き戻す
+//
+// TIPS:平らな(高さ0で特殊なキューブが無い)タイルはファイルを作らない
+//      スイッチの対象はステージ全体の座標のまま持つ
+//
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <cmath>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem.hpp>
+#include "Stage.hpp"
+#include "StageSerializer.hpp"
+#include "JsonUtil.hpp"
+#include "JsonWriter.hpp"
+#include "NumberFormat.hpp"
+#include "FileUtil.hpp"
+#include "Trace.hpp"
+
+
+namespace ngs {
+
+class StageChunks : private boost::noncopyable {
+public:
+  enum {
+    VERSION = 1,
+    DEFAULT_CHUNK_SIZE = 64,
+  };
+
+  struct Chunk {
+    // タイルの番号(x, z)と先頭のセルの位置
+    ci::Vec2i index;
+    ci::Vec2i origin;
+
+    std::unique_ptr<Stage> stage;
+    std::future<Stage> loading;
+    bool dirty;
+    // 読めなかったタイルは読み直さない
+    bool failed;
+
+    // 最後に表示範囲に入ったupdateの番号と、読み込んだ量の見積もり
+    size_t last_used;
+    size_t bytes;
+
+    Chunk(const ci::Vec2i& chunk_index, const int chunk_size) :
+      index(chunk_index),
+      origin(chunk_index * chunk_size),
+      dirty(false),
+      failed(false),
+      last_used(0),
+      bytes(0)
+    {}
+  };
+
+
+  // 見出しだけを読む。budgetは読み込んでおくタイルの量(バイト)
+  StageChunks(const std::string& directory, const size_t budget) :
+    directory_(directory),
+    budget_(budget),
+    serial_(0)
+  {
+    auto params = Json::readFromPath(getHeaderPath(directory_));
+    int version = Json::getValue(params, "version", 0);
+    if (version != VERSION) {
+      throw std::runtime_error("StageChunks: unsupported version " + NumberFormat::toString(version));
+    }
+
+    StageSerializer::readParams(params, params_);
+    params_.size = Json::getVec2<int>(params["size"]);
+    chunk_size_  = params["chunk_size"].getValue<int>();
+    if ((chunk_size_ <= 0) || (params_.size.x <= 0) || (params_.size.y <= 0)) {
+      throw std::runtime_error("StageChunks: bad size in " + getHeaderPath(directory_));
+    }
+
+    num_chunks_ = (params_.size + ci::Vec2i(chunk_size_ - 1, chunk_size_ - 1)) / chunk_size_;
+    // TIPS:タイルは触れた時に作る(巨大なステージでも開く時間は変わらない)
+    chunks_.resize(num_chunks_.x * num_chunks_.y);
+  }
+
+
+  static bool isChunked(const std::string& directory) {
+    return boost::filesystem::exists(getHeaderPath(directory));
+  }
+
+  // ステージを分割して書き出す。ファイルを書いたタイルの数を返す
+  static size_t create(const Stage& stage, const std::string& directory, const int chunk_size) {
+    if (chunk_size <= 0) throw std::invalid_argument("StageChunks: chunk size must be positive");
+
+    boost::filesystem::create_directories(directory);
+
+    auto header = JsonWriter::Value::makeObject()
+      .addChild("version", int(VERSION))
+      .addChild("size", JsonWriter::Value::makeArray().pushBack(stage.size.x).pushBack(stage.size.y))
+      .addChild("chunk_size", chunk_size);
+    StageSerializer::writeParams(stage, header);
+    writeFile(getHeaderPath(directory), header.write());
+
+    size_t num = 0;
+    for (int z = 0; z < stage.size.y; z += chunk_size) {
+      for (int x = 0; x < stage.size.x; x += chunk_size) {
+        ci::Vec2i index(x / chunk_size, z / chunk_size);
+        auto tile = extract(stage, ci::Vec2i(x, z), ci::Vec2i(chunk_size, chunk_size));
+        if (writeChunk(tile, getChunkPath(directory, index))) num += 1;
+      }
+    }
+    return num;
+  }
+
+  // 全タイルを読んで1つのステージにする
+  // TIPS:読み込み済みのタイルは編集中の内容を使う
+  Stage toStage() const {
+    Stage stage = params_;
+    stage.resize();
+
+    for (int cz = 0; cz < num_chunks_.y; ++cz) {
+      for (int cx = 0; cx < num_chunks_.x; ++cx) {
+        ci::Vec2i index(cx, cz);
+        const auto* chunk = chunks_[cz * num_chunks_.x + cx].get();
+
+        Stage loaded;
+        const Stage* tile = (chunk && chunk->stage) ? chunk->stage.get() : nullptr;
+        if (!tile) {
+          loaded = readChunk(getChunkPath(directory_, index), getChunkSize(index), params_);
+          tile = &loaded;
+        }
+
+        ci::Vec2i origin = index * chunk_size_;
+        for (const auto& row : tile->body) {
+          for (const auto& cube : row) {
+            auto& dest = stage.body[origin.y + cube.pos.z][origin.x + cube.pos.x];
+            dest = cube;
+            dest.pos.x += origin.x;
+            dest.pos.z += origin.y;
+          }
+        }
+      }
+    }
+    stage.updateSpecialCubes();
+
+    return stage;
+  }
+
+
+  // 表示範囲(セルの座標)に合わせて読み込みと破棄をおこなう
+  void update(const ci::Vec2f& view_min, const ci::Vec2f& view_max) {
+    serial_ += 1;
+
+    for (auto i : resident_) {
+      auto& chunk = *chunks_[i];
+      if (chunk.loading.valid()
+          && (chunk.loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+        try {
+          chunk.stage = std::unique_ptr<Stage>(new Stage(chunk.loading.get()));
+          chunk.bytes = estimateBytes(*chunk.stage);
+        }
+        catch (const std::exception& e) {
+          ci::app::console() << "chunk load failed:" << getChunkPath(directory_, chunk.index) << " " << e.what() << std::endl;
+          chunk.failed = true;
+          chunk.bytes  = 0;
+        }
+      }
+    }
+    resident_.erase(std::remove_if(resident_.begin(), resident_.end(), [this](const size_t i) {
+          return chunks_[i]->failed;
+        }), resident_.end());
+
+    // 表示範囲のタイルに印を付ける
+    ci::Vec2i first = toChunkIndex(view_min);
+    ci::Vec2i last  = toChunkIndex(view_max);
+    std::vector<size_t> wanted;
+    for (int cz = first.y; cz <= last.y; ++cz) {
+      for (int cx = first.x; cx <= last.x; ++cx) {
+        size_t i = cz * num_chunks_.x + cx;
+        if (!chunks_[i]) {
+          chunks_[i] = std::unique_ptr<Chunk>(new Chunk(ci::Vec2i(cx, cz), chunk_size_));
+        }
+
+        auto& chunk = *chunks_[i];
+        chunk.last_used = serial_;
+        if (!chunk.stage && !chunk.loading.valid() && !chunk.failed) wanted.push_back(i);
+      }
+    }
+
+    size_t wanted_bytes = 0;
+    for (auto i : wanted) {
+      wanted_bytes += estimateBytes(getChunkSize(chunks_[i]->index));
+    }
+    evict(std::min(wanted_bytes, budget_));
+
+    // 同時に読むのはスレッドの数まで。budgetを超える分は次のフレームに回す
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t num_loading = std::count_if(resident_.begin(), resident_.end(), [this](const size_t i) {
+        return chunks_[i]->loading.valid();
+      });
+    size_t bytes = getResidentBytes();
+    for (auto i : wanted) {
+      if (num_loading >= num_threads) break;
+
+      auto& chunk = *chunks_[i];
+      const auto size = getChunkSize(chunk.index);
+      size_t estimate = estimateBytes(size);
+      if ((bytes + estimate) > budget_) break;
+
+      const auto path = getChunkPath(directory_, chunk.index);
+      // TIPS:params_は開いた後は書き換えない(chunks_より先に破棄されることもない)
+      const auto& params = params_;
+      chunk.loading = std::async(std::launch::async, [path, size, &params]() {
+          Trace::ThreadScope thread_scope;
+          Trace::Scope trace_scope("chunk", path);
+          return readChunk(path, size, params);
+        });
+      chunk.bytes = estimate;
+      resident_.push_back(i);
+
+      num_loading += 1;
+      bytes += estimate;
+    }
+  }
+
+  // 編集したタイルを全て書き戻す。書き戻したタイルの数を返す
+  size_t flush() {
+    size_t num = 0;
+    for (auto i : resident_) {
+      auto& chunk = *chunks_[i];
+      if (!chunk.dirty || !chunk.stage) continue;
+
+      writeBack(chunk);
+      num += 1;
+    }
+    return num;
+  }
+
+
+  // 読み込み済みのタイル(無ければnullptr)
+  Chunk* findChunk(const ci::Vec2i& pos) {
+    if ((pos.x < 0) || (pos.x >= params_.size.x) || (pos.y < 0) || (pos.y >= params_.size.y)) return nullptr;
+
+    auto* chunk = chunks_[(pos.y / chunk_size_) * num_chunks_.x + (pos.x / chunk_size_)].get();
+    return (chunk && chunk->stage) ? chunk : nullptr;
+  }
+
+  const Stage::Cube* getCube(const ci::Vec2i& pos) {
+    const auto* chunk = findChunk(pos);
+    if (!chunk) return nullptr;
+
+    auto local = pos - chunk->origin;
+    return chunk->stage->getCube(ci::Vec3i(local.x, 0, local.y));
+  }
+
+
+  // 読み込み中と読み込み済みのタイル
+  std::vector<const Chunk*> getResident() const {
+    std::vector<const Chunk*> chunks;
+    for (auto i : resident_) {
+      chunks.push_back(chunks_[i].get());
+    }
+    return chunks;
+  }
+
+  size_t getResidentBytes() const {
+    size_t bytes = 0;
+    for (auto i : resident_) {
+      bytes += chunks_[i]->bytes;
+    }
+    return bytes;
+  }
+
+  size_t getNumDirty() const {
+    return std::count_if(resident_.begin(), resident_.end(), [this](const size_t i) {
+        return chunks_[i]->dirty;
+      });
+  }
+
+  // 色や速度などの値と、ステージ全体の大きさ(bodyは空)
+  const Stage& getParams() const {
+    return params_;
+  }
+
+  // 端のタイルは小さくなる
+  ci::Vec2i getChunkSize(const ci::Vec2i& index) const {
+    ci::Vec2i origin = index * chunk_size_;
+    return ci::Vec2i(std::min(chunk_size_, params_.size.x - origin.x),
+                     std::min(chunk_size_, params_.size.y - origin.y));
+  }
+
+  const std::string& getDirectory() const {
+    return directory_;
+  }
+
+
+  static std::string getHeaderPath(const std::string& directory) {
+    return (boost::filesystem::path(directory) / "chunks.json").string();
+  }
+
+  static std::string getChunkPath(const std::string& directory, const ci::Vec2i& index) {
+    auto name = NumberFormat::toString(index.x) + "_" + NumberFormat::toString(index.y) + ".json";
+    return (boost::filesystem::path(directory) / name).string();
+  }
+
+  // stageのposからsizeの範囲を切り出す(位置は切り出した範囲の座標になる)
+  static Stage extract(const Stage& stage, const ci::Vec2i& pos, const ci::Vec2i& size) {
+    Stage tile;
+    tile.copyParams(stage);
+    tile.size.x = std::min(size.x, stage.size.x - pos.x);
+    tile.size.y = std::min(size.y, stage.size.y - pos.y);
+    tile.resize();
+
+    for (int z = 0; z < tile.size.y; ++z) {
+      for (int x = 0; x < tile.size.x; ++x) {
+        const auto* cube = stage.getCube(ci::Vec3i(pos.x + x, 0, pos.y + z));
+        if (!cube) continue;
+
+        auto& dest = tile.body[z][x];
+        dest = *cube;
+        dest.pos.x = x;
+        dest.pos.z = z;
+      }
+    }
+    tile.updateSpecialCubes();
+
+    return tile;
+  }
+
+  static bool isFlat(const Stage& stage) {
+    for (const auto& row : stage.body) {
+      for (const auto& cube : row) {
+        if ((cube.pos.y != 0) || (cube.type != Stage::Cube::NONE)) return false;
+      }
+    }
+    return true;
+  }
+
+  // ファイルが無ければ平らなタイル。色などはparamsの値を使う
+  static Stage readChunk(const std::string& path, const ci::Vec2i& size, const Stage& params) {
+    Stage stage;
+    stage.copyParams(params);
+    if (boost::filesystem::exists(path)) {
+      StageSerializer::readBody(Json::readFromPath(path), stage);
+    }
+
+    // TIPS:足りない所は平らに埋め、はみ出した所は捨てる
+    if (stage.size != size) {
+      stage.size = size;
+      stage.resize();
+    }
+    return stage;
+  }
+
+  // 平らなタイルはファイルを消す。ファイルを書いたらtrue
+  static bool writeChunk(const Stage& stage, const std::string& path) {
+    if (isFlat(stage)) {
+      boost::filesystem::remove(path);
+      return false;
+    }
+
+    auto tile = JsonWriter::Value::makeObject();
+    StageSerializer::writeBody(stage, tile, StageSerializer::BODY_RLE);
+    writeFile(path, tile.write());
+    return true;
+  }
+
+  // 読み込む前の見積もり
+  static size_t estimateBytes(const ci::Vec2i& size) {
+    return size.x * size.y * sizeof(Stage::Cube);
+  }
+
+  static size_t estimateBytes(const Stage& stage) {
+    size_t bytes = sizeof(Stage);
+    for (const auto& row : stage.body) {
+      bytes += row.capacity() * sizeof(Stage::Cube);
+    }
+    for (const auto& cubes : stage.special_cubes) {
+      bytes += cubes.capacity() * sizeof(ci::Vec2i);
+    }
+    return bytes;
+  }
+
+
+private:
+  std::string directory_;
+  size_t budget_;
+
+  Stage params_;
+  int chunk_size_;
+  ci::Vec2i num_chunks_;
+
+  // z * num_chunks_.x + x に置く(触れていないタイルはnullptr)
+  std::vector<std::unique_ptr<Chunk> > chunks_;
+  // 読み込み中か読み込み済みのタイルの添字
+  std::vector<size_t> resident_;
+  size_t serial_;
+
+
+  ci::Vec2i toChunkIndex(const ci::Vec2f& pos) const {
+    ci::Vec2i index(int(std::floor(pos.x)) / chunk_size_, int(std::floor(pos.y)) / chunk_size_);
+    index.x = std::min(std::max(index.x, 0), num_chunks_.x - 1);
+    index.y = std::min(std::max(index.y, 0), num_chunks_.y - 1);
+    return index;
+  }
+
+  // これから読むneededの分を空けるまで、表示範囲外のタイルを古い順に破棄する
+  void evict(const size_t needed) {
+    size_t bytes = getResidentBytes();
+    if ((bytes + needed) <= budget_) return;
+
+    std::vector<size_t> order;
+    for (auto i : resident_) {
+      const auto& chunk = *chunks_[i];
+      if (chunk.stage && (chunk.last_used != serial_)) order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [this](const size_t a, const size_t b) {
+        return chunks_[a]->last_used < chunks_[b]->last_used;
+      });
+
+    for (auto i : order) {
+      if ((bytes + needed) <= budget_) break;
+
+      auto& chunk = *chunks_[i];
+      if (chunk.dirty) {
+        try {
+          writeBack(chunk);
+        }
+        catch (const std::exception& e) {
+          // 書けなかったタイルは残しておく
+          ci::app::console() << "chunk write failed:" << getChunkPath(directory_, chunk.index) << " " << e.what() << std::endl;
+          continue;
+        }
+      }
+
+      bytes -= chunk.bytes;
+      chunk.stage.reset();
+      chunk.bytes = 0;
+    }
+
+    resident_.erase(std::remove_if(resident_.begin(), resident_.end(), [this](const size_t i) {
+          return !chunks_[i]->stage && !chunks_[i]->loading.valid();
+        }), resident_.end());
+  }
+
+  void writeBack(Chunk& chunk) {
+    const auto path = getChunkPath(directory_, chunk.index);
+    Trace::Scope trace_scope("save chunk", path);
+
+    chunk.stage->validate();
+    writeChunk(*chunk.stage, path);
+    chunk.dirty = false;
+  }
+
+  // 一時ファイルに書いてから置き換える(失敗したら例外で、元のファイルはそのまま)
+  static void writeFile(const std::string& path, const std::string& text) {
+    FileUtil::writeAtomic(path, [&text](std::ostream& file) { file << text; });
+  }
+
+};
+
+}
@@ -0,0 +1,175 @@
+﻿#pragma once
+
+//
+// startline + 各ステージ + finishline を一続きに並べたコース
+// 表示範囲のステージだけを読み込み、範囲外は破棄する
+//
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <future>
+#include <algorithm>
+#include "Stage.hpp"
+#include "StageSerializer.hpp"
+
+
+namespace ngs {
+
+class StageCourse {
+public:
+  struct Entry {
+    std::string path;
+
+    // コース上の開始位置と長さ(読み込むまでは推定値)
+    int z;
+    int length;
+    int x_offset;
+
+    std::unique_ptr<Stage> stage;
+    std::future<Stage> loading;
+    bool modified;
+
+    explicit Entry(const std::string& entry_path) :
+      path(entry_path),
+      z(0),
+      length(0),
+      x_offset(0),
+      modified(false)
+    {}
+  };
+
+
+  StageCourse(const std::vector<std::string>& stage_path, const int default_length) :
+    default_length_(default_length)
+  {
+    for (const auto& path : makeCourseOrder(stage_path)) {
+      entries_.emplace_back(new Entry(path));
+      entries_.back()->length = default_length_;
+    }
+    layout();
+  }
+
+
+  // startlineを先頭、finishlineを末尾に並べる
+  static std::vector<std::string> makeCourseOrder(const std::vector<std::string>& stage_path) {
+    std::vector<std::string> order;
+
+    bool has_start  = std::find(stage_path.begin(), stage_path.end(), "startline.json") != stage_path.end();
+    bool has_finish = std::find(stage_path.begin(), stage_path.end(), "finishline.json") != stage_path.end();
+
+    if (has_start) order.push_back("startline.json");
+    for (const auto& path : stage_path) {
+      if ((path == "startline.json") || (path == "finishline.json")) continue;
+      order.push_back(path);
+    }
+    if (has_finish) order.push_back("finishline.json");
+
+    return order;
+  }
+
+
+  // 表示範囲[z_min, z_max]に合わせて読み込みと破棄をおこなう
+  void update(const float z_min, const float z_max) {
+    bool relayout = false;
+
+    for (auto& entry : entries_) {
+      if (entry->loading.valid()
+          && (entry->loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+        try {
+          entry->stage = std::unique_ptr<Stage>(new Stage(entry->loading.get()));
+          relayout = relayout || (entry->length != entry->stage->size.y);
+          entry->length   = entry->stage->size.y;
+          entry->x_offset = entry->stage->x_offset;
+        }
+        catch (const std::exception& e) {
+          ci::app::console() << "course load failed:" << entry->path << " " << e.what() << std::endl;
+        }
+      }
+
+      bool visible = (entry->z < z_max) && ((entry->z + entry->length) > z_min);
+      if (visible) {
+        if (!entry->stage && !entry->loading.valid()) {
+          const auto path = entry->path;
+          entry->loading = std::async(std::launch::async, [path]() {
+              return StageSerializer::deserialize(path);
+            });
+        }
+      }
+      else if (entry->stage && !entry->modified) {
+        // TIPS:編集中のステージは破棄しない
+        entry->stage.reset();
+      }
+    }
+
+    if (relayout) layout();
+  }
+
+  // 編集中のステージで置き換える
+  void assign(const std::string& path, const Stage& stage) {
+    auto* entry = findEntry(path);
+    if (!entry) return;
+
+    entry->stage = std::unique_ptr<Stage>(new Stage(stage));
+    entry->modified = true;
+    entry->length   = stage.size.y;
+    entry->x_offset = stage.x_offset;
+    layout();
+  }
+
+  // 外部で書き換えられたので次に表示する時に読み直す
+  void invalidate(const std::string& path) {
+    for (auto& entry : entries_) {
+      if ((entry->path == path) && !entry->modified) {
+        entry->stage.reset();
+      }
+    }
+  }
+
+
+  Entry* findEntry(const float z) {
+    for (auto& entry : entries_) {
+      if ((z >= entry->z) && (z < (entry->z + entry->length))) return entry.get();
+    }
+    return nullptr;
+  }
+
+  Entry* findEntry(const std::string& path) {
+    for (auto& entry : entries_) {
+      if (entry->path == path) return entry.get();
+    }
+    return nullptr;
+  }
+
+  const std::vector<std::unique_ptr<Entry> >& getEntries() const {
+    return entries_;
+  }
+
+  int getLength() const {
+    return entries_.empty() ? 0 : entries_.back()->z + entries_.back()->length;
+  }
+
+  size_t getNumLoaded() const {
+    return std::count_if(entries_.begin(), entries_.end(),
+                         [](const std::unique_ptr<Entry>& entry) {
+                           return bool(entry->stage);
+                         });
+  }
+
+
+private:
+  std::vector<std::unique_ptr<Entry> > entries_;
+  int default_length_;
+
+
+  void layout() {
+    int z = 0;
+    for (auto& entry : entries_) {
+      entry->z = z;
+      z += entry->length;
+    }
+  }
+
+};
+
+}
@@ -0,0 +1,228 @@
+﻿#pragma once
+
+//
+// Stage同士の差分
+// 行ごとに比べて、同じ行は読み飛ばす
+//
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include "Stage.hpp"
+#include "CubeTraits.hpp"
+
+
+namespace ngs {
+namespace StageDiff {
+
+struct CellChange {
+  enum {
+    HEIGHT  = 1 << 0,
+    TYPE    = 1 << 1,
+    PAYLOAD = 1 << 2,
+    ADDED   = 1 << 3,
+    REMOVED = 1 << 4,
+  };
+
+  ci::Vec2i pos;
+  int kind;
+
+  // ADDED/REMOVEDでは存在しない側は0
+  const Stage::Cube* from;
+  const Stage::Cube* to;
+};
+
+struct ParamChange {
+  std::string name;
+  std::string from;
+  std::string to;
+};
+
+struct Result {
+  std::vector<CellChange> cells;
+  std::vector<ParamChange> params;
+
+  bool empty() const {
+    return cells.empty() && params.empty();
+  }
+};
+
+
+std::string typeName(const int type) {
+  const auto* info = findCubeTypeInfo(type);
+  return info ? info->name : "none";
+}
+
+
+// 種類ごとに意味のある付加情報だけを比べる
+bool isSamePayload(const Stage::Cube& a, const Stage::Cube& b) {
+  if (a.type != b.type) return false;
+
+  switch (a.type) {
+  case Stage::Cube::MOVING:
+    return a.pattern == b.pattern;
+
+  case Stage::Cube::SWITCH:
+    return a.target == b.target;
+
+  case Stage::Cube::FALLING:
+    return (a.interval == b.interval) && (a.delay == b.delay);
+
+  case Stage::Cube::ONEWAY:
+    return (a.direction == b.direction) && (a.power == b.power);
+  }
+  return true;
+}
+
+// diffRowで何も出てこない行か
+// TIPS:行を詰め直したりハッシュを作ったりせず、違うセルが見つかったらそこで止める
+bool isSameRow(const std::vector<Stage::Cube>& from, const std::vector<Stage::Cube>& to) {
+  if (from.size() != to.size()) return false;
+
+  for (size_t x = 0; x < from.size(); ++x) {
+    if ((from[x].pos.y != to[x].pos.y) || !isSamePayload(from[x], to[x])) return false;
+  }
+  return true;
+}
+
+
+template <typename T>
+void diffParam(Result& result, const std::string& name, const T& from, const T& to) {
+  if (from == to) return;
+
+  std::ostringstream from_text;
+  from_text << from;
+  std::ostringstream to_text;
+  to_text << to;
+  result.params.push_back({ name, from_text.str(), to_text.str() });
+}
+
+void diffColor(Result& result, const std::string& name, const ci::Color& from, const ci::Color& to) {
+  if (from == to) return;
+
+  std::ostringstream from_text;
+  from_text << "[" << from.r << ", " << from.g << ", " << from.b << "]";
+  std::ostringstream to_text;
+  to_text << "[" << to.r << ", " << to.g << ", " << to.b << "]";
+  result.params.push_back({ name, from_text.str(), to_text.str() });
+}
+
+
+void diffRow(Result& result, const int z,
+             const std::vector<Stage::Cube>& from, const std::vector<Stage::Cube>& to) {
+  size_t num = std::max(from.size(), to.size());
+  for (size_t x = 0; x < num; ++x) {
+    CellChange change;
+    change.pos  = ci::Vec2i(int(x), z);
+    change.kind = 0;
+    change.from = (x < from.size()) ? &from[x] : nullptr;
+    change.to   = (x < to.size()) ? &to[x] : nullptr;
+
+    if (!change.from) {
+      change.kind = CellChange::ADDED;
+    }
+    else if (!change.to) {
+      change.kind = CellChange::REMOVED;
+    }
+    else {
+      if (change.from->pos.y != change.to->pos.y) change.kind |= CellChange::HEIGHT;
+      if (change.from->type != change.to->type) change.kind |= CellChange::TYPE;
+      else if (!isSamePayload(*change.from, *change.to)) change.kind |= CellChange::PAYLOAD;
+    }
+
+    if (change.kind) result.cells.push_back(change);
+  }
+}
+
+
+// 結果はfrom/toのセルを指すので、両方のStageより長く保持しないこと
+Result diff(const Stage& from, const Stage& to) {
+  Result result;
+
+  size_t rows = std::max(from.body.size(), to.body.size());
+  for (size_t z = 0; z < rows; ++z) {
+    static const std::vector<Stage::Cube> empty_row;
+    const auto& from_row = (z < from.body.size()) ? from.body[z] : empty_row;
+    const auto& to_row   = (z < to.body.size()) ? to.body[z] : empty_row;
+
+    // 同じ行は調べない
+    if (isSameRow(from_row, to_row)) continue;
+
+    diffRow(result, int(z), from_row, to_row);
+  }
+
+  diffParam(result, "width",  from.size.x, to.size.x);
+  diffParam(result, "length", from.size.y, to.size.y);
+
+  diffColor(result, "color",    from.color,    to.color);
+  diffColor(result, "bg_color", from.bg_color, to.bg_color);
+
+  diffParam(result, "x_offset", from.x_offset, to.x_offset);
+  diffParam(result, "pickable", from.pickable, to.pickable);
+
+  diffParam(result, "build_speed",    from.build_speed,    to.build_speed);
+  diffParam(result, "collapse_speed", from.collapse_speed, to.collapse_speed);
+  diffParam(result, "auto_collapse",  from.auto_collapse,  to.auto_collapse);
+
+  diffParam(result, "camera",      from.camera,      to.camera);
+  diffParam(result, "light_tween", from.light_tween, to.light_tween);
+
+  return result;
+}
+
+
+std::string describePayload(const Stage::Cube& cube) {
+  std::ostringstream text;
+  switch (cube.type) {
+  case Stage::Cube::MOVING:
+    text << "pattern [" << cube.pattern << "]";
+    break;
+
+  case Stage::Cube::SWITCH:
+    text << "target";
+    for (const auto& t : cube.target) {
+      text << " [" << t << "]";
+    }
+    break;
+
+  case Stage::Cube::FALLING:
+    text << "interval " << cube.interval << " delay " << cube.delay;
+    break;
+
+  case Stage::Cube::ONEWAY:
+    text << "direction " << cube.direction << " power " << cube.power;
+    break;
+  }
+  return text.str();
+}
+
+// 1変更1行で書き出す
+void write(std::ostream& output, const Result& result) {
+  for (const auto& p : result.params) {
+    output << "param " << p.name << ": " << p.from << " -> " << p.to << "\n";
+  }
+
+  for (const auto& c : result.cells) {
+    output << "cell [" << c.pos.x << ", " << c.pos.y << "]";
+
+    if (c.kind & CellChange::ADDED) {
+      output << " added height " << c.to->pos.y << " type " << typeName(c.to->type);
+    }
+    if (c.kind & CellChange::REMOVED) {
+      output << " removed";
+    }
+    if (c.kind & CellChange::HEIGHT) {
+      output << " height " << c.from->pos.y << " -> " << c.to->pos.y;
+    }
+    if (c.kind & CellChange::TYPE) {
+      output << " type " << typeName(c.from->type) << " -> " << typeName(c.to->type);
+    }
+    if (c.kind & CellChange::PAYLOAD) {
+      output << " " << describePayload(*c.from) << " -> " << describePayload(*c.to);
+    }
+    output << "\n";
+  }
+}
+
+}
+}
@@ -6,48 +6,49 @@
 
 #include "cinder/gl/gl.h"
 #include "Stage.hpp"
+#include "CubeTraits.hpp"
+#include "StageCourse.hpp"
+#include "StageChunks.hpp"
+#include "StageDiff.hpp"
+#include "StageBrowser.hpp"
+#include "StageLint.hpp"
+#include "StageTimeline.hpp"
 
 
 namespace ngs {
 namespace StageDrawer {
 
 
+void drawCube(const Stage::Cube& cube) {
+  float size = 0.9;
+  ci::Rectf rect(cube.pos.x, cube.pos.z, cube.pos.x + size, cube.pos.z + size);
+  ci::gl::drawSolidRect(rect);
+}
+
 void draw(const Stage& stage) {
+  // 全セルを地の色で塗ってから、特殊なキューブだけを種類の色で塗り直す
+  ci::gl::color(stage.color);
   for (const auto& rows : stage.body) {
     for (const auto& cube : rows) {
       if (cube.pos.y < 0) continue;
+      drawCube(cube);
+    }
+  }
 
-      switch (cube.type) {
-      case Stage::Cube::ITEM:
-        ci::gl::color(1, 1, 0);
-        break;
-
-      case Stage::Cube::MOVING:
-        ci::gl::color(0, 1, 0);
-        break;
-
-      case Stage::Cube::SWITCH:
-        ci::gl::color(1, 0, 1);
-        break;
-
-      case Stage::Cube::FALLING:
-        ci::gl::color(1, 0.5, 0);
-        break;
-
-      case Stage::Cube::ONEWAY:
-        ci::gl::color(0, 0.5, 1);
-        break;
-
-      default:
-        ci::gl::color(stage.color);
-        break;
-      }
-      
-      float size = 0.9;      
-      ci::Rectf rect(cube.pos.x, cube.pos.z, cube.pos.x + size, cube.pos.z + size);
-      ci::gl::drawSolidRect(rect);
+  const auto& infos = getCubeTypeInfo();
+  for (size_t i = 0; i < infos.size(); ++i) {
+    ci::gl::color(infos[i].color);
+    for (const auto& pos : stage.special_cubes[i]) {
+      const auto& cube = stage.body[pos.y][pos.x];
+      if (cube.pos.y < 0) continue;
+      drawCube(cube);
+    }
+  }
 
-      ci::gl::color(1, 0, 0);
+  // 高さ
+  ci::gl::color(1, 0, 0);
+  for (const auto& rows : stage.body) {
+    for (const auto& cube : rows) {
       for (int i = 0; i < cube.pos.y; ++i) {
         float size = 0.1;
         float ofs_x = 0.1 + 0.2 * (i % 4);
@@ -78,5 +79,201 @@ void drawSwitchTarget(const std::vector<std::string>& targets) {
   }
 }
 
+// 並べたステージを x_offset で揃えて描画
+void drawCourse(const StageCourse& course, const int grid) {
+  const int length = course.getLength();
+
+  ci::gl::lineWidth(1);
+  ci::gl::color(0, 0, 1);
+  ci::gl::drawLine(ci::Vec2i(0, -2), ci::Vec2i(0, length + 2));
+
+  ci::gl::color(1, 0, 0);
+  ci::gl::drawLine(ci::Vec2i(grid, -2), ci::Vec2i(grid, length + 2));
+
+  for (const auto& entry : course.getEntries()) {
+    if (entry->stage) {
+      ci::gl::pushModelView();
+      ci::gl::translate(ci::Vec2f(entry->x_offset, entry->z));
+      draw(*entry->stage);
+      ci::gl::popModelView();
+    }
+    else {
+      // 読み込み待ち
+      ci::gl::color(0.3, 0.3, 0.3);
+      ci::Rectf rect(0, entry->z, grid, entry->z + entry->length);
+      ci::gl::drawStrokedRect(rect);
+    }
+
+    // ステージの継ぎ目
+    ci::gl::color(1, 1, 1, 0.5);
+    ci::gl::drawLine(ci::Vec2i(-2, entry->z), ci::Vec2i(grid + 2, entry->z));
+  }
+}
+
+// タイルに分けたステージ
+// 読み込み中のタイルは枠だけ、編集したタイルは枠の色を変える
+void drawChunks(const StageChunks& chunks, const int grid) {
+  const auto& params = chunks.getParams();
+
+  ci::gl::lineWidth(1);
+  ci::gl::color(0, 0, 1);
+  ci::gl::drawLine(ci::Vec2i(-params.x_offset, -2), ci::Vec2i(-params.x_offset, params.size.y + 2));
+
+  ci::gl::color(1, 0, 0);
+  ci::gl::drawLine(ci::Vec2i(-params.x_offset + grid, -2), ci::Vec2i(-params.x_offset + grid, params.size.y + 2));
+
+  ci::gl::color(0.3, 0.3, 0.3);
+  ci::gl::drawStrokedRect(ci::Rectf(0, 0, params.size.x, params.size.y));
+
+  for (const auto* chunk : chunks.getResident()) {
+    if (chunk->stage) {
+      ci::gl::pushModelView();
+      ci::gl::translate(ci::Vec2f(chunk->origin));
+      draw(*chunk->stage);
+      ci::gl::popModelView();
+    }
+
+    auto size = chunks.getChunkSize(chunk->index);
+    if (chunk->dirty) {
+      ci::gl::color(1, 0.5, 0);
+    }
+    else {
+      ci::gl::color(0.3, 0.3, 0.3);
+    }
+    ci::gl::drawStrokedRect(ci::Rectf(chunk->origin.x, chunk->origin.y,
+                                      chunk->origin.x + size.x, chunk->origin.y + size.y));
+  }
+}
+
+// サムネイル一覧(画面座標で描く)
+// query_matchが立っているステージは検索に一致した印を付ける
+void drawBrowser(const StageBrowser& browser, const ci::Vec2i& box, const float window_width,
+                 const int current_stage, const std::vector<bool>& query_match) {
+  const auto& entries = browser.getEntries();
+  for (size_t i = 0; i < entries.size(); ++i) {
+    auto rect = browser.getRect(i, box, window_width);
+
+    if (entries[i]->texture) {
+      ci::gl::color(1, 1, 1);
+      ci::gl::draw(entries[i]->texture, browser.getImageRect(i, box, window_width));
+    }
+    else {
+      // 作成待ち
+      ci::gl::color(0.3, 0.3, 0.3);
+      ci::gl::lineWidth(1);
+      ci::gl::drawStrokedRect(rect);
+    }
+
+    if ((i < query_match.size()) && query_match[i]) {
+      ci::gl::color(0.3, 1, 0.3);
+      ci::gl::lineWidth(2);
+      ci::gl::drawStrokedRect(rect.inflated(ci::Vec2f(6, 6)));
+    }
+
+    if (int(i) == current_stage) {
+      ci::gl::color(1, 0, 0);
+      ci::gl::lineWidth(2);
+      ci::gl::drawStrokedRect(rect.inflated(ci::Vec2f(3, 3)));
+    }
+
+    ci::gl::drawString(entries[i]->path, ci::Vec2f(rect.x1, rect.y2 + 2), ci::ColorA(1, 1, 1, 1));
+  }
+}
+
+// 差分のあったセルを囲む
+void drawDiff(const StageDiff::Result& result) {
+  ci::gl::lineWidth(2);
+  for (const auto& change : result.cells) {
+    if (change.kind & (StageDiff::CellChange::ADDED | StageDiff::CellChange::REMOVED)) {
+      ci::gl::color(0.3, 1, 0.3);
+    }
+    else if (change.kind & StageDiff::CellChange::TYPE) {
+      ci::gl::color(1, 0.3, 0.3);
+    }
+    else if (change.kind & StageDiff::CellChange::PAYLOAD) {
+      ci::gl::color(1, 1, 0.3);
+    }
+    else {
+      ci::gl::color(1, 1, 1);
+    }
+
+    ci::Rectf rect(change.pos.x - 0.05, change.pos.y - 0.05,
+                   change.pos.x + 0.95, change.pos.y + 0.95);
+    ci::gl::drawStrokedRect(rect);
+  }
+}
+
+// 問題のあるセルに印を付ける(エラーは赤、警告は橙)
+// TIPS:差分の枠と重ならないよう、セルの内側に×を描く
+void drawLint(const std::vector<StageLint::Issue>& issues) {
+  ci::gl::lineWidth(2);
+  for (const auto& issue : issues) {
+    if (issue.pos.x < 0) continue;
+
+    if (issue.severity == StageLint::ERROR) {
+      ci::gl::color(1, 0.2, 0.2);
+    }
+    else {
+      ci::gl::color(1, 0.6, 0.1);
+    }
+
+    ci::Vec2f p0(issue.pos.x + 0.2, issue.pos.y + 0.2);
+    ci::Vec2f p1(issue.pos.x + 0.7, issue.pos.y + 0.7);
+    ci::gl::drawLine(p0, p1);
+    ci::gl::drawLine(ci::Vec2f(p0.x, p1.y), ci::Vec2f(p1.x, p0.y));
+  }
+}
+
+// movingの経路と、時刻timeの各キューブの位置
+// fallingはセルの下端に予定(待ち:灰 落下中:橙)を描き、落ちてくる途中は小さく描く
+// lengthは予定の帯の幅にあたる秒数
+void drawTimeline(const StageTimeline& timeline, const float time, const float length) {
+  const ci::Vec2f center(0.45, 0.45);
+
+  ci::gl::lineWidth(1);
+  ci::gl::color(0.3, 1, 0.3, 0.6);
+  for (const auto& track : timeline.getMoving()) {
+    const auto& keys = track.keys;
+    for (size_t i = 1; i < keys.size(); ++i) {
+      ci::gl::drawLine(ci::Vec2f(keys[i - 1].pos.x, keys[i - 1].pos.z) + center,
+                       ci::Vec2f(keys[i].pos.x, keys[i].pos.z) + center);
+    }
+  }
+
+  ci::gl::lineWidth(2);
+  ci::gl::color(0.3, 1, 0.3);
+  for (const auto& track : timeline.getMoving()) {
+    auto pos = StageTimeline::evaluate(track, time);
+    ci::Rectf rect(pos.x + 0.1, pos.z + 0.1, pos.x + 0.8, pos.z + 0.8);
+    ci::gl::drawStrokedRect(rect);
+  }
+
+  for (const auto& track : timeline.getFalling()) {
+    const float x = track.cell.x;
+    const float z = track.cell.y;
+
+    ci::gl::color(0.5, 0.5, 0.5);
+    ci::gl::drawSolidRect(ci::Rectf(x, z + 0.8, x + 0.9, z + 0.9));
+
+    float delay    = std::min(std::max(track.delay, 0.0f), length);
+    float interval = std::min(std::max(track.interval, 0.0f), length - delay);
+    ci::gl::color(1, 0.5, 0);
+    ci::gl::drawSolidRect(ci::Rectf(x + 0.9 * delay / length, z + 0.8,
+                                    x + 0.9 * (delay + interval) / length, z + 0.9));
+
+    ci::gl::color(1, 1, 1);
+    float now = x + 0.9 * std::min(time / length, 1.0f);
+    ci::gl::drawLine(ci::Vec2f(now, z + 0.75), ci::Vec2f(now, z + 0.95));
+
+    // 高いほど小さく描く
+    auto pos = StageTimeline::evaluate(track, time);
+    float rate = (pos.y - track.height) / StageTimeline::getFallHeight();
+    float size = 0.7 - 0.5 * rate;
+    float ofs  = 0.45 - size * 0.5;
+    ci::gl::color(1, 0.5, 0);
+    ci::gl::drawStrokedRect(ci::Rectf(x + ofs, z + ofs - 0.05, x + ofs + size, z + ofs + size - 0.05));
+  }
+}
+
 }
 }
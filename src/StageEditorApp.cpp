@@ -1,16 +1,39 @@
 ﻿
 #include "Defines.hpp"
+#include "AllocTrack.hpp"
+#include "Trace.hpp"
 #include <chrono>
 #include <iomanip>
+#include <future>
+#include <limits>
+#include <deque>
 #include "cinder/app/AppNative.h"
 #include "cinder/System.h"
 #include "cinder/Matrix22.h"
 #include "cinder/gl/gl.h"
 #include "cinder/Params/Params.h"
+#include "cinder/ImageIo.h"
+#include "AntTweakBar.h"
 #include "JsonUtil.hpp"
 #include "Stage.hpp"
 #include "StageSerializer.hpp"
 #include "StageDrawer.hpp"
+#include "FileWatcher.hpp"
+#include "StageCourse.hpp"
+#include "StageChunks.hpp"
+#include "EditorConfig.hpp"
+#include "StageDiff.hpp"
+#include "StagePack.hpp"
+#include "StageBrowser.hpp"
+#include "StageManifest.hpp"
+#include "StageJournal.hpp"
+#include "StageLint.hpp"
+#include "StageTimeline.hpp"
+#include "StageSnapshot.hpp"
+#include "StageHeightmap.hpp"
+#include "CubeTraits.hpp"
+#include "EditorCore.hpp"
+#include "InputRecord.hpp"
 
 
 using namespace ci;
@@ -20,17 +43,75 @@ using namespace ci::app;
 namespace ngs {
 
 class StageEditorApp : public AppNative {
-  ci::JsonTree params_;
-
-  int grid_;
+  EditorConfig config_;
+  bool active_;
   
   std::vector<std::string> stage_path;
-  std::string copy_path;
-  bool auto_backup;
 
   
   int current_stage;
   Stage stage;
+  bool modified;
+  // 編集のたびに増える(表示の更新判定用)
+  int edit_serial;
+
+  // 未保存の編集の記録(クラッシュからの復元用)
+  std::unique_ptr<StageJournal> journal;
+
+  // 外部で書き換えられたファイルの再読み込み
+  std::unique_ptr<FileWatcher> file_watcher;
+  std::future<Stage> reload_task;
+  int reload_stage_num;
+  bool reload_pending;
+  Stage reloaded_stage;
+  // 外部の変更を捨てて上書き保存してよいか(reload_pending中に2回押した)
+  bool overwrite_confirmed;
+
+  // コース表示
+  bool course_view;
+  std::unique_ptr<StageCourse> course;
+  StageCourse::Entry* cursor_entry;
+
+  // タイルに分けた巨大なステージの表示(表示範囲のタイルだけを読み込む)
+  bool chunk_view;
+  std::unique_ptr<StageChunks> chunks;
+
+  // バックアップとの差分表示
+  std::vector<std::string> diff_backup_files;
+  size_t diff_backup_index;
+  std::unique_ptr<Stage> diff_stage;
+  StageDiff::Result diff_result;
+  int diff_serial;
+
+  // サムネイル一覧
+  bool browser_view;
+  std::unique_ptr<StageBrowser> browser;
+
+  // ステージの目録と検索(一致したステージは一覧で枠を付ける)
+  std::unique_ptr<StageManifest> manifest;
+  std::string stage_query;
+  std::vector<bool> query_match;
+
+  // 検査(編集したセルだけを調べ直す)。問題はパネルとステージ上の枠で示す
+  std::unique_ptr<StageLint> lint;
+  bool lint_view;
+
+  // 別スレッドに渡す読み取り専用の写し(編集した行だけを写し直す)
+  StageSnapshots snapshots;
+
+  // movingとfallingの動きの表示。timeline_timeの時刻の位置を描く
+  StageTimeline timeline;
+  bool timeline_view;
+  bool timeline_play;
+  float timeline_time;
+  int timeline_serial;
+
+  // 入力の記録(性能の回帰テスト用)
+  std::unique_ptr<InputRecord::Recorder> recorder;
+
+  // メモリ確保の計測結果の表示
+  bool alloc_view;
+  std::vector<std::string> alloc_report;
 
   Vec2f view_offset;
   float view_rotate;
@@ -46,6 +127,20 @@ class StageEditorApp : public AppNative {
 
   params::InterfaceGlRef settings_panel;
   params::InterfaceGlRef property_panel;
+  params::InterfaceGlRef lint_panel;
+
+  // 設定パネルに表示するステージ名
+  std::string panel_stage_name;
+
+  // プロパティパネルの表示中の種類(-1:空)と、パネルにバインドする値
+  int property_type;
+  std::string property_pattern;
+  float property_interval;
+  float property_delay;
+  std::string property_direction;
+  int property_power;
+  // TIPS:要素のアドレスをパネルに渡すので、増減しても他の要素が動かないdequeを使う
+  std::deque<std::string> property_target;
   
 
   float bg_duration;
@@ -54,20 +149,12 @@ class StageEditorApp : public AppNative {
   
   void prepareSettings(Settings* settings) override {
     // アプリ起動時の設定はここで処理する
-    params_ = Json::readFromFile("params.json");
-
-    grid_ = params_["app.grid"].getValue<int>();
+    config_ = readEditorConfig("params.json");
+    stage_path = config_.stage;
+    active_ = true;
     
-    auto size = Json::getVec2<int>(params_["app.size"]);
-    settings->setWindowSize(size);
-
-    for (const auto& path : params_["app.stage"]) {
-      stage_path.push_back(path.getValue<std::string>());      
-    }
-    copy_path = params_["app.copy_path"].getValue<std::string>();
-    auto_backup = params_["app.auto_backup"].getValue<bool>();
-
-    settings->setFrameRate(params_["app.frame_rate"].getValue<float>());
+    settings->setWindowSize(config_.size);
+    settings->setFrameRate(config_.frame_rate);
     
 #if 0
     auto active_touch = ci::System::hasMultiTouch();
@@ -81,11 +168,13 @@ class StageEditorApp : public AppNative {
 #if defined(CINDER_MAC)
     // バックグラウンドになった時に全速力で更新されるのを防ぐ
     get()->getSignalWillResignActive().connect([this]() noexcept {
-        setFrameRate(params_["app.frame_rate_low"].getValue<float>());
+        active_ = false;
+        setFrameRate(config_.frame_rate_low);
       });
     
     get()->getSignalDidBecomeActive().connect([this]() noexcept {
-        setFrameRate(params_["app.frame_rate"].getValue<float>());
+        active_ = true;
+        setFrameRate(config_.frame_rate);
       });
 #endif
     
@@ -94,17 +183,41 @@ class StageEditorApp : public AppNative {
     view_scale  = Vec2f(20, 20);
 
     selected = false;
+    cursor_pos = Vec2i::zero();
+    course_view = false;
+    cursor_entry = nullptr;
+    chunk_view = false;
+    browser_view = false;
+    alloc_view = false;
+    lint_view = true;
+    timeline_view = false;
+    timeline_play = false;
+    timeline_time = 0.0f;
+    edit_serial = 0;
+    timeline_serial = -1;
+
+    lint = std::unique_ptr<StageLint>(new StageLint(makeLintNames()));
 
     current_stage = 0;
     loadStage(current_stage);
 
-    settings_panel = params::InterfaceGl::create("settings", Json::getVec2<int>(params_["app.settings.size"]));
-    settings_panel->setPosition(Json::getVec2<int>(params_["app.settings.position"]));
-    settings_panel->setOptions("", "refresh=0.033");
+    file_watcher = std::unique_ptr<FileWatcher>(new FileWatcher(getDocumentPath(""), makeWatchFiles()));
+
+    settings_panel = params::InterfaceGl::create("settings", config_.settings_size);
+    settings_panel->setPosition(config_.settings_position);
+    // TIPS:値を変えた時にrefreshPanelで更新するので、定期的な更新は控えめでよい
+    settings_panel->setOptions("", "refresh=1");
     setupSettingsPanel();
+    updateSettingsPanel();
 
-    property_panel = params::InterfaceGl::create("property", Json::getVec2<int>(params_["app.property.size"]));
-    property_panel->setPosition(Json::getVec2<int>(params_["app.property.position"]));
+    property_panel = params::InterfaceGl::create("property", config_.property_size);
+    property_panel->setPosition(config_.property_position);
+    property_panel->setOptions("", "refresh=1");
+    property_type = -1;
+
+    lint_panel = params::InterfaceGl::create("lint", config_.lint_size);
+    lint_panel->setPosition(config_.lint_position);
+    lint_panel->setOptions("", "refresh=1");
 
     gl::enableAlphaBlending();
     bg_color = Color::black();
@@ -113,53 +226,78 @@ class StageEditorApp : public AppNative {
 
 
   void mouseMove(MouseEvent event) override {
-    Matrix22f matrix;
-
-    matrix.rotate(toRadians(view_rotate));
-    matrix.scale(view_scale);
-    auto pos = matrix.inverted() * Vec2f(event.getPos() - view_offset);
+    auto pos = screenToWorld(event.getPos());
+    auto prev_cursor_pos = cursor_pos;
 
     on_cursor = false;
-    if ((pos.x >= 0.0f) && (pos.x < stage.size.x)) {
-      if ((pos.y >= 0.0f) && (pos.y < stage.size.y)) {
+    if (browser_view) return;
+
+    if (course_view) {
+      // カーソル下のステージのローカル座標へ変換
+      cursor_entry = course->findEntry(pos.y);
+      if (cursor_entry && cursor_entry->stage) {
+        Vec2f local(pos.x - cursor_entry->x_offset, pos.y - cursor_entry->z);
+        const auto& size = cursor_entry->stage->size;
+        if ((local.x >= 0.0f) && (local.x < size.x)) {
+          if ((local.y >= 0.0f) && (local.y < size.y)) {
+            on_cursor = true;
+            cursor_pos.x = local.x;
+            cursor_pos.y = local.y;
+          }
+        }
+      }
+    }
+    else if (chunk_view) {
+      // TIPS:読み込み済みのタイルの上だけ編集できる
+      Vec2i cell(std::floor(pos.x), std::floor(pos.y));
+      if (chunks->findChunk(cell)) {
         on_cursor = true;
-        cursor_pos.x = pos.x;
-        cursor_pos.y = pos.y;
+        cursor_pos = cell;
       }
     }
+    else {
+      on_cursor = EditorCore::findCursor(stage, pos, cursor_pos);
+      recordMouse(InputRecord::Event::MOUSE_MOVE, event.getPos());
+    }
+
+    if (cursor_pos != prev_cursor_pos) {
+      refreshPanel("settings");
+    }
   }
 
   void mouseDown(MouseEvent event) override {
     if (event.isLeft()) {
       prev_drag_pos = event.getPos();
 
-      if (on_cursor) {
+      if (browser_view) {
+        int stage_num = browser->findEntry(event.getPos(), config_.thumbnail_box, getWindowWidth());
+        if (stage_num >= 0) {
+          browser_view = false;
+          if (stage_num != current_stage) changeStage(stage_num);
+        }
+        return;
+      }
+
+      if (isEditingStage()) {
+        recordMouse(InputRecord::Event::MOUSE_DOWN, event.getPos());
+      }
+
+      if (on_cursor && isEditingStage()) {
         selected = true;
         selected_pos = cursor_pos;
 
-        if (stage.isItemCube(selected_pos)) {
-          setupItemPropertyPanel();
-        }
-        else if (stage.isMovingCube(selected_pos)) {
-          setupMovingPropertyPanel();
-        }
-        else if (stage.isSwitchCube(selected_pos)) {
-          setupSwitchPropertyPanel();
-        }
-        else if (stage.isFallingCube(selected_pos)) {
-          setupFallingPropertyPanel();
-        }
-        else if (stage.isOnewayCube(selected_pos)) {
-          setupOnewayPropertyPanel();
-        }
-        else {
-          clearPropertyPanel();
-        }
+        setupPropertyPanel();
       }
     }
   }
 
   void mouseDrag(MouseEvent event) override {
+    if (browser_view) return;
+
+    if (isEditingStage() && event.isLeftDown()) {
+      recordMouse(InputRecord::Event::MOUSE_DRAG, event.getPos());
+    }
+
     if (!on_cursor && event.isLeftDown()) {
       auto pos = event.getPos();
 
@@ -168,108 +306,278 @@ class StageEditorApp : public AppNative {
     }
   }
 
+  void mouseWheel(MouseEvent event) override {
+    if (browser_view) {
+      browser->scroll(event.getWheelIncrement() * 40.0f);
+      return;
+    }
+
+    // TIPS:表示位置が変わると記録したマウスの位置が別のセルを指すので、スクロールも記録する
+    if (recorder && isEditingStage()) {
+      recorder->wheel(event.getWheelIncrement());
+    }
+    view_offset += EditorCore::getWheelScroll(getView(), event.getWheelIncrement());
+  }
+
+  // 画像を落とすと今のステージを作り直す
+  void fileDrop(FileDropEvent event) override {
+    if (!isEditingStage() || browser_view) return;
+
+    const auto& files = event.getFiles();
+    if (files.empty()) return;
+
+    importHeightmap(files.front());
+  }
+
   void keyDown(KeyEvent event) override {
     auto chara  = event.getChar();
 
+    if (recorder && (chara != 'Q') && isEditingStage() && !browser_view) {
+      recorder->key(chara);
+    }
+
     switch (chara) {
     case 'W':
-      writeStage(current_stage);
+      if (!writeEditingStages()) break;
       bg_color = Color(0.5, 0, 0);
       bg_duration = 0.5;
       break;
 
     case 'C':
-      writeStage(current_stage);
+      if (!writeEditingStages()) break;
       copyAllStagesToApp();
       bg_color = Color(0.5, 0.5, 0);
       bg_duration = 0.5;
       break;
 
-    case ',':
-      current_stage -= 1;
-      if (current_stage < 0) current_stage = stage_path.size() - 1;
-      on_cursor = false;
-      selected  = false;
+    case 'P':
+      if (!writeEditingStages()) break;
+      exportStagePack();
+      bg_color = Color(0, 0.5, 0.5);
+      bg_duration = 0.5;
+      break;
 
-      loadStage(current_stage);
-      setupSettingsPanel();
-      clearPropertyPanel();
+    case 'V':
+      if (chunk_view) break;
+      toggleCourseView();
       break;
 
-    case '.':
-      current_stage = (current_stage + 1) % stage_path.size();
-      on_cursor = false;
-      selected  = false;
+    case 'G':
+      if (course_view || browser_view) break;
+      toggleChunkView();
+      break;
 
-      loadStage(current_stage);
-      setupSettingsPanel();
-      clearPropertyPanel();
+    case 'D':
+      if (!isEditingStage()) break;
+      cycleDiffBackup();
+      break;
+
+    case 'B':
+      if (!isEditingStage()) break;
+      toggleBrowserView();
+      break;
+
+    case 'Q':
+      if (!isEditingStage() || browser_view) break;
+      toggleRecording();
+      break;
+
+    case 'L':
+      lint_view = !lint_view;
+      break;
+
+    case 'T':
+      timeline_view = !timeline_view;
+      break;
+
+    case 'E':
+      writeTrace();
+      break;
+
+    case 'A':
+      // 表示を始める時に数え直す
+      alloc_view = !alloc_view;
+      if (alloc_view) AllocTrack::reset();
+      break;
+
+    case ',':
+      if (!isEditingStage()) break;
+      changeStage((current_stage > 0) ? current_stage - 1 : int(stage_path.size()) - 1);
+      break;
+
+    case '.':
+      if (!isEditingStage()) break;
+      changeStage((current_stage + 1) % stage_path.size());
       break;
 
     case 'K':
+      if (!isEditingStage()) break;
       stage.clear();
+      markModified();
+      journalClear();
+      lint->invalidate();
+      snapshots.invalidate();
       on_cursor = false;
       selected  = false;
 
       clearPropertyPanel();
       break;
 
+    case 'I':
+    case 'X':
+    case 'Y':
+    case 'Z':
+      if (!isEditingStage() || !on_cursor) break;
+      editStructure(chara);
+      break;
+
+    case 'R':
+      // 未保存の編集を捨てて外部の変更を反映
+      if (reload_pending) {
+        applyReloadedStage(reloaded_stage);
+      }
+      break;
+
       
     default:
       if (on_cursor) {
-        switch (chara) {
-        case 'i':
-          stage.toggleItem(cursor_pos);
-          break;
-
-        case 'm':
-          stage.toggleMoving(cursor_pos);
-          break;
-
-        case 's':
-          stage.toggleSwitch(cursor_pos);
-          break;
-
-        case 'f':
-          stage.toggleFalling(cursor_pos);
-          break;
-
-        case 'o':
-          stage.toggleOneway(cursor_pos);
-          break;
-          
-        case '-':
-          stage.changeHeight(cursor_pos, -1);
-          break;
-        
-        case '^':
-          stage.changeHeight(cursor_pos, 1);
-          break;
-
-        case '0':
-          stage.setHeight(cursor_pos, 0);
-          break;
+        if (course_view) {
+          if (cursor_entry && cursor_entry->stage
+              && EditorCore::editCube(*cursor_entry->stage, cursor_pos, chara)) {
+            cursor_entry->modified = true;
+          }
+        }
+        else if (chunk_view) {
+          auto* chunk = chunks->findChunk(cursor_pos);
+          if (chunk && EditorCore::editCube(*chunk->stage, cursor_pos - chunk->origin, chara)) {
+            chunk->dirty = true;
+          }
+        }
+        else if (EditorCore::editCube(stage, cursor_pos, chara)) {
+          markModified();
+          journalCube(cursor_pos);
+          lint->markCell(cursor_pos);
+          snapshots.markCell(cursor_pos);
         }
       }
       
-      if (selected && stage.isSwitchCube(selected_pos)) {
-        switch (chara) {
-        case '[':
-          stage.reduceSwitchTarget(selected_pos);
-          setupSwitchPropertyPanel();
-          break;
-
-        case ']':
-          stage.addSwitchTarget(selected_pos);
-          setupSwitchPropertyPanel();
-          break;
-        }
+      if (selected && EditorCore::editSwitchTarget(stage, selected_pos, chara)) {
+        markModified();
+        journalCube(selected_pos);
+        lint->markCell(selected_pos);
+        snapshots.markCell(selected_pos);
+        setupPropertyPanel();
       }
     }
   }
   
   
+  // カーソル位置で行や列を挿入・削除する
+  void editStructure(const char chara) {
+    int index = 0;
+    auto op = EditorCore::editStructure(stage, cursor_pos, chara, index);
+    if (op.empty()) return;
+
+    markModified();
+    if (journal) {
+      journal->writeStructure(op, index);
+      updateJournal();
+    }
+    // TIPS:同じフレームで挿入と削除をすると大きさが元に戻るので、ここで全て調べ直す印を付ける
+    lint->invalidate();
+    snapshots.invalidate();
+
+    on_cursor = false;
+    selected  = false;
+    clearPropertyPanel();
+    refreshPanel("settings");
+  }
+
+  // 終了時、タイル表示で編集したまま書き戻していないタイルを保存する
+  // TIPS:書けなかった時は失ったタイル数を出力しておく
+  void shutdown() override {
+    if (!chunks) return;
+
+    auto num_dirty = chunks->getNumDirty();
+    if (!num_dirty) return;
+
+    if (!writeChunks()) {
+      console() << "chunks:" << num_dirty << " modified tiles were not saved" << std::endl;
+    }
+  }
+
 	void update() override {
+    Trace::Scope trace_scope("update");
+
+    bool stage_changed = false;
+    for (const auto& file : file_watcher->poll()) {
+      if (file == "params.json") {
+        reloadParams();
+      }
+      else if (file == makeStagePath(current_stage)) {
+        startReloadStage(current_stage);
+      }
+
+      if (course) {
+        course->invalidate(file);
+      }
+      if (browser) {
+        browser->invalidate(file);
+      }
+      stage_changed = true;
+    }
+    finishReloadStage();
+
+    if (stage_changed && browser_view) {
+      updateManifest();
+    }
+
+    if (browser_view) {
+      browser->update();
+    }
+
+    // TIPS:コース表示中はstageを編集しないので調べない
+    if (isEditingStage() && lint->update(stage)) {
+      setupLintPanel();
+    }
+
+    if (timeline_view && isEditingStage()) {
+      updateTimeline();
+    }
+
+    if (diff_stage && (diff_serial != edit_serial)) {
+      diff_result = StageDiff::diff(*diff_stage, stage);
+      diff_serial = edit_serial;
+    }
+
+    if (course_view) {
+      Vec2f view_min;
+      Vec2f view_max;
+      getViewBounds(view_min, view_max);
+      course->update(view_min.y, view_max.y);
+
+      if (cursor_entry && !cursor_entry->stage) {
+        on_cursor = false;
+      }
+    }
+
+    if (chunk_view) {
+      Vec2f view_min;
+      Vec2f view_max;
+      getViewBounds(view_min, view_max);
+      chunks->update(view_min, view_max);
+
+      if (on_cursor && !chunks->findChunk(cursor_pos)) {
+        on_cursor = false;
+      }
+    }
+
+    if (alloc_view) {
+      // TIPS:表示用の文字列はdrawの外で作る(drawの計測に入れないため)
+      alloc_report = AllocTrack::isEnabled() ? AllocTrack::format(AllocTrack::getResults())
+                                             : std::vector<std::string>(1, "alloc tracking: build with NGS_ALLOC_TRACK");
+    }
+
     if (bg_duration > 0.0f) {
       bg_duration -= 1 / 60.0;
       if (bg_duration <= 0.0f) {
@@ -279,31 +587,65 @@ class StageEditorApp : public AppNative {
   }
   
 	void draw() override {
+    AllocTrack::Scope alloc_scope("draw");
+    Trace::Scope trace_scope("draw");
+
     gl::clear(bg_color);
 
+    if (browser_view) {
+      StageDrawer::drawBrowser(*browser, config_.thumbnail_box, getWindowWidth(), current_stage, query_match);
+      settings_panel->draw();
+      return;
+    }
+
     gl::pushModelView();
 
     gl::translate(view_offset);
     gl::rotate(view_rotate);
     gl::scale(view_scale);
 
-    ci::gl::lineWidth(1);
-    ci::gl::color(0, 0, 1);
-    ci::gl::drawLine(ci::Vec2i(-stage.x_offset, -2), ci::Vec2i(-stage.x_offset, stage.size.y + 2));
+    if (course_view) {
+      StageDrawer::drawCourse(*course, config_.grid);
+    }
+    else if (chunk_view) {
+      StageDrawer::drawChunks(*chunks, config_.grid);
+    }
+    else {
+      ci::gl::lineWidth(1);
+      ci::gl::color(0, 0, 1);
+      ci::gl::drawLine(ci::Vec2i(-stage.x_offset, -2), ci::Vec2i(-stage.x_offset, stage.size.y + 2));
 
-    ci::gl::color(1, 0, 0);
-    ci::gl::drawLine(ci::Vec2i(-stage.x_offset + grid_, -2), ci::Vec2i(-stage.x_offset + grid_, stage.size.y + 2));
+      ci::gl::color(1, 0, 0);
+      ci::gl::drawLine(ci::Vec2i(-stage.x_offset + config_.grid, -2), ci::Vec2i(-stage.x_offset + config_.grid, stage.size.y + 2));
     
-    StageDrawer::draw(stage);
+      StageDrawer::draw(stage);
+
+      if (selected && stage.isType(selected_pos, Stage::Cube::SWITCH)) {
+        StageDrawer::drawSwitchTarget(stage.getTarget(selected_pos));
+      }
 
-    if (selected && stage.isSwitchCube(selected_pos)) {
-      StageDrawer::drawSwitchTarget(stage.getTarget(selected_pos));
+      if (diff_stage) {
+        StageDrawer::drawDiff(diff_result);
+      }
+
+      if (lint_view) {
+        StageDrawer::drawLint(lint->getIssues());
+      }
+
+      if (timeline_view) {
+        StageDrawer::drawTimeline(timeline, timeline_time, config_.timeline_length);
+      }
     }
     
     if (on_cursor) {
+      // コース表示ではカーソル下のステージ位置へずらす
+      Vec2f ofs = (course_view && cursor_entry) ? Vec2f(cursor_entry->x_offset, cursor_entry->z)
+                                                : Vec2f::zero();
+
       gl::color(0, 0, 1);
       gl::lineWidth(2);
-      Rectf rect(cursor_pos.x, cursor_pos.y, cursor_pos.x + 0.9, cursor_pos.y + 0.9);
+      Rectf rect(ofs.x + cursor_pos.x, ofs.y + cursor_pos.y,
+                 ofs.x + cursor_pos.x + 0.9, ofs.y + cursor_pos.y + 0.9);
       gl::drawStrokedRect(rect);
     }
     
@@ -318,33 +660,741 @@ class StageEditorApp : public AppNative {
 
     settings_panel->draw();
     property_panel->draw();
+    if (lint_view && isEditingStage()) lint_panel->draw();
+
+    if (reload_pending) {
+      gl::drawString("stage changed on disk. R: reload (discard local edits)  W/C/P twice: overwrite",
+                     Vec2f(10, 10), ColorA(1, 0, 1, 1));
+    }
+
+    if (recorder) {
+      gl::drawString("REC " + std::to_string(recorder->getNumEvents()) + " events",
+                     Vec2f(getWindowWidth() - 120, 10), ColorA(1, 0.2, 0.2, 1));
+    }
+
+    if (timeline_view && isEditingStage()) {
+      gl::drawString("time " + NumberFormat::toString(timeline_time),
+                     Vec2f(getWindowWidth() - 120, 24), ColorA(1, 0.5, 0, 1));
+    }
+
+    if (alloc_view) {
+      Vec2f pos(10, getWindowHeight() - 14.0f * (alloc_report.size() + 1));
+      for (const auto& line : alloc_report) {
+        gl::drawString(line, pos, ColorA(0.3, 1, 0.3, 1));
+        pos.y += 14;
+      }
+    }
+
+    if (chunk_view) {
+      std::ostringstream text;
+      text << "chunks " << chunks->getResident().size() << " loaded "
+           << chunks->getResidentBytes() / (1024 * 1024) << "MB "
+           << chunks->getNumDirty() << " modified";
+      gl::drawString(text.str(), Vec2f(10, 30), ColorA(1, 0.5, 0, 1));
+    }
+
+    if (diff_stage && isEditingStage()) {
+      Vec2f pos(10, 30);
+      gl::drawString("diff: " + diff_backup_files[diff_backup_index] + " -> current",
+                     pos, ColorA(1, 1, 1, 1));
+      for (const auto& p : diff_result.params) {
+        pos.y += 14;
+        gl::drawString(p.name + ": " + p.from + " -> " + p.to, pos, ColorA(1, 1, 0.3, 1));
+      }
+    }
+  }
+
+
+  void reloadParams() {
+    // 全項目を読めた時だけ差し替える
+    EditorConfig config;
+    try {
+      config = readEditorConfig("params.json");
+    }
+    catch (const std::exception& e) {
+      // 書き込み途中などで読めなかった
+      console() << "params.json reload failed:" << e.what() << std::endl;
+      return;
+    }
+    std::swap(config_, config);
+
+    setFrameRate(active_ ? config_.frame_rate : config_.frame_rate_low);
+    if (config_.size != config.size) {
+      setWindowSize(config_.size);
+    }
+
+    settings_panel->setPosition(config_.settings_position);
+    property_panel->setPosition(config_.property_position);
+    lint_panel->setPosition(config_.lint_position);
+    if (config_.settings_size != config.settings_size) {
+      settings_panel->setOptions("", makePanelSizeOption(config_.settings_size));
+    }
+    if (config_.property_size != config.property_size) {
+      property_panel->setOptions("", makePanelSizeOption(config_.property_size));
+    }
+    if (config_.lint_size != config.lint_size) {
+      lint_panel->setOptions("", makePanelSizeOption(config_.lint_size));
+    }
+
+    // 名前の一覧が変わったかもしれないので作り直す(次のupdateで全て調べる)
+    lint = std::unique_ptr<StageLint>(new StageLint(makeLintNames()));
+
+    auto current_path = makeStagePath(current_stage);
+    stage_path = config_.stage;
+
+    file_watcher->setFiles(makeWatchFiles());
+
+    // ステージ一覧が変わったので作り直す
+    if (!course_view) {
+      course.reset();
+    }
+    if (!chunk_view && chunks) {
+      // 場所や量が変わったかもしれないので、編集したタイルを書き戻してから開き直す
+      writeChunks();
+      chunks.reset();
+    }
+    browser.reset();
+    browser_view = false;
+
+    // 編集中のステージの位置が変わっても追従する
+    auto it = std::find(stage_path.begin(), stage_path.end(), current_path);
+    if (it != stage_path.end()) {
+      current_stage = int(std::distance(stage_path.begin(), it));
+    }
+    else {
+      stage_path.push_back(current_path);
+      current_stage = int(stage_path.size()) - 1;
+    }
+    updateSettingsPanel();
+  }
+
+  static std::string makePanelSizeOption(const Vec2i& size) {
+    std::ostringstream text;
+    text << "size='" << size.x << " " << size.y << "'";
+    return text.str();
+  }
+
+  std::vector<std::string> makeWatchFiles() const {
+    auto files = stage_path;
+    files.push_back("params.json");
+    return files;
+  }
+
+  void startReloadStage(const int stage_num) {
+    auto path = makeStagePath(stage_num);
+    reload_stage_num = stage_num;
+    reload_task = std::async(std::launch::async, [path]() {
+        Trace::ThreadScope thread_scope;
+        Trace::Scope trace_scope("reload", path);
+        return StageSerializer::deserialize(path);
+      });
+  }
+
+  void finishReloadStage() {
+    if (!reload_task.valid()) return;
+    if (reload_task.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+    Stage new_stage;
+    try {
+      new_stage = reload_task.get();
+    }
+    catch (const std::exception& e) {
+      console() << "stage reload failed:" << e.what() << std::endl;
+      return;
+    }
+
+    // 読み込み中に別のステージへ切り替えた
+    if (reload_stage_num != current_stage) return;
+
+    if (modified) {
+      // 未保存の編集は勝手に上書きしない
+      reloaded_stage = std::move(new_stage);
+      reload_pending = true;
+      overwrite_confirmed = false;
+      console() << "stage changed on disk:" << makeStagePath(current_stage) << std::endl;
+
+      bg_color = Color(0.5, 0, 0.5);
+      bg_duration = 0.5;
+      return;
+    }
+
+    applyReloadedStage(new_stage);
+  }
+
+  void applyReloadedStage(const Stage& new_stage) {
+    // 記録開始時のステージと食い違うので記録はここまで
+    stopRecording();
+
+    bool resized = stage.size != new_stage.size;
+
+    auto changed = stage.applyDiff(new_stage);
+    edit_serial += 1;
+    lint->invalidate();
+    snapshots.invalidate();
+    console() << "reload:" << makeStagePath(current_stage)
+              << " " << changed << " cells" << std::endl;
+
+    modified = false;
+    reload_pending = false;
+    overwrite_confirmed = false;
+
+    // 編集を捨ててディスクの内容に合わせたので記録もやり直す
+    if (journal) {
+      journal->reset(StageJournal::readFile(getDocumentPath(makeStagePath(current_stage))));
+    }
+
+    if (resized) {
+      on_cursor = false;
+      selected  = false;
+      clearPropertyPanel();
+    }
+    else if (selected) {
+      setupPropertyPanel();
+    }
+    refreshPanel("settings");
+  }
+
+
+  Vec2f screenToWorld(const Vec2f& screen_pos) const {
+    return EditorCore::screenToWorld(getView(), screen_pos);
+  }
+
+  EditorCore::View getView() const {
+    EditorCore::View view = { view_offset, view_rotate, view_scale };
+    return view;
+  }
+
+  // 画面の四隅から表示範囲を求める
+  void getViewBounds(Vec2f& view_min, Vec2f& view_max) const {
+    auto size = Vec2f(getWindowSize());
+    view_min = Vec2f(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    view_max = -view_min;
+    for (const auto& corner : { Vec2f(0, 0), Vec2f(size.x, 0), Vec2f(0, size.y), size }) {
+      auto pos = screenToWorld(corner);
+      view_min.x = std::min(view_min.x, pos.x);
+      view_min.y = std::min(view_min.y, pos.y);
+      view_max.x = std::max(view_max.x, pos.x);
+      view_max.y = std::max(view_max.y, pos.y);
+    }
+  }
+
+  // stageを表示・編集しているか(コースやタイルの表示ではない)
+  bool isEditingStage() const {
+    return !course_view && !chunk_view;
+  }
+
+  // 入力の記録を開始・終了する
+  // TIPS:記録開始時のステージも一緒に書くので、保存していない編集があっても再生できる
+  void toggleRecording() {
+    if (recorder) {
+      stopRecording();
+      return;
+    }
+
+    auto stage_file = makeStagePath(current_stage);
+    auto directory  = getDocumentPath(config_.record_path);
+    try {
+      boost::filesystem::create_directories(directory);
+      auto path = directory + stage_file + createUniquePath() + ".rec";
+      recorder = std::unique_ptr<InputRecord::Recorder>(new InputRecord::Recorder(path, stage_file,
+                                                                                  StageSerializer::write(stage),
+                                                                                  getView()));
+      console() << "record to:" << path << std::endl;
+    }
+    catch (const std::exception& e) {
+      console() << "record failed:" << e.what() << std::endl;
+    }
+  }
+
+  void stopRecording() {
+    if (!recorder) return;
+
+    console() << "record end:" << recorder->getNumEvents() << " events" << std::endl;
+    recorder.reset();
+  }
+
+  void recordMouse(const InputRecord::Event::Type type, const Vec2f& pos) {
+    if (recorder) recorder->mouse(type, pos);
+  }
+
+  // 編集した時だけ作り直す(変わっていないキューブはそのまま使う)
+  void updateTimeline() {
+    if (timeline_serial != edit_serial) {
+      timeline.update(stage, config_.timeline_step);
+      timeline_serial = edit_serial;
+    }
+
+    if (timeline_play) {
+      timeline_time += 1.0f / config_.frame_rate;
+      if (timeline_time > config_.timeline_length) timeline_time = 0.0f;
+      refreshPanel("settings");
+    }
+  }
+
+  void toggleCourseView() {
+    stopRecording();
+    on_cursor = false;
+    selected  = false;
+    cursor_entry = nullptr;
+    clearPropertyPanel();
+
+    auto current_path = makeStagePath(current_stage);
+    if (!course_view) {
+      if (!course) {
+        course = std::unique_ptr<StageCourse>(new StageCourse(stage_path, config_.course_length));
+      }
+
+      // 未保存の編集をコース側へ引き継ぐ
+      if (modified) {
+        course->assign(current_path, stage);
+      }
+    }
+    else {
+      // コースで編集した内容を引き継ぐ
+      auto* entry = course->findEntry(current_path);
+      if (entry && entry->modified && entry->stage) {
+        stage = *entry->stage;
+        markModified();
+        lint->invalidate();
+        snapshots.invalidate();
+        entry->modified = false;
+
+        if (journal) {
+          journal->checkpoint(stage);
+        }
+        refreshPanel("settings");
+      }
+    }
+
+    course_view = !course_view;
+  }
+
+  // タイルに分けたステージの表示
+  // TIPS:開く時は見出しだけを読む。タイルは表示範囲に入った時に読み込む
+  void toggleChunkView() {
+    stopRecording();
+    on_cursor = false;
+    selected  = false;
+    clearPropertyPanel();
+
+    if (!chunk_view && !chunks) {
+      try {
+        chunks = std::unique_ptr<StageChunks>(new StageChunks(getDocumentPath(config_.chunks_path),
+                                                              size_t(config_.chunks_budget) * 1024 * 1024));
+      }
+      catch (const std::exception& e) {
+        console() << "chunks: can't open " << config_.chunks_path << " " << e.what() << std::endl;
+        return;
+      }
+    }
+
+    chunk_view = !chunk_view;
+  }
+
+  void toggleBrowserView() {
+    stopRecording();
+    if (!browser) {
+      browser = std::unique_ptr<StageBrowser>(new StageBrowser(stage_path, getDocumentPath(""),
+                                                               getDocumentPath(config_.thumbnail_cache),
+                                                               config_.thumbnail_cell));
+    }
+
+    on_cursor = false;
+    browser_view = !browser_view;
+
+    if (browser_view) {
+      updateManifest();
+
+      // 未保存の編集は写しから描く(写しを取るのは編集した行の分だけ)
+      if (modified) {
+        browser->assign(makeStagePath(current_stage), snapshots.take(stage));
+      }
+    }
+  }
+
+  // 変わったステージだけを読み直して目録を保存する
+  void updateManifest() {
+    Trace::Scope trace_scope("manifest");
+
+    try {
+      if (!manifest) {
+        manifest = std::unique_ptr<StageManifest>(new StageManifest(getDocumentPath(config_.manifest_path)));
+      }
+      auto num = manifest->update(getDocumentPath(""), stage_path);
+      if (num > 0) {
+        manifest->write();
+        console() << "manifest:" << num << " stages updated" << std::endl;
+      }
+    }
+    catch (const std::exception& e) {
+      console() << "manifest failed:" << e.what() << std::endl;
+    }
+
+    applyQuery();
+  }
+
+  void applyQuery() {
+    query_match.assign(stage_path.size(), false);
+    if (stage_query.empty() || !manifest) return;
+
+    try {
+      auto query = StageManifest::parseQuery(stage_query);
+      for (size_t i = 0; i < stage_path.size(); ++i) {
+        const auto* entry = manifest->find(stage_path[i]);
+        query_match[i] = entry && StageManifest::match(query, *entry);
+      }
+    }
+    catch (const std::exception& e) {
+      console() << "query:" << e.what() << std::endl;
+    }
   }
 
+  // 新しいバックアップから順に差分を表示し、最後まで行ったら消す
+  void cycleDiffBackup() {
+    if (!diff_stage) {
+      diff_backup_files = listBackupFiles(makeStagePath(current_stage));
+      diff_backup_index = 0;
+    }
+    else {
+      diff_backup_index += 1;
+    }
+
+    diff_stage.reset();
+    for (; diff_backup_index < diff_backup_files.size(); ++diff_backup_index) {
+      auto path = getDocumentPath("backup/" + diff_backup_files[diff_backup_index]);
+      try {
+        diff_stage = std::unique_ptr<Stage>(new Stage(StageSerializer::makeStage(Json::readFromPath(path))));
+        diff_serial = edit_serial - 1;
+        break;
+      }
+      catch (const std::exception& e) {
+        console() << "diff: can't read " << path << " " << e.what() << std::endl;
+      }
+    }
+  }
+
+  static std::vector<std::string> listBackupFiles(const std::string& stage_file) {
+    std::vector<std::string> files;
+
+    boost::system::error_code ec;
+    boost::filesystem::directory_iterator it(getDocumentPath("backup/"), ec);
+    if (ec) return files;
+
+    const auto prefix = stage_file + ".";
+    for (; it != boost::filesystem::directory_iterator(); ++it) {
+      auto name = it->path().filename().string();
+      if (name.compare(0, prefix.size(), prefix) == 0) {
+        files.push_back(name);
+      }
+    }
+
+    // TIPS:ファイル名に日時が入っているので逆順で新しい順になる
+    std::sort(files.rbegin(), files.rend());
+    return files;
+  }
 
   std::string makeStagePath(const int stage_num) {
     return stage_path[stage_num];
   }
 
+  // TIPS:未保存の編集は破棄される
+  void changeStage(const int stage_num) {
+    Trace::instant("change stage", makeStagePath(stage_num));
+    stopRecording();
+    if (browser && modified) {
+      // 捨てた編集の写しを一覧から外す
+      browser->invalidate(makeStagePath(current_stage));
+    }
+    current_stage = stage_num;
+    on_cursor = false;
+    selected  = false;
+
+    loadStage(current_stage);
+    updateSettingsPanel();
+    clearPropertyPanel();
+  }
+
   void loadStage(const int stage_num) {
+    AllocTrack::Scope alloc_scope("load");
+
     auto path = makeStagePath(stage_num);
+    Trace::Scope trace_scope("load", path);
     stage = StageSerializer::deserialize(path);
+    traceFileSize("read bytes", path);
+
+    modified = false;
+    reload_pending = false;
+    overwrite_confirmed = false;
+    edit_serial += 1;
+    lint->invalidate();
+    snapshots.invalidate();
+
+    // バックアップはステージごとなので差分表示をやめる
+    diff_stage.reset();
+
+    openJournal(path);
+  }
+
+  // 前回保存せずに終わった編集があれば復元する
+  void openJournal(const std::string& stage_file) {
+    journal.reset();
+    if (!config_.journal) return;
+
+    journal = std::unique_ptr<StageJournal>(new StageJournal(getDocumentPath(config_.journal_path),
+                                                             stage_file,
+                                                             config_.journal_checkpoint));
+    try {
+      if (journal->recover(StageJournal::readFile(getDocumentPath(stage_file)), stage)) {
+        markModified();
+        console() << "journal recovered:" << stage_file << std::endl;
+
+        bg_color = Color(0, 0, 0.5);
+        bg_duration = 0.5;
+      }
+    }
+    catch (const std::exception& e) {
+      console() << "journal recovery failed:" << stage_file << " " << e.what() << std::endl;
+    }
+  }
+
+  void journalCube(const Vec2i& pos) {
+    if (!journal) return;
+
+    auto* cube = stage.getCube(Vec3i(pos.x, 0, pos.y));
+    if (cube) {
+      journal->writeCube(*cube);
+      updateJournal();
+    }
+  }
+
+  void journalParams() {
+    if (!journal) return;
+
+    journal->writeParams(stage);
+    updateJournal();
+  }
+
+  void journalSize() {
+    if (!journal) return;
+
+    journal->writeSize(stage.size);
+    updateJournal();
+  }
+
+  void journalClear() {
+    if (!journal) return;
+
+    journal->writeClear();
+    updateJournal();
+  }
+
+  // 記録が溜まったらステージ全体を書き出して取り直す
+  void updateJournal() {
+    if (!journal->needsCheckpoint()) return;
+
+    try {
+      journal->checkpoint(stage);
+    }
+    catch (const std::exception& e) {
+      console() << "journal checkpoint failed:" << e.what() << std::endl;
+    }
   }
 
   void writeStage(const int stage_num) {
-    if (auto_backup) {
-      backupStage(stage_num);
+    writeStageFile(makeStagePath(stage_num), stage);
+    finishWriteStage(stage_num);
+  }
+
+  // stageを保存した後の後始末
+  void finishWriteStage(const int stage_num) {
+    // TIPS:保存前のvalidateで穴の上の特殊なキューブが消えるため
+    //      (消えたセルを指していたlintの指摘も残さない)
+    snapshots.invalidate();
+    lint->invalidate();
+
+    modified = false;
+    reload_pending = false;
+    overwrite_confirmed = false;
+
+    if (journal) {
+      journal->reset(StageJournal::readFile(getDocumentPath(makeStagePath(stage_num))));
     }
+  }
 
-    stage.validate();
+  void writeStageFile(const std::string& stage_file, Stage& target) {
+    AllocTrack::Scope alloc_scope("save");
+    Trace::Scope trace_scope("save", stage_file);
 
-    auto path = getDocumentPath(makeStagePath(stage_num));
-    StageSerializer::serialize(stage, path);
+    if (config_.auto_backup) {
+      backupStage(stage_file);
+    }
+
+    target.validate();
+
+    auto path = getDocumentPath(stage_file);
+    StageSerializer::serialize(target, path,
+                               config_.body_rle ? StageSerializer::BODY_RLE : StageSerializer::BODY_PLAIN);
+    traceFileSize("write bytes", stage_file);
+    file_watcher->ignore(stage_file);
+
+    // TIPS:ファイルの監視では気付かないので、コース側の古い内容をここで捨てる
+    //      コースで編集中のものはinvalidateが残す
+    if (course) {
+      course->invalidate(stage_file);
+    }
+    if (browser) {
+      browser->invalidate(stage_file);
+    }
+  }
+
+  void traceFileSize(const char* name, const std::string& stage_file) {
+    boost::system::error_code ec;
+    auto size = boost::filesystem::file_size(getDocumentPath(stage_file), ec);
+    if (!ec) Trace::counter(name, size);
+  }
+
+  // PGM/PPMはStageHeightmapで、それ以外の形式はCinderで読む
+  static StageHeightmap::Image readHeightmapImage(const boost::filesystem::path& path) {
+    auto ext = boost::algorithm::to_lower_copy(path.extension().string());
+    if ((ext == ".pgm") || (ext == ".ppm") || (ext == ".pnm")) return StageHeightmap::readImage(path.string());
+
+    Surface8u surface(loadImage(path));
+    StageHeightmap::Image image(surface.getWidth(), surface.getHeight());
+    for (int y = 0; y < image.height; ++y) {
+      const auto* src = surface.getData(Vec2i(0, y));
+      auto* dst = &image.pixels[y * image.width * 4];
+      for (int x = 0; x < image.width; ++x, src += surface.getPixelInc(), dst += 4) {
+        dst[0] = src[surface.getRedOffset()];
+        dst[1] = src[surface.getGreenOffset()];
+        dst[2] = src[surface.getBlueOffset()];
+        dst[3] = surface.hasAlpha() ? src[surface.getAlphaOffset()] : 255;
+      }
+    }
+    return image;
+  }
+
+  // 画像から今のステージを作り直す(大きさは画像かheightmap.paramsに合わせる)
+  // 色や速度などはそのまま
+  void importHeightmap(const boost::filesystem::path& path) {
+    Trace::Scope trace_scope("heightmap", path.filename().string());
+
+    Stage new_stage;
+    try {
+      auto params = StageHeightmap::parse(config_.heightmap_params);
+      new_stage = StageHeightmap::convert(readHeightmapImage(path), params, stage);
+    }
+    catch (const std::exception& e) {
+      console() << "heightmap import failed:" << e.what() << std::endl;
+      return;
+    }
+
+    // 記録開始時のステージと食い違うので記録はここまで
+    stopRecording();
+
+    auto changed = stage.applyDiff(new_stage);
+    markModified();
+    lint->invalidate();
+    snapshots.invalidate();
+    console() << "heightmap:" << path.string() << " " << stage.size.x << "x" << stage.size.y
+              << " " << changed << " cells" << std::endl;
+
+    // TIPS:大きさも変わるので1件ずつではなく丸ごと記録する
+    if (journal) {
+      try {
+        journal->checkpoint(stage);
+      }
+      catch (const std::exception& e) {
+        console() << "journal checkpoint failed:" << e.what() << std::endl;
+      }
+    }
+
+    on_cursor = false;
+    selected  = false;
+    clearPropertyPanel();
+    refreshPanel("settings");
+
+    bg_color = Color(0, 0, 0.5);
+    bg_duration = 0.5;
   }
 
-  void backupStage(const int stage_num) {
-    auto origin_path = getDocumentPath(makeStagePath(stage_num));
+  // これまでの記録をChromeのトレース形式で書き出す(chrome://tracingで開く)
+  void writeTrace() {
+    auto directory = getDocumentPath(config_.trace_path);
+    try {
+      boost::filesystem::create_directories(directory);
+      auto path = directory + "trace" + createUniquePath() + ".json";
+      Trace::writeChromeJson(path);
+      console() << "trace to:" << path << std::endl;
+    }
+    catch (const std::exception& e) {
+      console() << "trace failed:" << e.what() << std::endl;
+    }
+  }
 
-    auto backup_path = getDocumentPath(std::string("backup/") + makeStagePath(stage_num))
+  // 表示中の編集を書き出す。書き出したらtrueを返す
+  // TIPS:書けなかったファイルは元のまま残り、編集中の内容も未保存のまま
+  bool writeEditingStages() {
+    if (chunk_view) {
+      return writeChunks();
+    }
+
+    // ファイルが外部で書き換えられていたら、1回目は断ってもう一度押すのを待つ
+    if (reload_pending && !overwrite_confirmed) {
+      overwrite_confirmed = true;
+      console() << "stage changed on disk:" << makeStagePath(current_stage)
+                << " save again to overwrite it, R to reload" << std::endl;
+      return false;
+    }
+
+    try {
+      if (course_view) {
+        writeCourseStages();
+      }
+      else {
+        writeStage(current_stage);
+      }
+    }
+    catch (const std::exception& e) {
+      console() << "save failed:" << e.what() << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // 編集したタイルだけを書き戻す
+  bool writeChunks() {
+    try {
+      auto num = chunks->flush();
+      console() << "chunks:" << num << " written" << std::endl;
+    }
+    catch (const std::exception& e) {
+      console() << "chunks write failed:" << e.what() << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // コース表示で編集したステージを全て書き出す
+  void writeCourseStages() {
+    for (const auto& entry : course->getEntries()) {
+      if (!entry->modified || !entry->stage) continue;
+
+      writeStageFile(entry->path, *entry->stage);
+      entry->modified = false;
+
+      // 今のステージなら1つの表示の方にも写す(戻った後の保存で古い内容に戻さないため)
+      if (entry->path == makeStagePath(current_stage)) {
+        stage = *entry->stage;
+        edit_serial += 1;
+        finishWriteStage(current_stage);
+      }
+    }
+  }
+
+  void backupStage(const std::string& stage_file) {
+    auto origin_path = getDocumentPath(stage_file);
+
+    auto backup_path = getDocumentPath(std::string("backup/") + stage_file)
       + createUniquePath();
 
     console() << "backup to:" << backup_path << std::endl;
@@ -355,7 +1405,14 @@ class StageEditorApp : public AppNative {
   void copyAllStagesToApp() {
     for (const auto& path : stage_path) {
       auto path_from = getDocumentPath(path);
-      auto path_to = getDocumentPath(copy_path + path);
+      auto path_to = getDocumentPath(config_.copy_path + path);
+
+      // TIPS:ゲームはランレングスのbodyを読めないので、数値の配列に戻して書く
+      auto params = Json::readFromPath(path_from);
+      if (StageSerializer::isRle(params)) {
+        StageSerializer::serialize(StageSerializer::makeStage(params), path_to);
+        continue;
+      }
 
       // TIPS:上書き許可
       boost::filesystem::copy_file(path_from, path_to,
@@ -364,6 +1421,19 @@ class StageEditorApp : public AppNative {
   }
 
 
+  // 全ステージを1ファイルにまとめてアプリへ書き出す
+  void exportStagePack() {
+    std::vector<std::pair<std::string, Stage> > stages;
+    for (const auto& path : stage_path) {
+      stages.push_back(std::make_pair(path, StageSerializer::deserialize(path)));
+    }
+
+    auto pack_path = getDocumentPath(config_.copy_path + config_.pack_name);
+    StagePack::write(stages, pack_path);
+    console() << "pack:" << pack_path << std::endl;
+  }
+
+
   static std::string getDocumentPath(const std::string& path) {
 #if defined (CINDER_MAC)
     // OSXはプロジェクト位置基底(assertが実行ファイルと同梱されてしまうため)
@@ -396,14 +1466,34 @@ class StageEditorApp : public AppNative {
   }
 
   
+  // 起動時に一度だけ作る
+  // TIPS:stageはメンバなので、ステージを切り替えてもバインドしたアドレスは変わらない
   void setupSettingsPanel() {
+    AllocTrack::Scope alloc_scope("panel");
+    Trace::Scope trace_scope("panel", "settings");
+
     settings_panel->clear();
 
-    {
-      std::ostringstream text;
-      text << "stage: " << stage_path[current_stage];
-      settings_panel->addText(text.str());
-    }
+    auto modified_fn = [this]() {
+      markModified();
+      journalParams();
+      lint->markParams();
+      snapshots.markParams();
+    };
+
+    settings_panel->addParam("stage", &panel_stage_name, true);
+    // 例: oneway_power>2;width>8
+    settings_panel->addParam("query", &stage_query).updateFn([this]() {
+        applyQuery();
+      });
+
+    settings_panel->addSeparator();
+
+    settings_panel->addParam("time", &timeline_time)
+      .min(0)
+      .max(config_.timeline_length)
+      .step(0.05);
+    settings_panel->addParam("play", &timeline_play);
 
     settings_panel->addSeparator();
 
@@ -412,130 +1502,314 @@ class StageEditorApp : public AppNative {
 
     settings_panel->addSeparator();
 
-    settings_panel->addParam("color", &stage.color);
-    settings_panel->addParam("bg_color", &stage.bg_color);
+    settings_panel->addParam("color", &stage.color)
+      .updateFn(modified_fn);
+    settings_panel->addParam("bg_color", &stage.bg_color)
+      .updateFn(modified_fn);
 
     settings_panel->addSeparator();
     
-    settings_panel->addParam("x_offset", &stage.x_offset);
+    settings_panel->addParam("x_offset", &stage.x_offset)
+      .updateFn(modified_fn);
     settings_panel->addParam("pickable", &stage.pickable)
-      .min(0);
+      .min(0)
+      .updateFn(modified_fn);
 
     settings_panel->addSeparator();
 
     settings_panel->addParam("build_speed", &stage.build_speed)
       .min(0)
-      .step(0.001);
+      .step(0.001)
+      .updateFn(modified_fn);
     
     settings_panel->addParam("collapse_speed", &stage.collapse_speed)
       .min(0)
-      .step(0.001);
+      .step(0.001)
+      .updateFn(modified_fn);
     
     settings_panel->addParam("auto_collapse", &stage.auto_collapse)
       .min(0)
-      .step(0.001);
+      .step(0.001)
+      .updateFn(modified_fn);
 
     settings_panel->addSeparator();
 
-	settings_panel->addParam("camera", &stage.camera);
-	settings_panel->addParam("light_tween", &stage.light_tween);
+	settings_panel->addParam("camera", &stage.camera)
+      .updateFn(modified_fn);
+	settings_panel->addParam("light_tween", &stage.light_tween)
+      .updateFn(modified_fn);
 
     settings_panel->addSeparator();
 
+    // TIPS:大きさだけ変わっても差分の印では追えないので、全て調べ直す印を付ける
+    auto resize_fn = [this]() {
+      on_cursor = false;
+      selected  = false;
+      markModified();
+      clearPropertyPanel();
+      stage.resize();
+      journalSize();
+      lint->invalidate();
+      snapshots.invalidate();
+    };
+
     settings_panel->addParam("width", &stage.size.x)
       .min(1)
-      .updateFn([this]() {
-          on_cursor = false;
-          selected  = false;
-          clearPropertyPanel();
-          stage.resize();
-        });
+      .updateFn(resize_fn);
 
     settings_panel->addParam("length", &stage.size.y)
       .min(1)
-      .updateFn([this]() {
-          on_cursor = false;
-          selected  = false;
-          clearPropertyPanel();
-          stage.resize();
-        });
+      .updateFn(resize_fn);
 
     settings_panel->addSeparator();
 
     settings_panel->addText("save: W  stage change: , .");
-    settings_panel->addText("item: i moving: m switch: s falling: f");
-    settings_panel->addText("oneway: o");
+    addCubeTypeHelp();
     settings_panel->addText("change height: - ^ 0");
-    settings_panel->addText("copy to app: C");
+    settings_panel->addText("insert/delete row: I X  column: Y Z");
+    settings_panel->addText("copy to app: C  export pack: P");
     settings_panel->addText("cleanup stage: K");
+    settings_panel->addText("reload changed file: R");
+    settings_panel->addText("course view: V");
+    settings_panel->addText("chunk view: G");
+    settings_panel->addText("diff with backup: D");
+    settings_panel->addText("stage browser: B");
+    settings_panel->addText("record input: Q");
+    settings_panel->addText("allocation report: A");
+    settings_panel->addText("write trace: E");
+    settings_panel->addText("lint view: L");
+    settings_panel->addText("timeline (moving/falling): T");
+    settings_panel->addText("import heightmap: drop image");
+  }
+
+  void updateSettingsPanel() {
+    panel_stage_name = stage_path[current_stage];
+    refreshPanel("settings");
+  }
+
+
+  void markModified() {
+    modified = true;
+    edit_serial += 1;
+  }
+
+  // 選択したキューブの種類が変わった時だけ作り直し、
+  // 同じ種類なら値の入れ替えだけで済ませる
+  void setupPropertyPanel() {
+    AllocTrack::Scope alloc_scope("panel");
+    Trace::Scope trace_scope("panel", "property");
+
+    int type = getPropertyType();
+    if (type != property_type) {
+      if (type == Stage::Cube::NONE) {
+        if (property_type >= 0) clearPropertyPanel();
+        return;
+      }
+
+      property_panel->clear();
+      property_target.clear();
+
+      PropertyPanelBuilder builder = { this, type };
+      forEachCubeType(builder);
+      property_type = type;
+    }
+
+    loadPropertyProxy();
+    refreshPanel("property");
+  }
+
+  int getPropertyType() const {
+    const auto* cube = stage.getCube(ci::Vec3i(selected_pos.x, 0, selected_pos.y));
+    return (cube && findCubeTypeInfo(cube->type)) ? cube->type : int(Stage::Cube::NONE);
   }
 
+  // 種類ごとのパネルはCubeTraitsで多重定義したsetupPropertyPanelを呼び分ける
+  struct PropertyPanelBuilder {
+    StageEditorApp* app;
+    int type;
+
+    template <int TYPE>
+    void apply() {
+      if (type == TYPE) app->setupPropertyPanel(CubeTraits<TYPE>());
+    }
+  };
+
+  // 種類を切り替えるキーの説明は表から作る
+  void addCubeTypeHelp() {
+    const size_t per_line = 4;
+
+    std::ostringstream text;
+    size_t count = 0;
+    for (const auto& info : getCubeTypeInfo()) {
+      if (count > 0) text << " ";
+      text << info.name << ": " << info.edit_key;
+      count += 1;
+      if (count == per_line) {
+        settings_panel->addText(text.str());
+        text.str("");
+        count = 0;
+      }
+    }
+    if (count > 0) settings_panel->addText(text.str());
+  }
+
+  // パネルは複製した値を表示し、編集されたらキューブへ書き戻す
+  void loadPropertyProxy() {
+    property_pattern   = stage.getPattern(selected_pos);
+    property_interval  = stage.getInterval(selected_pos);
+    property_delay     = stage.getDelay(selected_pos);
+    property_direction = stage.getDirection(selected_pos);
+    property_power     = stage.getPower(selected_pos);
+
+    if (property_type == Stage::Cube::SWITCH) {
+      const auto& target = stage.getTarget(selected_pos);
+
+      // TIPS:増減した分だけ項目を足し引きする
+      while (property_target.size() > target.size()) {
+        property_panel->removeParam(makeTargetParamName(property_target.size()));
+        property_target.pop_back();
+      }
+      while (property_target.size() < target.size()) {
+        property_target.push_back(std::string());
+        size_t index = property_target.size() - 1;
+        property_panel->addParam(makeTargetParamName(index + 1), &property_target.back())
+          .updateFn([this, index]() {
+              auto& target = stage.getTarget(selected_pos);
+              if (index < target.size()) target[index] = property_target[index];
+              propertyModified();
+            });
+      }
+      std::copy(target.begin(), target.end(), property_target.begin());
+    }
+  }
+
+  static std::string makeTargetParamName(const size_t index) {
+    std::ostringstream text;
+    text << "target:" << index;
+    return text.str();
+  }
+
+  void propertyModified() {
+    markModified();
+    journalCube(selected_pos);
+    lint->markCell(selected_pos);
+    snapshots.markCell(selected_pos);
+  }
 
   void clearPropertyPanel() {
     property_panel->clear();
+    property_type = -1;
+    property_target.clear();
   }
   
-  void setupItemPropertyPanel() {
-    property_panel->clear();
-  }
+  void setupPropertyPanel(CubeTraits<Stage::Cube::ITEM>) {}
   
-  void setupMovingPropertyPanel() {
-    property_panel->clear();
-
+  void setupPropertyPanel(CubeTraits<Stage::Cube::MOVING>) {
     property_panel->addText("moving");
     
     property_panel->addSeparator();
     
-    property_panel->addParam("pattern", &stage.getPattern(selected_pos));
+    property_panel->addParam("pattern", &property_pattern)
+      .updateFn([this]() {
+          stage.getPattern(selected_pos) = property_pattern;
+          propertyModified();
+        });
   }
 
-  void setupSwitchPropertyPanel() {
-    property_panel->clear();
-
+  void setupPropertyPanel(CubeTraits<Stage::Cube::SWITCH>) {
     property_panel->addText("switch");
     
     property_panel->addSeparator();
 
-    auto& target = stage.getTarget(selected_pos);
-    size_t index = 1;
-    for (auto& t : target) {
-      std::ostringstream text;
-      text << "target:" << index;
-      property_panel->addParam(text.str(), &t);
+    property_panel->addText("target number change: [ ]");
 
-      index += 1;
-    }
-    
+    // ターゲットの項目はloadPropertyProxyで末尾に足す
     property_panel->addSeparator();
-
-    property_panel->addText("target number change: [ ]");
   }
 
-  void setupOnewayPropertyPanel() {
-    property_panel->clear();
-
+  void setupPropertyPanel(CubeTraits<Stage::Cube::ONEWAY>) {
     property_panel->addText("oneway");
     
     property_panel->addSeparator();
 
-    auto& direction = stage.getDirection(selected_pos);
-    property_panel->addParam("direction", &direction);
+    property_panel->addParam("direction", &property_direction)
+      .updateFn([this]() {
+          stage.getDirection(selected_pos) = property_direction;
+          propertyModified();
+        });
 
-    auto& power = stage.getPower(selected_pos);
-    property_panel->addParam("power", &power);
+    property_panel->addParam("power", &property_power)
+      .updateFn([this]() {
+          stage.getPower(selected_pos) = property_power;
+          propertyModified();
+        });
     
   }
   
-  void setupFallingPropertyPanel() {
-    property_panel->clear();
-
+  void setupPropertyPanel(CubeTraits<Stage::Cube::FALLING>) {
     property_panel->addText("falling");
 
-    auto& interval = stage.getInterval(selected_pos);
-    property_panel->addParam("interval", &interval);
+    property_panel->addParam("interval", &property_interval)
+      .updateFn([this]() {
+          stage.getInterval(selected_pos) = property_interval;
+          propertyModified();
+        });
+
+    property_panel->addParam("delay", &property_delay)
+      .updateFn([this]() {
+          stage.getDelay(selected_pos) = property_delay;
+          propertyModified();
+        });
+  }
+
+
+  StageLint::Names makeLintNames() const {
+    return StageLint::Names(config_.lint_camera, config_.lint_light_tween, config_.lint_direction);
+  }
+
+  // 問題の一覧が変わった時に作り直す
+  // セルの問題はボタンにして、押すとそのセルを選択する
+  void setupLintPanel() {
+    const size_t max_lines = 30;
+    Trace::Scope trace_scope("panel", "lint");
+
+    lint_panel->clear();
+
+    const auto& issues = lint->getIssues();
+    lint_panel->addText("errors: " + std::to_string(lint->getNumErrors())
+                        + "  warnings: " + std::to_string(lint->getNumWarnings()));
+    lint_panel->addSeparator();
+
+    for (size_t i = 0; i < std::min(issues.size(), max_lines); ++i) {
+      const auto& issue = issues[i];
+      // TIPS:ボタンの名前はバーの中で重ならないよう番号を付ける
+      auto text = std::to_string(i + 1) + ". " + StageLint::format(issue);
+      if (issue.pos.x < 0) {
+        lint_panel->addText(text);
+        continue;
+      }
+
+      const auto pos = issue.pos;
+      lint_panel->addButton(text, [this, pos]() {
+          if (!isEditingStage() || browser_view) return;
+          selected = true;
+          selected_pos = pos;
+          setupPropertyPanel();
+        });
+    }
+    if (issues.size() > max_lines) {
+      lint_panel->addText("... " + std::to_string(issues.size() - max_lines) + " more");
+    }
+
+    refreshPanel("lint");
+  }
+
 
-    auto& delay = stage.getDelay(selected_pos);
-    property_panel->addParam("delay", &delay);
+  // バインドしている値を変えた時だけ表示を更新する
+  // TIPS:InterfaceGlはパネル名でAntTweakBarのバーを作る
+  static void refreshPanel(const std::string& name) {
+    auto* bar = TwGetBarByName(name.c_str());
+    if (bar) TwRefreshBar(bar);
   }
   
 };
@@ -0,0 +1,359 @@
+﻿#pragma once
+
+//
+// ステージの自動生成
+// 条件から候補をたくさん作り、たどり着けないものや検査でエラーになるものを捨てる
+//
+//   "width=8;length=40;holes=0.1;height=2;item=4;moving=2;build_speed=0.5:1"
+//
+//   width length      大きさ
+//   holes             穴の割合(0〜1)
+//   height            高さの最大(隣のセルとの差は1まで)
+//   item moving switch falling oneway   種類ごとの数
+//   build_speed collapse_speed auto_collapse   速さの範囲(min:max)
+//   seed              乱数の種(同じ条件と種なら同じステージになる)
+//
+// TIPS:候補の番号ごとに乱数を作るので、スレッドの数や順番によらず結果は同じ
+//
+
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include "Stage.hpp"
+#include "CubeTraits.hpp"
+#include "StageLint.hpp"
+#include "StageTimeline.hpp"
+#include "NumberFormat.hpp"
+
+
+namespace ngs {
+namespace StageGenerator {
+
+struct Range {
+  float min;
+  float max;
+};
+
+struct Params {
+  ci::Vec2i size;
+  float holes;
+  int height;
+  // 添字はStage::getTypeIndexと同じ
+  int count[Stage::NUM_CUBE_TYPES];
+
+  Range build_speed;
+  Range collapse_speed;
+  Range auto_collapse;
+
+  unsigned int seed;
+
+  Params() :
+    size(8, 40),
+    holes(0.1f),
+    height(2),
+    seed(0)
+  {
+    std::fill(std::begin(count), std::end(count), 0);
+
+    Range none = { 0.0f, 0.0f };
+    build_speed    = none;
+    collapse_speed = none;
+    auto_collapse  = none;
+  }
+};
+
+struct Result {
+  std::vector<Stage> stages;
+
+  size_t tried;
+  size_t unreachable;
+  size_t invalid;
+};
+
+
+Range parseRange(const std::string& name, const std::string& text) {
+  auto separator = text.find(':');
+  float min = NumberFormat::parseValue<float>(name, text.substr(0, separator));
+  float max = (separator == std::string::npos) ? min : NumberFormat::parseValue<float>(name, text.substr(separator + 1));
+  if ((min < 0.0f) || (max < min)) throw std::invalid_argument(name + ": bad range " + text);
+
+  Range range = { min, max };
+  return range;
+}
+
+// 知らない項目名ならfalse
+bool parseParam(const std::string& name, const std::string& value, Params& params) {
+  if (name == "width")  { params.size.x = NumberFormat::parseValue<int>(name, value); return true; }
+  if (name == "length") { params.size.y = NumberFormat::parseValue<int>(name, value); return true; }
+  if (name == "holes")  { params.holes  = NumberFormat::parseValue<float>(name, value); return true; }
+  if (name == "height") { params.height = NumberFormat::parseValue<int>(name, value); return true; }
+  if (name == "seed")   { params.seed   = unsigned(NumberFormat::parseValue<int>(name, value)); return true; }
+
+  if (name == "build_speed")    { params.build_speed    = parseRange(name, value); return true; }
+  if (name == "collapse_speed") { params.collapse_speed = parseRange(name, value); return true; }
+  if (name == "auto_collapse")  { params.auto_collapse  = parseRange(name, value); return true; }
+
+  const auto& infos = getCubeTypeInfo();
+  for (size_t i = 0; i < infos.size(); ++i) {
+    if (name != infos[i].name) continue;
+
+    params.count[i] = NumberFormat::parseValue<int>(name, value);
+    if (params.count[i] < 0) throw std::invalid_argument(name + ": must be positive " + value);
+    return true;
+  }
+
+  return false;
+}
+
+// ';'区切りの条件を読む(書かなかった項目は元の値のまま)
+Params parse(const std::string& text, Params params = Params()) {
+  NumberFormat::parseParams(text, [&params](const std::string& name, const std::string& value) {
+      return parseParam(name, value, params);
+    });
+
+  if ((params.size.x < 1) || (params.size.y < 2)) throw std::invalid_argument("stage is too small");
+  if ((params.holes < 0.0f) || (params.holes >= 1.0f)) throw std::invalid_argument("holes must be 0 to 1");
+  if ((params.height < 0) || (params.height > 10)) throw std::invalid_argument("height must be 0 to 10");
+
+  return params;
+}
+
+
+// 手前の行から穴を通らずに奥の行までたどり着けるか
+// アイテムとスイッチも全て取りに行ける必要がある
+// TIPS:隣のセルとの高さの差が1までなら移動できるものとする
+bool isReachable(const Stage& stage) {
+  const int width  = stage.size.x;
+  const int length = stage.size.y;
+
+  auto height = [&stage](const int x, const int z) {
+    const auto* cube = stage.getCube(ci::Vec3i(x, 0, z));
+    return cube ? cube->pos.y : -1;
+  };
+
+  std::vector<char> visited(width * length, 0);
+  std::vector<ci::Vec2i> queue;
+  for (int x = 0; x < width; ++x) {
+    if (height(x, 0) < 0) continue;
+
+    visited[x] = 1;
+    queue.push_back(ci::Vec2i(x, 0));
+  }
+
+  const ci::Vec2i offsets[] = { ci::Vec2i(1, 0), ci::Vec2i(-1, 0), ci::Vec2i(0, 1), ci::Vec2i(0, -1) };
+  for (size_t i = 0; i < queue.size(); ++i) {
+    const auto pos = queue[i];
+    const int h = height(pos.x, pos.y);
+
+    for (const auto& offset : offsets) {
+      const auto next = pos + offset;
+      if ((next.x < 0) || (next.x >= width) || (next.y < 0) || (next.y >= length)) continue;
+      if (visited[next.y * width + next.x]) continue;
+
+      const int next_h = height(next.x, next.y);
+      if ((next_h < 0) || (std::abs(next_h - h) > 1)) continue;
+
+      visited[next.y * width + next.x] = 1;
+      queue.push_back(next);
+    }
+  }
+
+  bool goal = false;
+  for (int x = 0; x < width; ++x) {
+    if (visited[(length - 1) * width + x]) goal = true;
+  }
+  if (!goal) return false;
+
+  for (int type : { int(Stage::Cube::ITEM), int(Stage::Cube::SWITCH) }) {
+    for (const auto& pos : stage.getSpecialCubes(type)) {
+      if (!visited[pos.y * width + pos.x]) return false;
+    }
+  }
+  return true;
+}
+
+
+float randomRange(const Range& range, std::mt19937& random) {
+  if (range.max <= range.min) return range.min;
+  return std::uniform_real_distribution<float>(range.min, range.max)(random);
+}
+
+// 行ったり来たりして元の位置に戻るpattern
+// TIPS:ステージの外へ出ない幅で往復する
+std::string makePattern(const Stage& stage, const ci::Vec2i& pos, std::mt19937& random) {
+  int value = std::uniform_int_distribution<int>(0, 1)(random) ? 4 : 6;
+  const int dx = int(StageTimeline::getStepDirection(value).x);
+  int space = (dx > 0) ? (stage.size.x - 1 - pos.x) : pos.x;
+  if (space == 0) {
+    value = 10 - value;
+    space = stage.size.x - 1;
+  }
+  if (space == 0) return "0";
+
+  int steps = std::uniform_int_distribution<int>(1, std::min(space, 4))(random);
+  std::vector<int> pattern(steps, value);
+  pattern.push_back(0);
+  pattern.insert(pattern.end(), steps, 10 - value);
+  pattern.push_back(0);
+  return NumberFormat::joinIntList(pattern);
+}
+
+void setupCube(Stage& stage, const ci::Vec2i& pos, const int type, std::mt19937& random) {
+  stage.setType(pos, type);
+  auto& cube = stage.body[pos.y][pos.x];
+
+  switch (type) {
+  case Stage::Cube::MOVING:
+    cube.pattern = makePattern(stage, pos, random);
+    break;
+
+  case Stage::Cube::SWITCH:
+    {
+      int num = std::uniform_int_distribution<int>(1, 3)(random);
+      std::uniform_int_distribution<int> x(0, stage.size.x - 1);
+      std::uniform_int_distribution<int> z(0, stage.size.y - 1);
+      for (int i = 0; i < num; ++i) {
+        cube.target.push_back(NumberFormat::joinIntList({ x(random), 0, z(random) }));
+      }
+    }
+    break;
+
+  case Stage::Cube::FALLING:
+    cube.interval = std::uniform_int_distribution<int>(6, 16)(random) * 0.05f;
+    cube.delay    = 0.0f;
+    break;
+
+  case Stage::Cube::ONEWAY:
+    {
+      static const char* directions[] = { "up", "down", "left", "right" };
+      cube.direction = directions[std::uniform_int_distribution<int>(0, 3)(random)];
+      cube.power     = std::uniform_int_distribution<int>(1, 3)(random);
+    }
+    break;
+  }
+}
+
+// 候補を1つ作る
+// 手前の1行は穴にも特殊なキューブにもしない(スタート位置)
+Stage makeCandidate(const Params& params, const unsigned int index) {
+  std::seed_seq seq = { params.seed, index };
+  std::mt19937 random(seq);
+
+  Stage stage;
+  stage.size = params.size;
+  stage.resize();
+
+  // 高さは手前の行から±1ずつ変える
+  std::uniform_int_distribution<int> step(-1, 1);
+  std::uniform_real_distribution<float> rate(0.0f, 1.0f);
+  std::vector<int> heights(params.size.x, 0);
+  for (int z = 0; z < params.size.y; ++z) {
+    for (int x = 0; x < params.size.x; ++x) {
+      if (z > 0) heights[x] = std::min(std::max(heights[x] + step(random), 0), params.height);
+
+      bool hole = (z > 0) && (rate(random) < params.holes);
+      stage.body[z][x].pos.y = hole ? -1 : heights[x];
+    }
+  }
+
+  // 特殊なキューブは穴でも他の種類でもないセルに置く
+  std::vector<ci::Vec2i> cells;
+  for (int z = 1; z < params.size.y; ++z) {
+    for (int x = 0; x < params.size.x; ++x) {
+      if (stage.body[z][x].pos.y >= 0) cells.push_back(ci::Vec2i(x, z));
+    }
+  }
+  std::shuffle(cells.begin(), cells.end(), random);
+
+  size_t next = 0;
+  const auto& infos = getCubeTypeInfo();
+  for (size_t i = 0; i < infos.size(); ++i) {
+    for (int n = 0; (n < params.count[i]) && (next < cells.size()); ++n) {
+      setupCube(stage, cells[next++], infos[i].type, random);
+    }
+  }
+
+  stage.color    = ci::Color(rate(random) * 0.5f + 0.5f, rate(random) * 0.5f + 0.5f, rate(random) * 0.5f + 0.5f);
+  stage.bg_color = ci::Color(rate(random) * 0.3f, rate(random) * 0.3f, rate(random) * 0.3f);
+
+  stage.x_offset = 0;
+  stage.pickable = 0;
+
+  stage.build_speed    = randomRange(params.build_speed, random);
+  stage.collapse_speed = randomRange(params.collapse_speed, random);
+  stage.auto_collapse  = randomRange(params.auto_collapse, random);
+
+  stage.camera      = "normal";
+  stage.light_tween = "default";
+
+  return stage;
+}
+
+
+// num個見つかるか、max_tries個作るまで候補を作る
+// 候補の番号順に採用するので、結果はスレッドの数によらない
+Result generate(const Params& params, const size_t num, const size_t max_tries) {
+  const size_t batch_size = 256;
+  const size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  Result result;
+  result.tried       = 0;
+  result.unreachable = 0;
+  result.invalid     = 0;
+
+  while ((result.stages.size() < num) && (result.tried < max_tries)) {
+    const size_t first = result.tried;
+    const size_t batch = std::min(batch_size, max_tries - first);
+
+    // 0:採用 1:たどり着けない 2:検査でエラー
+    std::vector<Stage> stages(batch);
+    std::vector<char> status(batch, 0);
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+      StageLint lint((StageLint::Names()));
+      for (size_t i = next++; i < batch; i = next++) {
+        stages[i] = makeCandidate(params, unsigned(first + i));
+        if (!isReachable(stages[i])) {
+          status[i] = 1;
+          continue;
+        }
+
+        lint.invalidate();
+        lint.update(stages[i]);
+        if (lint.getNumErrors() > 0) status[i] = 2;
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min(num_threads, batch); ++i) {
+      threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    for (size_t i = 0; i < batch; ++i) {
+      result.tried += 1;
+      if (status[i] == 1) {
+        result.unreachable += 1;
+      }
+      else if (status[i] == 2) {
+        result.invalid += 1;
+      }
+      else {
+        result.stages.push_back(std::move(stages[i]));
+        if (result.stages.size() == num) break;
+      }
+    }
+  }
+
+  return result;
+}
+
+}
+}
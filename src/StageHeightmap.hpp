@@ -0,0 +1,337 @@
+﻿#pragma once
+
+//
+// 画像からステージを作る
+// 明るさを高さに、決めておいた色をキューブの種類にする
+//
+//   "width=8;length=40;height=3;hole=0.1;tolerance=0.2;item=ffff00"
+//
+//   width length       大きさ(0なら画像のピクセル数)
+//   height             白の高さ(黒に近いほど低い)
+//   hole               これより暗いセルは穴(0〜1)。透明なピクセルも穴
+//   tolerance          色キーとの差の許容量(0〜1)
+//   item moving switch falling oneway   色キー(RRGGBB)。既定はエディタの表示色
+//
+// TIPS:画像はthumbsと同じ向き(奥が上、xは右から左)
+//      1セルに入るピクセルをまとめて調べ、半分以上が同じ色キーならその種類にする
+//      色キーのセルの高さは、同じセルの灰色のピクセルから決める(無ければ左隣のセルと同じ)
+//      大きな画像は行をスレッドに振り分ける(行ごとに別のvectorへ書くのでロックしない)
+//
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include "Stage.hpp"
+#include "CubeTraits.hpp"
+#include "NumberFormat.hpp"
+#include "StageRasterizer.hpp"
+
+
+namespace ngs {
+namespace StageHeightmap {
+
+using Image = StageRasterizer::Image;
+
+enum {
+  // これ以上のピクセル数なら行をスレッドに振り分ける
+  PARALLEL_PIXELS = 1 << 16,
+};
+
+struct Key {
+  int type;
+  uint8_t rgb[3];
+};
+
+struct Params {
+  ci::Vec2i size;
+  int height;
+  float hole;
+  float tolerance;
+  std::vector<Key> keys;
+
+  Params() :
+    size(0, 0),
+    height(3),
+    hole(0.1f),
+    tolerance(0.2f)
+  {
+    for (const auto& info : getCubeTypeInfo()) {
+      Key key = { info.type, {
+          uint8_t(info.color.r * 255.0f + 0.5f),
+          uint8_t(info.color.g * 255.0f + 0.5f),
+          uint8_t(info.color.b * 255.0f + 0.5f) } };
+      keys.push_back(key);
+    }
+  }
+};
+
+
+// RRGGBB(先頭の#は付けても付けなくてもよい)
+void parseColor(const std::string& name, std::string text, uint8_t rgb[3]) {
+  if (!text.empty() && (text[0] == '#')) text.erase(0, 1);
+  if ((text.size() != 6) || (text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)) {
+    throw std::invalid_argument(name + ": color must be RRGGBB " + text);
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    rgb[i] = uint8_t(std::strtol(text.substr(i * 2, 2).c_str(), nullptr, 16));
+  }
+}
+
+// 知らない項目名ならfalse
+bool parseParam(const std::string& name, const std::string& value, Params& params) {
+  if (name == "width")     { params.size.x    = NumberFormat::parseValue<int>(name, value); return true; }
+  if (name == "length")    { params.size.y    = NumberFormat::parseValue<int>(name, value); return true; }
+  if (name == "height")    { params.height    = NumberFormat::parseValue<int>(name, value); return true; }
+  if (name == "hole")      { params.hole      = NumberFormat::parseValue<float>(name, value); return true; }
+  if (name == "tolerance") { params.tolerance = NumberFormat::parseValue<float>(name, value); return true; }
+
+  const auto& infos = getCubeTypeInfo();
+  for (size_t i = 0; i < infos.size(); ++i) {
+    if (name != infos[i].name) continue;
+
+    parseColor(name, value, params.keys[i].rgb);
+    return true;
+  }
+
+  return false;
+}
+
+// ';'区切りの条件を読む(書かなかった項目は元の値のまま)
+Params parse(const std::string& text, Params params = Params()) {
+  NumberFormat::parseParams(text, [&params](const std::string& name, const std::string& value) {
+      return parseParam(name, value, params);
+    });
+
+  if ((params.size.x < 0) || (params.size.y < 0)) throw std::invalid_argument("size must not be negative");
+  if ((params.height < 0) || (params.height > 10)) throw std::invalid_argument("height must be 0 to 10");
+  if ((params.hole < 0.0f) || (params.hole >= 1.0f)) throw std::invalid_argument("hole must be 0 to 1");
+  if ((params.tolerance < 0.0f) || (params.tolerance > 1.0f)) throw std::invalid_argument("tolerance must be 0 to 1");
+
+  return params;
+}
+
+
+// バイナリのPNM(P5:グレー P6:RGB)を読む
+// TIPS:maxvalが255を超える時は2バイトのビッグエンディアンを8ビットに縮める
+Image readPnm(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) throw std::runtime_error("StageHeightmap: can't read " + path);
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  // 空白とコメントを飛ばして数を読む
+  size_t pos = 2;
+  auto readNumber = [&data, &pos, &path]() {
+    while (pos < data.size()) {
+      if (data[pos] == '#') {
+        while ((pos < data.size()) && (data[pos] != '\n')) ++pos;
+      }
+      else if (std::isspace(data[pos])) {
+        ++pos;
+      }
+      else {
+        break;
+      }
+    }
+
+    int value = 0;
+    size_t first = pos;
+    while ((pos < data.size()) && std::isdigit(data[pos])) {
+      value = value * 10 + (data[pos] - '0');
+      if (value > (1 << 24)) throw std::runtime_error("StageHeightmap: bad header " + path);
+      ++pos;
+    }
+    if (pos == first) throw std::runtime_error("StageHeightmap: bad header " + path);
+    return value;
+  };
+
+  if ((data.size() < 2) || (data[0] != 'P') || ((data[1] != '5') && (data[1] != '6'))) {
+    throw std::runtime_error("StageHeightmap: not a binary PGM/PPM " + path);
+  }
+  const int channels = (data[1] == '5') ? 1 : 3;
+  const int width  = readNumber();
+  const int height = readNumber();
+  const int maxval = readNumber();
+  if ((width <= 0) || (height <= 0) || (maxval <= 0) || (maxval > 65535)) {
+    throw std::runtime_error("StageHeightmap: bad header " + path);
+  }
+  // ヘッダの後の空白は1文字だけ
+  pos += 1;
+
+  const int bytes = (maxval > 255) ? 2 : 1;
+  if ((data.size() - std::min(pos, data.size())) < size_t(width) * height * channels * bytes) {
+    throw std::runtime_error("StageHeightmap: truncated " + path);
+  }
+
+  Image image(width, height);
+  const uint8_t* src = &data[pos];
+  for (size_t i = 0; i < size_t(width) * height; ++i) {
+    uint8_t rgb[3];
+    for (int c = 0; c < channels; ++c) {
+      int value = (bytes == 2) ? ((src[0] << 8) | src[1]) : src[0];
+      rgb[c] = uint8_t((value * 255 + maxval / 2) / maxval);
+      src += bytes;
+    }
+
+    auto* p = &image.pixels[i * 4];
+    p[0] = rgb[0];
+    p[1] = rgb[(channels == 3) ? 1 : 0];
+    p[2] = rgb[(channels == 3) ? 2 : 0];
+    p[3] = 255;
+  }
+  return image;
+}
+
+// 拡張子で形式を選ぶ
+// TIPS:PNGはthumbsが書き出す無圧縮の形式だけ読める(それ以外はエディタで読むかPNMにする)
+Image readImage(const std::string& path) {
+  auto ext = boost::algorithm::to_lower_copy(boost::filesystem::path(path).extension().string());
+  if ((ext == ".pgm") || (ext == ".ppm") || (ext == ".pnm")) return readPnm(path);
+
+  if (ext == ".png") {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("StageHeightmap: can't read " + path);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Image image(1, 1);
+    if (!StageRasterizer::decodePng(data, image)) {
+      throw std::runtime_error("StageHeightmap: compressed PNG is not supported (use PGM/PPM) " + path);
+    }
+    return image;
+  }
+
+  throw std::runtime_error("StageHeightmap: unknown image type " + path);
+}
+
+
+// 色キーの添字(どれにも近くなければ-1)
+int findKey(const uint8_t* p, const Params& params) {
+  const int limit = int(params.tolerance * 255.0f + 0.5f);
+  int best = -1;
+  int best_diff = limit + 1;
+  for (size_t i = 0; i < params.keys.size(); ++i) {
+    const auto& rgb = params.keys[i].rgb;
+    int diff = std::max(std::abs(p[0] - rgb[0]), std::max(std::abs(p[1] - rgb[1]), std::abs(p[2] - rgb[2])));
+    if (diff < best_diff) {
+      best = int(i);
+      best_diff = diff;
+    }
+  }
+  return best;
+}
+
+int toHeight(const float brightness, const Params& params) {
+  if (brightness < params.hole) return -1;
+
+  float rate = (brightness - params.hole) / (1.0f - params.hole);
+  return std::min(int(rate * params.height + 0.5f), params.height);
+}
+
+// z行目を作る
+void convertRow(const Image& image, const Params& params, const ci::Vec2i& size, const int z,
+                std::vector<Stage::Cube>& row) {
+  // 奥が上なので、z行目は画像の下から数える
+  const int py0 = (size.y - 1 - z) * image.height / size.y;
+  const int py1 = std::max((size.y - z) * image.height / size.y, py0 + 1);
+
+  int last_height = 0;
+  std::vector<int> counts(params.keys.size());
+  for (int x = 0; x < size.x; ++x) {
+    // xは右から左
+    const int px0 = (size.x - 1 - x) * image.width / size.x;
+    const int px1 = std::max((size.x - x) * image.width / size.x, px0 + 1);
+
+    std::fill(counts.begin(), counts.end(), 0);
+    int total = 0;
+    int holes = 0;
+    int grays = 0;
+    float brightness = 0.0f;
+    for (int py = py0; py < py1; ++py) {
+      const auto* p = &image.pixels[(py * image.width + px0) * 4];
+      for (int px = px0; px < px1; ++px, p += 4) {
+        total += 1;
+        if (p[3] < 128) {
+          holes += 1;
+          continue;
+        }
+
+        int key = findKey(p, params);
+        if (key >= 0) {
+          counts[key] += 1;
+          continue;
+        }
+
+        brightness += (0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]) / 255.0f;
+        grays += 1;
+      }
+    }
+
+    auto& cube = row[x];
+    cube.pos = ci::Vec3i(x, 0, z);
+    cube.type = Stage::Cube::NONE;
+
+    auto key = std::max_element(counts.begin(), counts.end());
+    if ((key != counts.end()) && ((*key * 2) >= total)) {
+      cube.pos.y = grays ? std::max(toHeight(brightness / grays, params), 0) : last_height;
+      cube.type  = params.keys[key - counts.begin()].type;
+    }
+    else if ((holes * 2) >= total) {
+      cube.pos.y = -1;
+    }
+    else {
+      cube.pos.y = grays ? toHeight(brightness / grays, params) : 0;
+    }
+
+    if (cube.pos.y >= 0) last_height = cube.pos.y;
+  }
+}
+
+// 画像からステージを作る。色や速度などはbaseのものを使う
+Stage convert(const Image& image, const Params& params, const Stage& base) {
+  Stage stage;
+  stage.copyParams(base);
+  stage.size.x = (params.size.x > 0) ? params.size.x : image.width;
+  stage.size.y = (params.size.y > 0) ? params.size.y : image.height;
+  if ((stage.size.x < 1) || (stage.size.y < 1)) throw std::invalid_argument("stage is too small");
+
+  stage.body.assign(stage.size.y, std::vector<Stage::Cube>(stage.size.x));
+
+  const int num_rows = stage.size.y;
+  std::atomic<int> next(0);
+  auto worker = [&]() {
+    for (int z = next++; z < num_rows; z = next++) {
+      convertRow(image, params, stage.size, z, stage.body[z]);
+    }
+  };
+
+  size_t num_threads = 1;
+  if ((size_t(image.width) * image.height) >= PARALLEL_PIXELS) {
+    num_threads = std::min(size_t(std::max(1u, std::thread::hardware_concurrency())), size_t(num_rows));
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  stage.updateSpecialCubes();
+  return stage;
+}
+
+}
+}
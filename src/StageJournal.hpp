@@ -0,0 +1,368 @@
+﻿#pragma once
+
+//
+// 編集ジャーナル
+// 編集のたびに変わったセルだけを追記し、保存しないまま落ちても復元できるようにする
+//
+// journal/<stage>.journal
+//   1行目   : ngsj <version> <元ファイルのcrc32> <checkpoint番号(0:無し)>
+//   2行目以降: 1行1レコード(タブ区切り)
+//     c x z y type interval delay power direction pattern target;target...
+//     p r g b bg_r bg_g bg_b x_offset pickable build_speed collapse_speed auto_collapse camera light_tween
+//     s width length
+//     r+ z / r- z / c+ x / c- x                (行や列の挿入・削除)
+//     k                                       (clear)
+//
+// journal/<stage>.checkpoint.<番号>
+//   一定数のレコードごとに書き出すステージ全体(ジャーナルはそこから取り直す)
+//
+// TIPS:行の挿入などは二重に適用できないので、チェックポイントは毎回別名で書き、
+//      新しいジャーナルに置き換えてから古いものを消す。
+//      途中で落ちても、ジャーナルと対になるチェックポイントが必ず残る
+//      書き出しに失敗した時は例外を投げ、今までのジャーナルに追記を続ける
+//
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "Stage.hpp"
+#include "StageSerializer.hpp"
+#include "StagePack.hpp"
+#include "NumberFormat.hpp"
+#include "FileUtil.hpp"
+
+
+namespace ngs {
+
+class StageJournal : private boost::noncopyable {
+public:
+  enum {
+    VERSION = 1,
+  };
+
+
+  // directoryは末尾に区切り文字を含むこと
+  StageJournal(const std::string& directory, const std::string& stage_file, const int checkpoint_interval) :
+    journal_path_(directory + stage_file + ".journal"),
+    checkpoint_path_(directory + stage_file + ".checkpoint"),
+    checkpoint_interval_(checkpoint_interval),
+    base_crc_(0),
+    checkpoint_serial_(0),
+    num_records_(0)
+  {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(directory, ec);
+  }
+
+
+  // 読み込んだステージに残っていたジャーナルを適用する
+  // base_textは読み込んだステージファイルの内容
+  // 復元したらtrueを返す(元ファイルと合わないジャーナルは使わない)
+  bool recover(const std::string& base_text, Stage& stage) {
+    base_crc_ = crc32(base_text);
+
+    std::ifstream file(journal_path_, std::ios::binary);
+    if (!file) return false;
+
+    std::string line;
+    std::getline(file, line);
+
+    std::istringstream header(line);
+    std::string magic;
+    int version = 0;
+    std::string crc_text;
+    int serial = 0;
+    header >> magic >> version >> crc_text >> serial;
+    if ((magic != "ngsj") || (version != VERSION) || (crc_text != std::to_string(base_crc_))) {
+      return false;
+    }
+
+    Stage recovered = stage;
+    if (serial > 0) {
+      recovered = StageSerializer::makeStage(Json::readFromPath(makeCheckpointPath(serial)));
+      checkpoint_serial_ = serial;
+    }
+
+    size_t num = 0;
+    while (std::getline(file, line)) {
+      // TIPS:書き込み途中で落ちた最後の行は改行が無いので捨てる
+      if (file.eof()) break;
+
+      if (apply(line, recovered)) num += 1;
+    }
+    file.close();
+    if ((serial == 0) && (num == 0)) return false;
+
+    stage = recovered;
+
+    // 復元した状態を起点に取り直す
+    checkpoint(stage);
+    return true;
+  }
+
+  // 保存したので元ファイルを起点にやり直す
+  void reset(const std::string& base_text) {
+    base_crc_ = crc32(base_text);
+
+    stream_.close();
+    boost::system::error_code ec;
+    boost::filesystem::remove(journal_path_, ec);
+    if (checkpoint_serial_ > 0) {
+      boost::filesystem::remove(makeCheckpointPath(checkpoint_serial_), ec);
+    }
+    checkpoint_serial_ = 0;
+    num_records_ = 0;
+  }
+
+  // 今の状態を丸ごと書き出し、ジャーナルを空にする
+  void checkpoint(const Stage& stage) {
+    stream_.close();
+
+    int serial = checkpoint_serial_ + 1;
+    auto path = makeCheckpointPath(serial);
+    boost::system::error_code ec;
+    try {
+      // TIPS:エディタだけが読むので小さく速いランレングスで書く
+      StageSerializer::serialize(stage, path, StageSerializer::BODY_RLE);
+      openJournal(serial);
+    }
+    catch (...) {
+      // TIPS:ジャーナルを作り直すと今までの記録が消えるので、そのまま追記で開き直す
+      boost::filesystem::remove(path, ec);
+      if (boost::filesystem::exists(journal_path_, ec)) {
+        stream_.open(journal_path_, std::ios::binary | std::ios::app);
+      }
+      throw;
+    }
+
+    if (checkpoint_serial_ > 0) {
+      boost::filesystem::remove(makeCheckpointPath(checkpoint_serial_), ec);
+    }
+    checkpoint_serial_ = serial;
+    num_records_ = 0;
+  }
+
+
+  void writeCube(const Stage::Cube& cube) {
+    std::string target;
+    for (size_t i = 0; i < cube.target.size(); ++i) {
+      if (i > 0) target += ';';
+      target += cube.target[i];
+    }
+
+    std::vector<std::string> fields = {
+      "c",
+      NumberFormat::toString(cube.pos.x),
+      NumberFormat::toString(cube.pos.z),
+      NumberFormat::toString(cube.pos.y),
+      NumberFormat::toString(cube.type),
+      NumberFormat::toString(cube.interval),
+      NumberFormat::toString(cube.delay),
+      NumberFormat::toString(cube.power),
+      cube.direction,
+      cube.pattern,
+      target,
+    };
+    append(fields);
+  }
+
+  void writeParams(const Stage& stage) {
+    std::vector<std::string> fields = {
+      "p",
+      NumberFormat::toString(stage.color.r),
+      NumberFormat::toString(stage.color.g),
+      NumberFormat::toString(stage.color.b),
+      NumberFormat::toString(stage.bg_color.r),
+      NumberFormat::toString(stage.bg_color.g),
+      NumberFormat::toString(stage.bg_color.b),
+      NumberFormat::toString(stage.x_offset),
+      NumberFormat::toString(stage.pickable),
+      NumberFormat::toString(stage.build_speed),
+      NumberFormat::toString(stage.collapse_speed),
+      NumberFormat::toString(stage.auto_collapse),
+      stage.camera,
+      stage.light_tween,
+    };
+    append(fields);
+  }
+
+  void writeSize(const ci::Vec2i& size) {
+    std::vector<std::string> fields = {
+      "s",
+      NumberFormat::toString(size.x),
+      NumberFormat::toString(size.y),
+    };
+    append(fields);
+  }
+
+  void writeClear() {
+    append(std::vector<std::string>(1, "k"));
+  }
+
+  // opは r+ r- c+ c- のどれか
+  void writeStructure(const std::string& op, const int index) {
+    std::vector<std::string> fields = {
+      op,
+      NumberFormat::toString(index),
+    };
+    append(fields);
+  }
+
+
+  bool needsCheckpoint() const {
+    return num_records_ >= checkpoint_interval_;
+  }
+
+  size_t getNumRecords() const {
+    return num_records_;
+  }
+
+
+  static std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+
+private:
+  std::string journal_path_;
+  std::string checkpoint_path_;
+  size_t checkpoint_interval_;
+
+  uint32_t base_crc_;
+  int checkpoint_serial_;
+  std::ofstream stream_;
+  size_t num_records_;
+
+
+  static uint32_t crc32(const std::string& text) {
+    return StagePack::crc32(std::vector<uint8_t>(text.begin(), text.end()));
+  }
+
+  std::string makeCheckpointPath(const int serial) const {
+    return checkpoint_path_ + "." + NumberFormat::toString(serial);
+  }
+
+  void openJournal(const int serial) {
+    // 新しく作り直す時は置き換えで書く(書けなければ元のジャーナルのまま例外)
+    FileUtil::writeAtomic(journal_path_, [this, serial](std::ostream& file) {
+        file << "ngsj " << int(VERSION) << " " << std::to_string(base_crc_)
+             << " " << serial << "\n";
+      });
+
+    stream_.open(journal_path_, std::ios::binary | std::ios::app);
+  }
+
+  void append(const std::vector<std::string>& fields) {
+    if (!stream_.is_open()) openJournal(checkpoint_serial_);
+
+    std::string line;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (i > 0) line += '\t';
+      for (char c : fields[i]) {
+        // 区切りと衝突する文字は空白にする
+        line += ((c == '\t') || (c == '\n') || (c == '\r')) ? ' ' : c;
+      }
+    }
+    line += '\n';
+
+    // TIPS:OSへ渡すところまでで十分(アプリが落ちても残る)
+    stream_.write(line.data(), line.size());
+    stream_.flush();
+    num_records_ += 1;
+  }
+
+
+  static std::vector<std::string> split(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t first = 0;
+    while (true) {
+      auto last = line.find('\t', first);
+      fields.push_back(line.substr(first, last - first));
+      if (last == std::string::npos) break;
+      first = last + 1;
+    }
+    return fields;
+  }
+
+  template <typename T>
+  static T toNumber(const std::string& text) {
+    T value = T();
+    NumberFormat::fromString(text, value);
+    return value;
+  }
+
+  static bool apply(const std::string& line, Stage& stage) {
+    auto fields = split(line);
+
+    if ((fields[0] == "c") && (fields.size() == 11)) {
+      auto* cube = stage.getCube(ci::Vec3i(toNumber<int>(fields[1]), 0, toNumber<int>(fields[2])));
+      if (!cube) return false;
+
+      cube->pos.y     = toNumber<int>(fields[3]);
+      stage.setType(ci::Vec2i(cube->pos.x, cube->pos.z), toNumber<int>(fields[4]));
+      cube->interval  = toNumber<float>(fields[5]);
+      cube->delay     = toNumber<float>(fields[6]);
+      cube->power     = toNumber<int>(fields[7]);
+      cube->direction = fields[8];
+      cube->pattern   = fields[9];
+
+      cube->target.clear();
+      if (!fields[10].empty()) {
+        size_t first = 0;
+        while (true) {
+          auto last = fields[10].find(';', first);
+          cube->target.push_back(fields[10].substr(first, last - first));
+          if (last == std::string::npos) break;
+          first = last + 1;
+        }
+      }
+      return true;
+    }
+
+    if ((fields[0] == "p") && (fields.size() == 14)) {
+      stage.color    = ci::Color(toNumber<float>(fields[1]), toNumber<float>(fields[2]), toNumber<float>(fields[3]));
+      stage.bg_color = ci::Color(toNumber<float>(fields[4]), toNumber<float>(fields[5]), toNumber<float>(fields[6]));
+
+      stage.x_offset = toNumber<int>(fields[7]);
+      stage.pickable = toNumber<int>(fields[8]);
+
+      stage.build_speed    = toNumber<float>(fields[9]);
+      stage.collapse_speed = toNumber<float>(fields[10]);
+      stage.auto_collapse  = toNumber<float>(fields[11]);
+
+      stage.camera      = fields[12];
+      stage.light_tween = fields[13];
+      return true;
+    }
+
+    if ((fields[0] == "s") && (fields.size() == 3)) {
+      stage.size.x = toNumber<int>(fields[1]);
+      stage.size.y = toNumber<int>(fields[2]);
+      stage.resize();
+      return true;
+    }
+
+    if (fields[0] == "k") {
+      stage.clear();
+      return true;
+    }
+
+    if (fields.size() == 2) {
+      int index = toNumber<int>(fields[1]);
+      if (fields[0] == "r+") { stage.insertRow(index);    return true; }
+      if (fields[0] == "r-") { stage.deleteRow(index);    return true; }
+      if (fields[0] == "c+") { stage.insertColumn(index); return true; }
+      if (fields[0] == "c-") { stage.deleteColumn(index); return true; }
+    }
+
+    return false;
+  }
+
+};
+
+}
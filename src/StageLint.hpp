@@ -0,0 +1,393 @@
+﻿#pragma once
+
+//
+// ステージの検査
+// 規則ごとにセルやステージ全体を調べて問題を集める
+// 編集したセルだけを、そのセルの種類に関係する規則で調べ直す
+//
+//   StageLint lint(names);
+//   lint.markCell(pos);
+//   if (lint.update(stage)) {
+//     for (const auto& issue : lint.getIssues()) ...
+//   }
+//
+// TIPS:大きさが変わった時は全セルを調べ直す(スイッチの対象の範囲が変わるため)
+//
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <sstream>
+#include <boost/noncopyable.hpp>
+#include "Stage.hpp"
+#include "CubeTraits.hpp"
+#include "NumberFormat.hpp"
+
+
+namespace ngs {
+
+class StageLint : private boost::noncopyable {
+public:
+  enum Severity {
+    WARNING,
+    ERROR,
+  };
+
+  struct Issue {
+    Severity severity;
+    std::string rule;
+    // セルの位置(x, z)。ステージ全体の問題は(-1, -1)
+    ci::Vec2i pos;
+    std::string message;
+
+    bool isSame(const Issue& rhs) const {
+      return (severity == rhs.severity)
+        && (rule == rhs.rule)
+        && (pos == rhs.pos)
+        && (message == rhs.message);
+    }
+  };
+
+  // ゲームが知っている名前
+  struct Names {
+    std::vector<std::string> camera;
+    std::vector<std::string> light_tween;
+    std::vector<std::string> direction;
+
+    Names() :
+      camera({ "normal", "reverse" }),
+      light_tween({ "default", "start", "finish" }),
+      direction({ "up", "down", "left", "right" })
+    {}
+
+    // 空の一覧は組み込みの名前のまま
+    Names(const std::vector<std::string>& camera_names,
+          const std::vector<std::string>& light_tween_names,
+          const std::vector<std::string>& direction_names) :
+      Names()
+    {
+      if (!camera_names.empty())      camera      = camera_names;
+      if (!light_tween_names.empty()) light_tween = light_tween_names;
+      if (!direction_names.empty())   direction   = direction_names;
+    }
+  };
+
+  // セルの規則はtypesのどれかのキューブだけを調べる
+  // TIPS:問題はseverityとmessageだけを入れて返す(ruleとposはupdateで埋める)
+  struct CellRule {
+    std::string name;
+    int types;
+    std::function<void (const Stage&, const Stage::Cube&, std::vector<Issue>&)> check;
+  };
+
+  struct StageRule {
+    std::string name;
+    std::function<void (const Stage&, std::vector<Issue>&)> check;
+  };
+
+
+  explicit StageLint(const Names& names) :
+    cell_rules_(makeCellRules(names)),
+    stage_rules_(makeStageRules(names)),
+    size_(ci::Vec2i::zero()),
+    full_(true),
+    params_dirty_(true),
+    num_checked_(0),
+    num_errors_(0),
+    num_warnings_(0)
+  {}
+
+
+  // 全て調べ直す(読み込み・全消去・外部の変更の反映など)
+  void invalidate() {
+    full_ = true;
+  }
+
+  void markCell(const ci::Vec2i& pos) {
+    dirty_cells_.push_back(pos);
+  }
+
+  // 色や速度、cameraなどのステージ全体の値
+  void markParams() {
+    params_dirty_ = true;
+  }
+
+  // 印を付けた所を調べ直す
+  // 問題の一覧が変わったらtrueを返す
+  bool update(const Stage& stage) {
+    num_checked_ = 0;
+    if (stage.size != size_) full_ = true;
+
+    bool changed = false;
+    if (full_) {
+      size_ = stage.size;
+      cell_issues_.assign(size_.x * size_.y, std::vector<Issue>());
+      for (int z = 0; z < size_.y; ++z) {
+        for (int x = 0; x < size_.x; ++x) {
+          checkCell(stage, ci::Vec2i(x, z));
+        }
+      }
+
+      full_ = false;
+      params_dirty_ = true;
+      dirty_cells_.clear();
+      changed = true;
+    }
+    else if (!dirty_cells_.empty()) {
+      // 同じセルを何度も編集していても1回だけ調べる
+      std::sort(dirty_cells_.begin(), dirty_cells_.end(), Stage::lessPosition);
+      dirty_cells_.erase(std::unique(dirty_cells_.begin(), dirty_cells_.end()), dirty_cells_.end());
+
+      for (const auto& pos : dirty_cells_) {
+        if (checkCell(stage, pos)) changed = true;
+      }
+      dirty_cells_.clear();
+    }
+
+    if (params_dirty_) {
+      std::vector<Issue> issues;
+      for (const auto& rule : stage_rules_) {
+        size_t first = issues.size();
+        rule.check(stage, issues);
+        fillIssues(issues, first, rule.name, ci::Vec2i(-1, -1));
+      }
+      if (!isSame(issues, stage_issues_)) {
+        stage_issues_ = std::move(issues);
+        changed = true;
+      }
+      params_dirty_ = false;
+    }
+
+    if (changed) collectIssues();
+    return changed;
+  }
+
+  // ステージ全体の問題、セルの問題(行優先)の順
+  const std::vector<Issue>& getIssues() const {
+    return issues_;
+  }
+
+  size_t getNumErrors() const {
+    return num_errors_;
+  }
+
+  size_t getNumWarnings() const {
+    return num_warnings_;
+  }
+
+  // 直前のupdateで調べたセルの数
+  size_t getNumChecked() const {
+    return num_checked_;
+  }
+
+
+  static const char* getSeverityName(const Severity severity) {
+    return (severity == ERROR) ? "error" : "warning";
+  }
+
+  // "3,5 error pattern: ..." の形の1行
+  static std::string format(const Issue& issue) {
+    std::ostringstream text;
+    if (issue.pos.x >= 0) {
+      text << issue.pos.x << "," << issue.pos.y << " ";
+    }
+    text << getSeverityName(issue.severity) << " " << issue.rule << ": " << issue.message;
+    return text.str();
+  }
+
+
+  static Issue makeIssue(const Severity severity, const std::string& message) {
+    Issue issue = { severity, std::string(), ci::Vec2i(-1, -1), message };
+    return issue;
+  }
+
+  // カンマや空白で区切った要素(parseIntListと同じ区切り)
+  static std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> values;
+
+    const char* p   = text.data();
+    const char* end = p + text.size();
+    while (p < end) {
+      while ((p < end) && ((*p == ' ') || (*p == ',') || (*p == '\t'))) ++p;
+
+      const char* first = p;
+      while ((p < end) && (*p != ' ') && (*p != ',') && (*p != '\t')) ++p;
+
+      if (first < p) values.push_back(std::string(first, p));
+    }
+
+    return values;
+  }
+
+  static bool contains(const std::vector<std::string>& names, const std::string& name) {
+    return std::find(names.begin(), names.end(), name) != names.end();
+  }
+
+
+  static std::vector<CellRule> makeCellRules(const Names& names) {
+    const int all_types = (1 << Stage::NUM_CUBE_TYPES) - 1;
+
+    std::vector<CellRule> rules = {
+      // 穴(高さ-1)に置いた特殊なキューブは保存時に消える
+      { "hole", all_types,
+        [](const Stage&, const Stage::Cube& cube, std::vector<Issue>& issues) {
+          if (cube.pos.y >= 0) return;
+
+          const auto* info = findCubeTypeInfo(cube.type);
+          issues.push_back(makeIssue(WARNING, std::string(info ? info->name : "cube") + " on a hole (dropped on save)"));
+        } },
+
+      { "pattern", Stage::Cube::MOVING,
+        [](const Stage&, const Stage::Cube& cube, std::vector<Issue>& issues) {
+          auto values = splitList(cube.pattern);
+          if (values.empty()) {
+            issues.push_back(makeIssue(ERROR, "empty pattern"));
+            return;
+          }
+          for (const auto& value : values) {
+            int number;
+            if (!NumberFormat::fromString(value, number)) {
+              issues.push_back(makeIssue(ERROR, "bad value '" + value + "' in pattern"));
+            }
+          }
+        } },
+
+      { "switch_target", Stage::Cube::SWITCH,
+        [](const Stage& stage, const Stage::Cube& cube, std::vector<Issue>& issues) {
+          if (cube.target.empty()) {
+            issues.push_back(makeIssue(WARNING, "no target"));
+            return;
+          }
+          for (size_t i = 0; i < cube.target.size(); ++i) {
+            const auto prefix = "target:" + NumberFormat::toString(int(i + 1)) + " ";
+
+            auto values = splitList(cube.target[i]);
+            std::vector<int> pos;
+            for (const auto& value : values) {
+              int number;
+              if (NumberFormat::fromString(value, number)) pos.push_back(number);
+            }
+            if ((values.size() != 3) || (pos.size() != 3)) {
+              issues.push_back(makeIssue(ERROR, prefix + "'" + cube.target[i] + "' is not x, y, z"));
+              continue;
+            }
+            if ((pos[0] < 0) || (pos[0] >= stage.size.x) || (pos[2] < 0) || (pos[2] >= stage.size.y)) {
+              issues.push_back(makeIssue(ERROR, prefix + "(" + cube.target[i] + ") is out of the stage"));
+            }
+          }
+        } },
+
+      { "direction", Stage::Cube::ONEWAY,
+        [names](const Stage&, const Stage::Cube& cube, std::vector<Issue>& issues) {
+          if (!contains(names.direction, cube.direction)) {
+            issues.push_back(makeIssue(ERROR, "unknown direction '" + cube.direction + "'"));
+          }
+        } },
+
+      { "falling", Stage::Cube::FALLING,
+        [](const Stage&, const Stage::Cube& cube, std::vector<Issue>& issues) {
+          if ((cube.interval < 0.0f) || (cube.delay < 0.0f)) {
+            issues.push_back(makeIssue(ERROR, "negative interval or delay"));
+          }
+        } },
+    };
+
+    return rules;
+  }
+
+  static std::vector<StageRule> makeStageRules(const Names& names) {
+    std::vector<StageRule> rules = {
+      { "camera",
+        [names](const Stage& stage, std::vector<Issue>& issues) {
+          if (!contains(names.camera, stage.camera)) {
+            issues.push_back(makeIssue(ERROR, "unknown camera '" + stage.camera + "'"));
+          }
+        } },
+
+      { "light_tween",
+        [names](const Stage& stage, std::vector<Issue>& issues) {
+          if (!contains(names.light_tween, stage.light_tween)) {
+            issues.push_back(makeIssue(ERROR, "unknown light_tween '" + stage.light_tween + "'"));
+          }
+        } },
+    };
+
+    return rules;
+  }
+
+
+private:
+  std::vector<CellRule> cell_rules_;
+  std::vector<StageRule> stage_rules_;
+
+  // 前回調べた時の大きさ。セルの問題は z * size_.x + x に置く
+  ci::Vec2i size_;
+  std::vector<std::vector<Issue> > cell_issues_;
+  std::vector<Issue> stage_issues_;
+
+  bool full_;
+  bool params_dirty_;
+  std::vector<ci::Vec2i> dirty_cells_;
+
+  std::vector<Issue> issues_;
+  size_t num_checked_;
+  size_t num_errors_;
+  size_t num_warnings_;
+
+
+  // 1セル分を調べ直す。問題が変わったらtrue
+  bool checkCell(const Stage& stage, const ci::Vec2i& pos) {
+    if ((pos.x < 0) || (pos.x >= size_.x) || (pos.y < 0) || (pos.y >= size_.y)) return false;
+
+    std::vector<Issue> issues;
+    const auto* cube = stage.getCube(ci::Vec3i(pos.x, 0, pos.y));
+    if (cube && (cube->type != Stage::Cube::NONE)) {
+      for (const auto& rule : cell_rules_) {
+        if (!(cube->type & rule.types)) continue;
+
+        size_t first = issues.size();
+        rule.check(stage, *cube, issues);
+        fillIssues(issues, first, rule.name, pos);
+      }
+    }
+    num_checked_ += 1;
+
+    auto& cell = cell_issues_[pos.y * size_.x + pos.x];
+    if (isSame(issues, cell)) return false;
+
+    cell = std::move(issues);
+    return true;
+  }
+
+  static void fillIssues(std::vector<Issue>& issues, const size_t first,
+                         const std::string& rule, const ci::Vec2i& pos) {
+    for (size_t i = first; i < issues.size(); ++i) {
+      issues[i].rule = rule;
+      issues[i].pos  = pos;
+    }
+  }
+
+  static bool isSame(const std::vector<Issue>& a, const std::vector<Issue>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+      if (!a[i].isSame(b[i])) return false;
+    }
+    return true;
+  }
+
+  void collectIssues() {
+    issues_ = stage_issues_;
+    for (const auto& cell : cell_issues_) {
+      issues_.insert(issues_.end(), cell.begin(), cell.end());
+    }
+
+    num_errors_ = std::count_if(issues_.begin(), issues_.end(), [](const Issue& issue) {
+        return issue.severity == ERROR;
+      });
+    num_warnings_ = issues_.size() - num_errors_;
+  }
+
+};
+
+}
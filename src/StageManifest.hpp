@@ -0,0 +1,447 @@
+﻿#pragma once
+
+//
+// ステージの目録
+// 大きさ・種類ごとの数・色・速度などをファイルにまとめておき、
+// ステージを全部読まなくても一覧や検索ができるようにする
+//
+//   ngsm <version>
+//   path mtime file_size crc32 width length item moving switch falling oneway
+//   height oneway_power x_offset pickable build_speed collapse_speed auto_collapse
+//   r g b bg_r bg_g bg_b camera light_tween           (1行1ステージ、タブ区切り)
+//
+// 更新日時かサイズが変わったファイルだけを読み直す
+// 中身が同じ(crc32が同じ)なら更新日時だけを書き換える
+//
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <boost/filesystem.hpp>
+#include "Stage.hpp"
+#include "StageSerializer.hpp"
+#include "StagePack.hpp"
+#include "CubeTraits.hpp"
+#include "NumberFormat.hpp"
+#include "FileUtil.hpp"
+
+
+namespace ngs {
+
+class StageManifest {
+public:
+  enum {
+    VERSION = 1,
+  };
+
+  struct Entry {
+    std::string path;
+
+    std::time_t mtime;
+    uintmax_t file_size;
+    uint32_t crc;
+
+    ci::Vec2i size;
+    int count[Stage::NUM_CUBE_TYPES];
+    // 一番高いキューブ、一番強いoneway
+    int max_height;
+    int max_oneway_power;
+
+    int x_offset;
+    int pickable;
+    float build_speed;
+    float collapse_speed;
+    float auto_collapse;
+
+    ci::Color color;
+    ci::Color bg_color;
+    std::string camera;
+    std::string light_tween;
+  };
+
+
+  // 目録を読む(無ければ空から始める)
+  explicit StageManifest(const std::string& path) :
+    path_(path)
+  {
+    std::ifstream file(path_, std::ios::binary);
+    if (!file) return;
+
+    std::string line;
+    std::getline(file, line);
+    std::istringstream header(line);
+    std::string magic;
+    int version = 0;
+    header >> magic >> version;
+    if ((magic != "ngsm") || (version != VERSION)) return;
+
+    while (std::getline(file, line)) {
+      Entry entry;
+      if (parseLine(line, entry)) entries_[entry.path] = entry;
+    }
+  }
+
+
+  // ファイルの一覧に合わせて更新する
+  // directoryは末尾に区切り文字を含むこと。読み直したファイルの数を返す
+  // TIPS:読み直しはスレッドに振り分ける(数千ファイルでも起動を待たせない)
+  size_t update(const std::string& directory, const std::vector<std::string>& files) {
+    std::map<std::string, Entry> entries;
+    std::vector<Entry> stale;
+
+    for (const auto& file : files) {
+      boost::system::error_code ec;
+      auto full_path = directory + file;
+      auto mtime = boost::filesystem::last_write_time(full_path, ec);
+      if (ec) continue;
+      auto file_size = boost::filesystem::file_size(full_path, ec);
+      if (ec) continue;
+
+      auto it = entries_.find(file);
+      if ((it != entries_.end()) && (it->second.mtime == mtime) && (it->second.file_size == file_size)) {
+        entries[file] = it->second;
+        continue;
+      }
+
+      Entry entry;
+      entry.path      = file;
+      entry.mtime     = mtime;
+      entry.file_size = file_size;
+      entry.crc       = 0;
+      stale.push_back(entry);
+    }
+
+    // TIPS:vector<bool>は要素ごとに別スレッドから書けないのでcharで持つ
+    std::vector<char> valid(stale.size(), 0);
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+      for (size_t i = next++; i < stale.size(); i = next++) {
+        try {
+          valid[i] = makeEntry(directory, stale[i], entries_);
+        }
+        catch (const std::exception&) {
+          // 読めないファイルは目録に載せない
+        }
+      }
+    };
+
+    size_t num_threads = std::min(size_t(std::max(1u, std::thread::hardware_concurrency())), stale.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+      threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    size_t num_read = 0;
+    for (size_t i = 0; i < stale.size(); ++i) {
+      if (!valid[i]) continue;
+
+      entries[stale[i].path] = stale[i];
+      num_read += 1;
+    }
+    entries_.swap(entries);
+
+    return num_read;
+  }
+
+  // 一時ファイルに書いてから置き換える(失敗したら例外で、元のファイルはそのまま)
+  void write() const {
+    FileUtil::writeAtomic(path_, [this](std::ostream& file) {
+        file << "ngsm " << int(VERSION) << "\n";
+        for (const auto& it : entries_) {
+          file << makeLine(it.second) << "\n";
+        }
+      });
+  }
+
+
+  const Entry* find(const std::string& path) const {
+    auto it = entries_.find(path);
+    return (it != entries_.end()) ? &it->second : nullptr;
+  }
+
+  const std::map<std::string, Entry>& getEntries() const {
+    return entries_;
+  }
+
+
+  // 検索条件
+  // "oneway_power>2;width>=10;camera==far" のように ; 区切りで全てを満たすものを探す
+  //   数値: width length item moving switch falling oneway height oneway_power
+  //         x_offset pickable build_speed collapse_speed auto_collapse
+  //   文字列(== と != のみ): camera light_tween
+  using Query = std::vector<std::function<bool (const Entry&)> >;
+
+  static Query parseQuery(const std::string& text) {
+    Query query;
+
+    size_t first = 0;
+    while (first <= text.size()) {
+      auto last = text.find(';', first);
+      auto condition = text.substr(first, last - first);
+      if (!condition.empty()) query.push_back(parseCondition(condition));
+
+      if (last == std::string::npos) break;
+      first = last + 1;
+    }
+
+    return query;
+  }
+
+  static bool match(const Query& query, const Entry& entry) {
+    for (const auto& condition : query) {
+      if (!condition(entry)) return false;
+    }
+    return true;
+  }
+
+  // 条件を満たすステージのパス(パス順)
+  std::vector<std::string> search(const Query& query) const {
+    std::vector<std::string> paths;
+    for (const auto& it : entries_) {
+      if (match(query, it.second)) paths.push_back(it.first);
+    }
+    return paths;
+  }
+
+
+private:
+  std::string path_;
+  std::map<std::string, Entry> entries_;
+
+
+  // 中身を読んで目録の値を埋める
+  // TIPS:ワーカースレッドから呼ぶので、entriesは読むだけ
+  static bool makeEntry(const std::string& directory, Entry& entry,
+                        const std::map<std::string, Entry>& entries) {
+    std::string text;
+    {
+      std::ifstream file(directory + entry.path, std::ios::binary);
+      if (!file) return false;
+      text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // 触っただけで中身が同じなら読み直さない
+    auto crc = StagePack::crc32(std::vector<uint8_t>(text.begin(), text.end()));
+    auto it = entries.find(entry.path);
+    if ((it != entries.end()) && (it->second.crc == crc)) {
+      auto mtime     = entry.mtime;
+      auto file_size = entry.file_size;
+      entry = it->second;
+      entry.mtime     = mtime;
+      entry.file_size = file_size;
+      return true;
+    }
+
+    auto stage = StageSerializer::makeStage(ci::JsonTree(text));
+    entry.crc = crc;
+    setStage(entry, stage);
+    return true;
+  }
+
+  static void setStage(Entry& entry, const Stage& stage) {
+    entry.size = stage.size;
+    for (int i = 0; i < Stage::NUM_CUBE_TYPES; ++i) {
+      entry.count[i] = int(stage.special_cubes[i].size());
+    }
+
+    entry.max_height = 0;
+    for (const auto& row : stage.body) {
+      for (const auto& cube : row) {
+        entry.max_height = std::max(entry.max_height, cube.pos.y);
+      }
+    }
+
+    entry.max_oneway_power = 0;
+    for (const auto& pos : stage.getSpecialCubes(Stage::Cube::ONEWAY)) {
+      entry.max_oneway_power = std::max(entry.max_oneway_power, stage.body[pos.y][pos.x].power);
+    }
+
+    entry.x_offset       = stage.x_offset;
+    entry.pickable       = stage.pickable;
+    entry.build_speed    = stage.build_speed;
+    entry.collapse_speed = stage.collapse_speed;
+    entry.auto_collapse  = stage.auto_collapse;
+
+    entry.color       = stage.color;
+    entry.bg_color    = stage.bg_color;
+    entry.camera      = stage.camera;
+    entry.light_tween = stage.light_tween;
+  }
+
+
+  static std::string makeLine(const Entry& entry) {
+    std::vector<std::string> fields = {
+      entry.path,
+      std::to_string(static_cast<long long>(entry.mtime)),
+      std::to_string(static_cast<unsigned long long>(entry.file_size)),
+      std::to_string(entry.crc),
+      NumberFormat::toString(entry.size.x),
+      NumberFormat::toString(entry.size.y),
+    };
+    for (int count : entry.count) {
+      fields.push_back(NumberFormat::toString(count));
+    }
+
+    const std::vector<std::string> params = {
+      NumberFormat::toString(entry.max_height),
+      NumberFormat::toString(entry.max_oneway_power),
+      NumberFormat::toString(entry.x_offset),
+      NumberFormat::toString(entry.pickable),
+      NumberFormat::toString(entry.build_speed),
+      NumberFormat::toString(entry.collapse_speed),
+      NumberFormat::toString(entry.auto_collapse),
+      NumberFormat::toString(entry.color.r),
+      NumberFormat::toString(entry.color.g),
+      NumberFormat::toString(entry.color.b),
+      NumberFormat::toString(entry.bg_color.r),
+      NumberFormat::toString(entry.bg_color.g),
+      NumberFormat::toString(entry.bg_color.b),
+      entry.camera,
+      entry.light_tween,
+    };
+    fields.insert(fields.end(), params.begin(), params.end());
+
+    std::string line;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (i > 0) line += '\t';
+      line += fields[i];
+    }
+    return line;
+  }
+
+  static bool parseLine(const std::string& line, Entry& entry) {
+    std::vector<std::string> fields;
+    size_t first = 0;
+    while (true) {
+      auto last = line.find('\t', first);
+      fields.push_back(line.substr(first, last - first));
+      if (last == std::string::npos) break;
+      first = last + 1;
+    }
+    if (fields.size() != (6 + Stage::NUM_CUBE_TYPES + 15)) return false;
+
+    size_t i = 0;
+    entry.path = fields[i++];
+
+    // 64bitの整数はストリームで読む
+    std::istringstream header(fields[i] + " " + fields[i + 1] + " " + fields[i + 2]);
+    long long mtime;
+    unsigned long long file_size;
+    unsigned long crc;
+    if (!(header >> mtime >> file_size >> crc)) return false;
+    entry.mtime     = std::time_t(mtime);
+    entry.file_size = file_size;
+    entry.crc       = uint32_t(crc);
+    i += 3;
+
+    bool ok = NumberFormat::fromString(fields[i++], entry.size.x)
+      && NumberFormat::fromString(fields[i++], entry.size.y);
+    for (int& count : entry.count) {
+      ok = ok && NumberFormat::fromString(fields[i++], count);
+    }
+    ok = ok
+      && NumberFormat::fromString(fields[i++], entry.max_height)
+      && NumberFormat::fromString(fields[i++], entry.max_oneway_power)
+      && NumberFormat::fromString(fields[i++], entry.x_offset)
+      && NumberFormat::fromString(fields[i++], entry.pickable)
+      && NumberFormat::fromString(fields[i++], entry.build_speed)
+      && NumberFormat::fromString(fields[i++], entry.collapse_speed)
+      && NumberFormat::fromString(fields[i++], entry.auto_collapse)
+      && NumberFormat::fromString(fields[i++], entry.color.r)
+      && NumberFormat::fromString(fields[i++], entry.color.g)
+      && NumberFormat::fromString(fields[i++], entry.color.b)
+      && NumberFormat::fromString(fields[i++], entry.bg_color.r)
+      && NumberFormat::fromString(fields[i++], entry.bg_color.g)
+      && NumberFormat::fromString(fields[i++], entry.bg_color.b);
+    entry.camera      = fields[i++];
+    entry.light_tween = fields[i++];
+
+    return ok;
+  }
+
+
+  using NumberField = std::function<double (const Entry&)>;
+  using TextField   = std::function<const std::string& (const Entry&)>;
+
+  // 項目名から値の取り出し方を決める(無ければ空)
+  // TIPS:検索のたびに名前を比べないよう、条件を読む時に一度だけ引く
+  static NumberField findNumberField(const std::string& name) {
+    if (name == "width")          return [](const Entry& e) { return double(e.size.x); };
+    if (name == "length")         return [](const Entry& e) { return double(e.size.y); };
+    if (name == "height")         return [](const Entry& e) { return double(e.max_height); };
+    if (name == "oneway_power")   return [](const Entry& e) { return double(e.max_oneway_power); };
+    if (name == "x_offset")       return [](const Entry& e) { return double(e.x_offset); };
+    if (name == "pickable")       return [](const Entry& e) { return double(e.pickable); };
+    if (name == "build_speed")    return [](const Entry& e) { return double(e.build_speed); };
+    if (name == "collapse_speed") return [](const Entry& e) { return double(e.collapse_speed); };
+    if (name == "auto_collapse")  return [](const Entry& e) { return double(e.auto_collapse); };
+
+    // 種類ごとの数は種類の名前で引く
+    const auto& infos = getCubeTypeInfo();
+    for (size_t i = 0; i < infos.size(); ++i) {
+      if (name == infos[i].name) {
+        return [i](const Entry& e) { return double(e.count[i]); };
+      }
+    }
+    return NumberField();
+  }
+
+  static TextField findTextField(const std::string& name) {
+    if (name == "camera")      return [](const Entry& e) -> const std::string& { return e.camera; };
+    if (name == "light_tween") return [](const Entry& e) -> const std::string& { return e.light_tween; };
+    return TextField();
+  }
+
+  static std::function<bool (const Entry&)> parseCondition(const std::string& text) {
+    static const char* const operators[] = { ">=", "<=", "==", "!=", ">", "<" };
+
+    for (const auto* op : operators) {
+      auto pos = text.find(op);
+      if (pos == std::string::npos) continue;
+
+      const std::string name  = text.substr(0, pos);
+      const std::string value = text.substr(pos + std::strlen(op));
+      const std::string kind(op);
+
+      auto text_field = findTextField(name);
+      if (text_field) {
+        if ((kind != "==") && (kind != "!=")) throw std::invalid_argument("string field needs == or !=: " + text);
+        bool equal = kind == "==";
+        return [text_field, value, equal](const Entry& entry) {
+          return (text_field(entry) == value) == equal;
+        };
+      }
+
+      auto field = findNumberField(name);
+      if (!field) throw std::invalid_argument("unknown field: " + name);
+
+      double threshold;
+      if (!NumberFormat::fromString(value, threshold)) throw std::invalid_argument("not a number: " + value);
+
+      if (kind == ">=") return [field, threshold](const Entry& e) { return field(e) >= threshold; };
+      if (kind == "<=") return [field, threshold](const Entry& e) { return field(e) <= threshold; };
+      if (kind == "==") return [field, threshold](const Entry& e) { return field(e) == threshold; };
+      if (kind == "!=") return [field, threshold](const Entry& e) { return field(e) != threshold; };
+      if (kind == ">")  return [field, threshold](const Entry& e) { return field(e) > threshold; };
+      return [field, threshold](const Entry& e) { return field(e) < threshold; };
+    }
+
+    throw std::invalid_argument("bad condition: " + text);
+  }
+
+};
+
+}
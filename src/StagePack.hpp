@@ -0,0 +1,496 @@
+﻿#pragma once
+
+//
+// 全ステージを1ファイルにまとめたパック
+//
+// 構成(数値は全てリトルエンディアン)
+//   header  : "NGSP" u32:version u32:count
+//   index   : count * { char[32]:name u32:offset u32:size u32:raw_size u32:crc32 }
+//   entries : PackBitsで圧縮したバイナリのステージ
+//
+// indexは固定長なので、n番目のステージは読み込み直後にO(1)でseekできる
+//
+// バイナリのステージ
+//   u16:width u16:length
+//   s32:x_offset s32:pickable
+//   f32*3:color f32*3:bg_color
+//   f32:build_speed f32:collapse_speed f32:auto_collapse
+//   str:camera str:light_tween           (str = u8:length + bytes)
+//   s8 * width * length:height          (穴は-1)
+//   u16:num_special
+//   num_special * { u16:x u16:z u8:type payload }
+//     MOVING  : u8:n s8*n:pattern
+//     SWITCH  : u8:n n * { s16:x s16:y s16:z }
+//     FALLING : f32:interval f32:delay
+//     ONEWAY  : str:direction s32:power
+//
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <boost/filesystem.hpp>
+#include "Stage.hpp"
+#include "NumberFormat.hpp"
+#include "FileUtil.hpp"
+
+
+namespace ngs {
+namespace StagePack {
+
+enum {
+  VERSION      = 1,
+  NAME_SIZE    = 32,
+  HEADER_SIZE  = 12,
+  ENTRY_SIZE   = NAME_SIZE + 4 * 4,
+};
+
+struct Entry {
+  std::string name;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t raw_size;
+  uint32_t crc;
+};
+
+
+struct Crc32Table {
+  uint32_t value[256];
+
+  Crc32Table() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+      }
+      value[i] = c;
+    }
+  }
+};
+
+// TIPS:サムネイル作成などワーカースレッドからも呼ばれるので、
+//      テーブルは起動時に作っておく(VS2013は関数内staticの初期化がスレッドセーフでない)
+const Crc32Table crc32_table;
+
+uint32_t crc32(const std::vector<uint8_t>& data) {
+  uint32_t crc = 0xffffffffu;
+  for (auto b : data) {
+    crc = crc32_table.value[(crc ^ b) & 0xff] ^ (crc >> 8);
+  }
+  return crc ^ 0xffffffffu;
+}
+
+
+// PackBits圧縮
+// 高さの列は同じ値が続くので単純な連長圧縮で十分に縮む
+std::vector<uint8_t> compress(const std::vector<uint8_t>& data) {
+  std::vector<uint8_t> output;
+  output.reserve(data.size() / 2);
+
+  size_t i = 0;
+  while (i < data.size()) {
+    size_t run = 1;
+    while (((i + run) < data.size()) && (data[i + run] == data[i]) && (run < 128)) ++run;
+
+    if (run >= 2) {
+      output.push_back(uint8_t(257 - run));
+      output.push_back(data[i]);
+      i += run;
+      continue;
+    }
+
+    // 連続しない区間はそのまま書く
+    size_t start = i;
+    while ((i < data.size()) && ((i - start) < 128)) {
+      if (((i + 1) < data.size()) && (data[i + 1] == data[i])) break;
+      ++i;
+    }
+    output.push_back(uint8_t(i - start - 1));
+    output.insert(output.end(), data.begin() + start, data.begin() + i);
+  }
+
+  return output;
+}
+
+std::vector<uint8_t> decompress(const std::vector<uint8_t>& data, const size_t raw_size) {
+  std::vector<uint8_t> output;
+  output.reserve(raw_size);
+
+  size_t i = 0;
+  while (i < data.size()) {
+    uint8_t header = data[i++];
+    if (header < 128) {
+      size_t length = header + 1;
+      if ((i + length) > data.size()) throw std::runtime_error("StagePack: broken literal");
+      output.insert(output.end(), data.begin() + i, data.begin() + i + length);
+      i += length;
+    }
+    else if (header > 128) {
+      if (i >= data.size()) throw std::runtime_error("StagePack: broken run");
+      output.insert(output.end(), 257 - header, data[i++]);
+    }
+  }
+
+  if (output.size() != raw_size) throw std::runtime_error("StagePack: size mismatch");
+  return output;
+}
+
+
+class Encoder {
+  std::vector<uint8_t> data_;
+
+public:
+  void u8(const uint8_t value) {
+    data_.push_back(value);
+  }
+
+  void u16(const uint16_t value) {
+    u8(value & 0xff);
+    u8(value >> 8);
+  }
+
+  void u32(const uint32_t value) {
+    u16(value & 0xffff);
+    u16(value >> 16);
+  }
+
+  void f32(const float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    u32(bits);
+  }
+
+  void str(const std::string& value) {
+    size_t length = std::min(value.size(), size_t(255));
+    u8(uint8_t(length));
+    data_.insert(data_.end(), value.begin(), value.begin() + length);
+  }
+
+  const std::vector<uint8_t>& getData() const {
+    return data_;
+  }
+};
+
+class Decoder {
+  const std::vector<uint8_t>& data_;
+  size_t pos_;
+
+  void check(const size_t size) const {
+    if ((pos_ + size) > data_.size()) throw std::runtime_error("StagePack: unexpected end of data");
+  }
+
+public:
+  explicit Decoder(const std::vector<uint8_t>& data) :
+    data_(data),
+    pos_(0)
+  {}
+
+  uint8_t u8() {
+    check(1);
+    return data_[pos_++];
+  }
+
+  uint16_t u16() {
+    uint16_t lo = u8();
+    return lo | (uint16_t(u8()) << 8);
+  }
+
+  uint32_t u32() {
+    uint32_t lo = u16();
+    return lo | (uint32_t(u16()) << 16);
+  }
+
+  float f32() {
+    uint32_t bits = u32();
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::string str() {
+    size_t length = u8();
+    check(length);
+    std::string value(data_.begin() + pos_, data_.begin() + pos_ + length);
+    pos_ += length;
+    return value;
+  }
+};
+
+
+std::vector<uint8_t> encode(const Stage& stage) {
+  Encoder encoder;
+
+  encoder.u16(uint16_t(stage.size.x));
+  encoder.u16(uint16_t(stage.size.y));
+  encoder.u32(uint32_t(stage.x_offset));
+  encoder.u32(uint32_t(stage.pickable));
+
+  encoder.f32(stage.color.r);
+  encoder.f32(stage.color.g);
+  encoder.f32(stage.color.b);
+  encoder.f32(stage.bg_color.r);
+  encoder.f32(stage.bg_color.g);
+  encoder.f32(stage.bg_color.b);
+
+  encoder.f32(stage.build_speed);
+  encoder.f32(stage.collapse_speed);
+  encoder.f32(stage.auto_collapse);
+
+  encoder.str(stage.camera);
+  encoder.str(stage.light_tween);
+
+  std::vector<const Stage::Cube*> special;
+  for (const auto& row : stage.body) {
+    for (int x = 0; x < stage.size.x; ++x) {
+      // TIPS:短い行は穴で埋める
+      if (x >= int(row.size())) {
+        encoder.u8(uint8_t(-1));
+        continue;
+      }
+
+      const auto& cube = row[x];
+      encoder.u8(uint8_t(int8_t(cube.pos.y)));
+      if ((cube.pos.y >= 0) && (cube.type != Stage::Cube::NONE)) {
+        special.push_back(&cube);
+      }
+    }
+  }
+
+  encoder.u16(uint16_t(special.size()));
+  for (const auto* cube : special) {
+    encoder.u16(uint16_t(cube->pos.x));
+    encoder.u16(uint16_t(cube->pos.z));
+    encoder.u8(uint8_t(cube->type));
+
+    switch (cube->type) {
+    case Stage::Cube::MOVING:
+      {
+        auto pattern = NumberFormat::parseIntList(cube->pattern);
+        encoder.u8(uint8_t(pattern.size()));
+        for (auto p : pattern) {
+          encoder.u8(uint8_t(int8_t(p)));
+        }
+      }
+      break;
+
+    case Stage::Cube::SWITCH:
+      encoder.u8(uint8_t(cube->target.size()));
+      for (const auto& t : cube->target) {
+        auto pos = NumberFormat::parseIntList(t);
+        pos.resize(3);
+        for (auto p : pos) {
+          encoder.u16(uint16_t(int16_t(p)));
+        }
+      }
+      break;
+
+    case Stage::Cube::FALLING:
+      encoder.f32(cube->interval);
+      encoder.f32(cube->delay);
+      break;
+
+    case Stage::Cube::ONEWAY:
+      encoder.str(cube->direction);
+      encoder.u32(uint32_t(cube->power));
+      break;
+    }
+  }
+
+  return encoder.getData();
+}
+
+Stage decode(const std::vector<uint8_t>& data) {
+  Decoder decoder(data);
+
+  Stage stage;
+  stage.size.x = decoder.u16();
+  stage.size.y = decoder.u16();
+  stage.x_offset = int32_t(decoder.u32());
+  stage.pickable = int32_t(decoder.u32());
+
+  stage.color.r = decoder.f32();
+  stage.color.g = decoder.f32();
+  stage.color.b = decoder.f32();
+  stage.bg_color.r = decoder.f32();
+  stage.bg_color.g = decoder.f32();
+  stage.bg_color.b = decoder.f32();
+
+  stage.build_speed    = decoder.f32();
+  stage.collapse_speed = decoder.f32();
+  stage.auto_collapse  = decoder.f32();
+
+  stage.camera      = decoder.str();
+  stage.light_tween = decoder.str();
+
+  stage.resize();
+  for (auto& row : stage.body) {
+    for (auto& cube : row) {
+      cube.pos.y = int8_t(decoder.u8());
+    }
+  }
+
+  size_t num_special = decoder.u16();
+  for (size_t i = 0; i < num_special; ++i) {
+    int x = decoder.u16();
+    int z = decoder.u16();
+    int type = decoder.u8();
+
+    Stage::Cube dummy;
+    auto* cube = ((x < stage.size.x) && (z < stage.size.y)) ? &stage.body[z][x] : &dummy;
+    cube->type = type;
+
+    switch (type) {
+    case Stage::Cube::MOVING:
+      {
+        std::vector<int> pattern(decoder.u8());
+        for (auto& p : pattern) {
+          p = int8_t(decoder.u8());
+        }
+        cube->pattern = NumberFormat::joinIntList(pattern);
+      }
+      break;
+
+    case Stage::Cube::SWITCH:
+      {
+        size_t num = decoder.u8();
+        for (size_t t = 0; t < num; ++t) {
+          std::vector<int> pos(3);
+          for (auto& p : pos) {
+            p = int16_t(decoder.u16());
+          }
+          cube->target.push_back(NumberFormat::joinIntList(pos));
+        }
+      }
+      break;
+
+    case Stage::Cube::FALLING:
+      cube->interval = decoder.f32();
+      cube->delay    = decoder.f32();
+      break;
+
+    case Stage::Cube::ONEWAY:
+      cube->direction = decoder.str();
+      cube->power     = int32_t(decoder.u32());
+      break;
+    }
+  }
+  stage.updateSpecialCubes();
+
+  return stage;
+}
+
+
+// 書き出し途中で失敗しても元のファイルを壊さないように一時ファイルから置き換える
+void write(const std::vector<std::pair<std::string, Stage> >& stages, const std::string& path) {
+  std::vector<Entry> entries;
+  std::vector<std::vector<uint8_t> > payloads;
+
+  uint32_t offset = uint32_t(HEADER_SIZE + ENTRY_SIZE * stages.size());
+  for (const auto& stage : stages) {
+    if (stage.first.size() >= NAME_SIZE) throw std::runtime_error("StagePack: name too long " + stage.first);
+
+    auto raw = encode(stage.second);
+    payloads.push_back(compress(raw));
+
+    Entry entry;
+    entry.name     = stage.first;
+    entry.offset   = offset;
+    entry.size     = uint32_t(payloads.back().size());
+    entry.raw_size = uint32_t(raw.size());
+    entry.crc      = crc32(raw);
+    entries.push_back(entry);
+
+    offset += entry.size;
+  }
+
+  Encoder header;
+  header.u8('N');
+  header.u8('G');
+  header.u8('S');
+  header.u8('P');
+  header.u32(VERSION);
+  header.u32(uint32_t(entries.size()));
+  for (const auto& entry : entries) {
+    char name[NAME_SIZE] = {};
+    std::memcpy(name, entry.name.data(), entry.name.size());
+    for (auto c : name) {
+      header.u8(uint8_t(c));
+    }
+    header.u32(entry.offset);
+    header.u32(entry.size);
+    header.u32(entry.raw_size);
+    header.u32(entry.crc);
+  }
+
+  const auto& data = header.getData();
+  FileUtil::writeAtomic(path, [&data, &payloads](std::ostream& file) {
+      file.write(reinterpret_cast<const char*>(data.data()), data.size());
+      for (const auto& payload : payloads) {
+        file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+      }
+    });
+}
+
+
+// 索引だけを読み、ステージは必要になった時にseekして読む
+class Reader {
+  std::ifstream file_;
+  std::vector<Entry> entries_;
+
+public:
+  explicit Reader(const std::string& path) :
+    file_(path, std::ios::binary)
+  {
+    if (!file_) throw std::runtime_error("StagePack: can't open " + path);
+
+    std::vector<uint8_t> header(HEADER_SIZE);
+    file_.read(reinterpret_cast<char*>(header.data()), header.size());
+    if (!file_ || std::memcmp(header.data(), "NGSP", 4)) throw std::runtime_error("StagePack: not a stage pack");
+
+    Decoder decoder(header);
+    decoder.u32();
+    if (decoder.u32() != VERSION) throw std::runtime_error("StagePack: unknown version");
+    size_t count = decoder.u32();
+
+    std::vector<uint8_t> index(ENTRY_SIZE * count);
+    file_.read(reinterpret_cast<char*>(index.data()), index.size());
+    if (!file_) throw std::runtime_error("StagePack: broken index");
+
+    Decoder index_decoder(index);
+    for (size_t i = 0; i < count; ++i) {
+      Entry entry;
+      for (int n = 0; n < NAME_SIZE; ++n) {
+        char c = char(index_decoder.u8());
+        if (c) entry.name += c;
+      }
+      entry.offset   = index_decoder.u32();
+      entry.size     = index_decoder.u32();
+      entry.raw_size = index_decoder.u32();
+      entry.crc      = index_decoder.u32();
+      entries_.push_back(entry);
+    }
+  }
+
+  const std::vector<Entry>& getEntries() const {
+    return entries_;
+  }
+
+  Stage load(const size_t index) {
+    const auto& entry = entries_.at(index);
+
+    std::vector<uint8_t> payload(entry.size);
+    file_.seekg(entry.offset);
+    file_.read(reinterpret_cast<char*>(payload.data()), payload.size());
+    if (!file_) throw std::runtime_error("StagePack: can't read " + entry.name);
+
+    auto raw = decompress(payload, entry.raw_size);
+    if (crc32(raw) != entry.crc) throw std::runtime_error("StagePack: checksum error " + entry.name);
+
+    return decode(raw);
+  }
+};
+
+}
+}
@@ -0,0 +1,280 @@
+﻿#pragma once
+
+//
+// CPUだけでStageを画像にする
+// StageDrawer::drawと同じ配色・配置で塗る(GPUもウインドウも不要)
+//
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "Stage.hpp"
+#include "CubeTraits.hpp"
+#include "NumberFormat.hpp"
+#include "StagePack.hpp"
+
+
+namespace ngs {
+namespace StageRasterizer {
+
+// RGBA8の画像
+struct Image {
+  int width;
+  int height;
+  std::vector<uint8_t> pixels;
+
+  Image(const int w, const int h) :
+    width(w),
+    height(h),
+    pixels(w * h * 4, 0)
+  {}
+};
+
+
+struct Rgba {
+  float r, g, b, a;
+};
+
+struct Rect {
+  float x0, y0, x1, y1;
+};
+
+Rgba getCubeColor(const Stage& stage, const Stage::Cube& cube) {
+  const auto* info = findCubeTypeInfo(cube.type);
+  if (info) return { info->color.r, info->color.g, info->color.b, info->color.a };
+  return { stage.color.r, stage.color.g, stage.color.b, 1 };
+}
+
+
+// ステージ座標の矩形をアルファブレンドで塗る
+void fillRect(Image& image, const float scale,
+              const float x0, const float y0, const float x1, const float y1,
+              const Rgba& color) {
+  // 画像の外(範囲外のスイッチの対象など)は塗らない
+  // TIPS:切り詰めてから最低1ピクセルにすると、端に点が出てしまう
+  //      丸める前の座標で調べる(端の細い矩形は丸めると幅0になるが、1ピクセル塗りたい)
+  if (((x1 * scale) <= 0.0f) || ((y1 * scale) <= 0.0f)
+      || ((x0 * scale) >= image.width) || ((y0 * scale) >= image.height)) return;
+
+  int px0 = std::max(0, int(std::floor(x0 * scale + 0.5f)));
+  int py0 = std::max(0, int(std::floor(y0 * scale + 0.5f)));
+  int px1 = std::min(image.width,  int(std::floor(x1 * scale + 0.5f)));
+  int py1 = std::min(image.height, int(std::floor(y1 * scale + 0.5f)));
+
+  // 縮小しても消えないように最低1ピクセルは塗る
+  if ((px1 <= px0) && (px0 < image.width))  px1 = px0 + 1;
+  if ((py1 <= py0) && (py0 < image.height)) py1 = py0 + 1;
+
+  const float a = color.a;
+  const uint8_t r = uint8_t(color.r * 255.0f + 0.5f);
+  const uint8_t g = uint8_t(color.g * 255.0f + 0.5f);
+  const uint8_t b = uint8_t(color.b * 255.0f + 0.5f);
+
+  for (int y = py0; y < py1; ++y) {
+    auto* p = &image.pixels[(y * image.width + px0) * 4];
+    for (int x = px0; x < px1; ++x, p += 4) {
+      if (a >= 1.0f) {
+        p[0] = r;
+        p[1] = g;
+        p[2] = b;
+      }
+      else {
+        p[0] = uint8_t(p[0] + (r - p[0]) * a);
+        p[1] = uint8_t(p[1] + (g - p[1]) * a);
+        p[2] = uint8_t(p[2] + (b - p[2]) * a);
+      }
+      p[3] = 255;
+    }
+  }
+}
+
+
+// 1セルをcell_sizeピクセルで描く
+// 画面と同じく奥(zの大きい方)が上、xは右から左に並ぶ
+Image rasterize(const Stage& stage, const int cell_size, const bool draw_switch_target = true) {
+  const float scale = float(cell_size);
+  Image image(std::max(1, stage.size.x * cell_size), std::max(1, stage.size.y * cell_size));
+
+  // 背景
+  fillRect(image, 1.0f, 0, 0, float(image.width), float(image.height),
+           { stage.bg_color.r, stage.bg_color.g, stage.bg_color.b, 1 });
+
+  // TIPS:エディタは180度回転して表示しているので反転してから塗る
+  auto flip = [&stage](const float x, const float z, const float w, const float h) {
+    return Rect{ stage.size.x - x - w, stage.size.y - z - h, stage.size.x - x, stage.size.y - z };
+  };
+
+  for (const auto& rows : stage.body) {
+    for (const auto& cube : rows) {
+      if (cube.pos.y < 0) continue;
+
+      auto rect = flip(float(cube.pos.x), float(cube.pos.z), 0.9f, 0.9f);
+      fillRect(image, scale, rect.x0, rect.y0, rect.x1, rect.y1, getCubeColor(stage, cube));
+
+      // 高さ
+      for (int i = 0; i < cube.pos.y; ++i) {
+        float ofs_x = 0.1f + 0.2f * (i % 4);
+        float ofs_y = 0.1f + 0.2f * (i / 4);
+        auto pip = flip(cube.pos.x + ofs_x, cube.pos.z + ofs_y, 0.1f, 0.1f);
+        fillRect(image, scale, pip.x0, pip.y0, pip.x1, pip.y1, { 1, 0, 0, 1 });
+      }
+    }
+  }
+
+  if (draw_switch_target) {
+    for (const auto& switch_pos : stage.getSpecialCubes(Stage::Cube::SWITCH)) {
+      for (const auto& target : stage.body[switch_pos.y][switch_pos.x].target) {
+        auto pos = NumberFormat::parseIntList(target);
+        if (pos.size() < 3) continue;
+
+        auto rect = flip(pos[0] + 0.1f, pos[2] + 0.1f, 0.7f, 0.7f);
+        fillRect(image, scale, rect.x0, rect.y0, rect.x1, rect.y1, { 0, 1, 1, 0.5f });
+      }
+    }
+  }
+
+  return image;
+}
+
+
+// 無圧縮deflateのPNG(外部ライブラリを使わない)
+std::vector<uint8_t> encodePng(const Image& image) {
+  auto be32 = [](std::vector<uint8_t>& out, const uint32_t value) {
+    out.push_back(uint8_t(value >> 24));
+    out.push_back(uint8_t(value >> 16));
+    out.push_back(uint8_t(value >> 8));
+    out.push_back(uint8_t(value));
+  };
+
+  auto chunk = [&be32](std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    be32(out, uint32_t(data.size()));
+    std::vector<uint8_t> body(type, type + 4);
+    body.insert(body.end(), data.begin(), data.end());
+    out.insert(out.end(), body.begin(), body.end());
+    be32(out, StagePack::crc32(body));
+  };
+
+  // 各行の先頭にフィルタ種別0を付ける
+  std::vector<uint8_t> raw;
+  const size_t stride = image.width * 4;
+  raw.reserve((stride + 1) * image.height);
+  for (int y = 0; y < image.height; ++y) {
+    raw.push_back(0);
+    raw.insert(raw.end(), image.pixels.begin() + y * stride, image.pixels.begin() + (y + 1) * stride);
+  }
+
+  std::vector<uint8_t> zlib = { 0x78, 0x01 };
+  for (size_t pos = 0; pos < raw.size() || raw.empty(); ) {
+    size_t length = std::min(raw.size() - pos, size_t(65535));
+    bool last = (pos + length) >= raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(uint8_t(length));
+    zlib.push_back(uint8_t(length >> 8));
+    zlib.push_back(uint8_t(~length));
+    zlib.push_back(uint8_t(~length >> 8));
+    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + length);
+    pos += length;
+    if (last) break;
+  }
+
+  uint32_t a = 1;
+  uint32_t b = 0;
+  for (auto v : raw) {
+    a = (a + v) % 65521;
+    b = (b + a) % 65521;
+  }
+  be32(zlib, (b << 16) | a);
+
+  std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+  std::vector<uint8_t> header;
+  be32(header, uint32_t(image.width));
+  be32(header, uint32_t(image.height));
+  header.push_back(8);    // bit depth
+  header.push_back(6);    // RGBA
+  header.push_back(0);
+  header.push_back(0);
+  header.push_back(0);
+
+  chunk(png, "IHDR", header);
+  chunk(png, "IDAT", zlib);
+  chunk(png, "IEND", std::vector<uint8_t>());
+
+  return png;
+}
+
+void writePng(const Image& image, const std::string& path) {
+  auto png = encodePng(image);
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file) throw std::runtime_error("StageRasterizer: can't write " + path);
+  file.write(reinterpret_cast<const char*>(png.data()), png.size());
+}
+
+
+// encodePngが書き出した形式(RGBA8・無圧縮・フィルタ無し)だけを読む
+// それ以外の形式はfalseを返す
+bool decodePng(const std::vector<uint8_t>& png, Image& image) {
+  static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  if ((png.size() < 8) || !std::equal(signature, signature + 8, png.begin())) return false;
+
+  auto be32 = [&png](const size_t pos) {
+    return (uint32_t(png[pos]) << 24) | (uint32_t(png[pos + 1]) << 16)
+      | (uint32_t(png[pos + 2]) << 8) | uint32_t(png[pos + 3]);
+  };
+
+  int width  = 0;
+  int height = 0;
+  std::vector<uint8_t> zlib;
+  for (size_t pos = 8; (pos + 12) <= png.size(); ) {
+    size_t length = be32(pos);
+    if ((pos + 12 + length) > png.size()) return false;
+
+    std::string type(png.begin() + pos + 4, png.begin() + pos + 8);
+    const auto* data = &png[pos + 8];
+    if (type == "IHDR") {
+      if ((length != 13) || (data[8] != 8) || (data[9] != 6) || data[10] || data[11] || data[12]) return false;
+      width  = int(be32(pos + 8));
+      height = int(be32(pos + 12));
+    }
+    else if (type == "IDAT") {
+      zlib.insert(zlib.end(), data, data + length);
+    }
+    pos += 12 + length;
+  }
+  if ((width <= 0) || (height <= 0) || (zlib.size() < 2)) return false;
+
+  const size_t stride = width * 4;
+  std::vector<uint8_t> raw;
+  raw.reserve((stride + 1) * height);
+  for (size_t pos = 2; pos < zlib.size(); ) {
+    uint8_t header = zlib[pos];
+    if ((header & 0x6) != 0) return false;
+    if ((pos + 5) > zlib.size()) return false;
+
+    size_t length = zlib[pos + 1] | (zlib[pos + 2] << 8);
+    pos += 5;
+    if ((pos + length) > zlib.size()) return false;
+
+    raw.insert(raw.end(), zlib.begin() + pos, zlib.begin() + pos + length);
+    pos += length;
+    if (header & 1) break;
+  }
+  if (raw.size() != (stride + 1) * height) return false;
+
+  image = Image(width, height);
+  for (int y = 0; y < height; ++y) {
+    const auto* row = &raw[y * (stride + 1)];
+    if (row[0] != 0) return false;
+    std::copy(row + 1, row + 1 + stride, image.pixels.begin() + y * stride);
+  }
+
+  return true;
+}
+
+}
+}
@@ -3,125 +3,299 @@
 //
 // Stageのserialize/desirialize
 //
+// bodyは1行を数値の配列で書く(ゲームが読む形)か、
+// "値*個数" を並べた文字列で書く(body_version:2 ランレングス)
+//   [ -1, -1, -1, 0, 0, 2 ] <-> "-1*3 0*2 2"
+// 読む時は行が文字列かどうかで見分ける
+//
 
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
 #include "Stage.hpp"
+#include "CubeTraits.hpp"
 #include "JsonUtil.hpp"
+#include "JsonWriter.hpp"
+#include "NumberFormat.hpp"
+#include "FileUtil.hpp"
 
 
 namespace ngs {
 namespace StageSerializer {
 
-ci::JsonTree makeMoving(const ci::Vec3i& pos, const std::string& pattern) {
-  std::ostringstream text;
-  text << "{ \"entry\": ["
-       << pos.x << ","
-       << pos.y << ","
-       << pos.z
-       << "], \"pattern\": [ "
-       << pattern
-       << "] }";
-
-  return ci::JsonTree(text.str());
+enum {
+  // bodyの書き方(body_versionの値)
+  BODY_PLAIN = 1,
+  BODY_RLE   = 2,
+
+  // 壊れたファイルで巨大な行を作らないための上限
+  MAX_ROW_LENGTH = 1 << 16,
+};
+
+
+JsonWriter::Value makeVec3(const ci::Vec3i& pos) {
+  return JsonWriter::Value::makeArray()
+    .pushBack(pos.x)
+    .pushBack(pos.y)
+    .pushBack(pos.z);
+}
+
+JsonWriter::Value makeMoving(const ci::Vec3i& pos, const std::string& pattern) {
+  return JsonWriter::Value::makeObject()
+    .addChild("entry", makeVec3(pos))
+    .addChild("pattern", JsonWriter::Value::makeArray(NumberFormat::parseIntList(pattern)));
 }
   
-ci::JsonTree makeSwitch(const ci::Vec3i& pos, const std::vector<std::string>& target) {
-  std::ostringstream text;
-  text << "{ \"position\": ["
-       << pos.x << ","
-       << pos.y << ","
-       << pos.z
-       << "], \"target\": [ ";
-
-  size_t index = 0;
+JsonWriter::Value makeSwitch(const ci::Vec3i& pos, const std::vector<std::string>& target) {
+  auto targets = JsonWriter::Value::makeArray();
   for (const auto& t : target) {
-    if (index > 0) text << ", ";
-    text << "[ " << t << " ]";
-    index += 1;
+    targets.pushBack(JsonWriter::Value::makeArray(NumberFormat::parseIntList(t)));
   }
-  text << "] }";
 
-  return ci::JsonTree(text.str());
+  return JsonWriter::Value::makeObject()
+    .addChild("position", makeVec3(pos))
+    .addChild("target", targets);
 }
 
-ci::JsonTree makeFalling(const ci::Vec3i& pos,
-                         const float interval, const float delay) {
-  std::ostringstream text;
-  text << "{ \"entry\": ["
-       << pos.x << ","
-       << pos.y << ","
-       << pos.z
-       << "], \"interval\": "
-       << interval << ","
-       << " \"delay\": "
-       << delay
-       << " }";
-
-  return ci::JsonTree(text.str());
+JsonWriter::Value makeFalling(const ci::Vec3i& pos,
+                              const float interval, const float delay) {
+  return JsonWriter::Value::makeObject()
+    .addChild("entry", makeVec3(pos))
+    .addChild("interval", interval)
+    .addChild("delay", delay);
 }
 
-ci::JsonTree makeOneway(const ci::Vec3i& pos,
-                        const std::string direction, const int power) {
-  std::ostringstream text;
-  text << "{ \"position\": ["
-       << pos.x << ","
-       << pos.y << ","
-       << pos.z
-       << "], \"direction\": \""
-       << direction << "\","
-       << " \"power\": "
-       << power
-       << " }";
-
-  return ci::JsonTree(text.str());
+JsonWriter::Value makeOneway(const ci::Vec3i& pos,
+                             const std::string direction, const int power) {
+  return JsonWriter::Value::makeObject()
+    .addChild("position", makeVec3(pos))
+    .addChild("direction", direction)
+    .addChild("power", power);
 }
 
 
-ci::JsonTree jsonArrayFromStageBody(const std::vector<Stage::Cube>& cubes) {
-  std::ostringstream text;
-  text << "[";
+// 同じ高さが続く所を "値*個数" にする(1個だけなら値のみ)
+std::string encodeRow(const std::vector<Stage::Cube>& cubes) {
+  std::string text;
+  for (size_t i = 0; i < cubes.size();) {
+    size_t count = 1;
+    while (((i + count) < cubes.size()) && (cubes[i + count].pos.y == cubes[i].pos.y)) ++count;
 
-  size_t i = 0;
-  for (const auto& cube : cubes) {
-    if (i > 0) text << ",";
-    ++i;
+    if (!text.empty()) text += ' ';
+    text += NumberFormat::toString(cubes[i].pos.y);
+    if (count > 1) {
+      text += '*';
+      text += NumberFormat::toString(int(count));
+    }
+    i += count;
+  }
+  return text;
+}
+
+// z行目の文字列をlineへ直接展開する(要素ごとのJsonTreeを作らない)
+void decodeRow(const std::string& text, const int z, std::vector<Stage::Cube>& line) {
+  const char* p = text.c_str();
+  while (*p) {
+    if (*p == ' ') {
+      ++p;
+      continue;
+    }
+
+    char* end;
+    long value = std::strtol(p, &end, 10);
+    if (end == p) throw std::runtime_error("StageSerializer: bad body row '" + text + "'");
+    p = end;
+
+    long count = 1;
+    if (*p == '*') {
+      count = std::strtol(p + 1, &end, 10);
+      if ((end == (p + 1)) || (count <= 0) || (count > (MAX_ROW_LENGTH - long(line.size())))) {
+        throw std::runtime_error("StageSerializer: bad count in body row '" + text + "'");
+      }
+      p = end;
+    }
 
-    text << cube.pos.y;
+    for (long i = 0; i < count; ++i) {
+      line.emplace_back(ci::Vec3i(int(line.size()), int(value), z));
+    }
   }
+}
+
+// ランレングスで書かれているか
+bool isRle(const ci::JsonTree& params) {
+  return Json::getValue(params, "body_version", int(BODY_PLAIN)) == BODY_RLE;
+}
 
-  text << "]";
 
-  return ci::JsonTree(text.str());
+JsonWriter::Value jsonArrayFromStageBody(const std::vector<Stage::Cube>& cubes) {
+  auto array = JsonWriter::Value::makeArray();
+  for (const auto& cube : cubes) {
+    array.pushBack(cube.pos.y);
+  }
+
+  return array;
 }
   
 template <typename T>
-ci::JsonTree jsonArrayFromVec3(const T& vector) {
-  std::ostringstream text;
-  text << "[ "
-       << vector.x << ", "
-       << vector.y << ", "
-       << vector.z << " ]";
-
-  return ci::JsonTree(text.str());
+JsonWriter::Value jsonArrayFromColor(const T& color) {
+  return JsonWriter::Value::makeArray()
+    .pushBack(color.r)
+    .pushBack(color.g)
+    .pushBack(color.b);
 }
-  
-template <typename T>
-ci::JsonTree jsonArrayFromColor(const std::string& key, const T& color) {
-  std::ostringstream text;
-  text << "{ \"" << key << "\":";
-  text << "[ "
-       << color.r << ", "
-       << color.g << ", "
-       << color.b << " ] }";
-
-  return ci::JsonTree(text.str());
+
+
+// 種類ごとの読み書き
+template <int TYPE>
+JsonWriter::Value writeCube(const Stage::Cube& cube);
+
+template <int TYPE>
+void readCube(const ci::JsonTree& params, Stage& stage);
+
+
+template <>
+JsonWriter::Value writeCube<Stage::Cube::ITEM>(const Stage::Cube& cube) {
+  return makeVec3(cube.pos);
+}
+
+template <>
+void readCube<Stage::Cube::ITEM>(const ci::JsonTree& params, Stage& stage) {
+  const auto pos = Json::getVec3<int>(params);
+  auto* cube = stage.getCube(pos);
+  if (cube) {
+    cube->type = Stage::Cube::ITEM;
+  }
 }
 
 
-Stage deserialize(const std::string& path) {
-  auto params = Json::readFromFile(path);
-  
-  Stage stage;
+template <>
+JsonWriter::Value writeCube<Stage::Cube::MOVING>(const Stage::Cube& cube) {
+  return makeMoving(cube.pos, cube.pattern);
+}
+
+template <>
+void readCube<Stage::Cube::MOVING>(const ci::JsonTree& params, Stage& stage) {
+  const auto pos = Json::getVec3<int>(params["entry"]);
+  auto* cube = stage.getCube(pos);
+  if (cube) {
+    cube->type = Stage::Cube::MOVING;
+
+    // 文字列の状態で編集するため
+    // 移動パターンを取り出して変換している
+    cube->pattern = NumberFormat::joinIntList(Json::getArray<int>(params["pattern"]));
+  }
+}
+
+
+template <>
+JsonWriter::Value writeCube<Stage::Cube::SWITCH>(const Stage::Cube& cube) {
+  return makeSwitch(cube.pos, cube.target);
+}
 
+template <>
+void readCube<Stage::Cube::SWITCH>(const ci::JsonTree& params, Stage& stage) {
+  const auto pos = Json::getVec3<int>(params["position"]);
+  auto* cube = stage.getCube(pos);
+  if (cube) {
+    cube->type = Stage::Cube::SWITCH;
+
+    // 文字列の状態で編集するため
+    // 移動パターンを取り出して変換している
+    for (const auto& value : params["target"]) {
+      cube->target.push_back(NumberFormat::joinIntList(Json::getArray<int>(value)));
+    }
+  }
+}
+
+
+template <>
+JsonWriter::Value writeCube<Stage::Cube::FALLING>(const Stage::Cube& cube) {
+  return makeFalling(cube.pos, cube.interval, cube.delay);
+}
+
+template <>
+void readCube<Stage::Cube::FALLING>(const ci::JsonTree& params, Stage& stage) {
+  const auto pos = Json::getVec3<int>(params["entry"]);
+
+  const float interval = Json::toValue<float>(params["interval"]);
+  const float delay    = Json::toValue<float>(params["delay"]);
+
+  auto* cube = stage.getCube(pos);
+  if (cube) {
+    cube->type = Stage::Cube::FALLING;
+    cube->interval = interval;
+    cube->delay    = delay;
+  }
+}
+
+
+template <>
+JsonWriter::Value writeCube<Stage::Cube::ONEWAY>(const Stage::Cube& cube) {
+  return makeOneway(cube.pos, cube.direction, cube.power);
+}
+
+template <>
+void readCube<Stage::Cube::ONEWAY>(const ci::JsonTree& params, Stage& stage) {
+  const auto pos = Json::getVec3<int>(params["position"]);
+
+  const auto direction = params["direction"].getValue<std::string>();
+  const auto power     = Json::toValue<int>(params["power"]);
+
+  auto* cube = stage.getCube(pos);
+  if (cube) {
+    cube->type = Stage::Cube::ONEWAY;
+    cube->direction = direction;
+    cube->power     = power;
+  }
+}
+
+
+// 種類ごとの項目を読む
+struct SpecialReader {
+  const ci::JsonTree& params;
+  Stage& stage;
+
+  template <int TYPE>
+  void apply() {
+    const auto* key = CubeTraits<TYPE>::key();
+    if (!params.hasChild(key)) return;
+
+    for (const auto& p : params[key]) {
+      readCube<TYPE>(p, stage);
+    }
+  }
+};
+
+// 種類ごとの項目を書く
+// TIPS:special_cubesだけをたどるので、特殊なキューブの数だけで済む
+struct SpecialWriter {
+  const Stage& stage;
+  JsonWriter::Value& stage_data;
+
+  template <int TYPE>
+  void apply() {
+    auto array = JsonWriter::Value::makeArray();
+    for (const auto& pos : stage.special_cubes[CubeTraits<TYPE>::INDEX]) {
+      array.pushBack(writeCube<TYPE>(stage.body[pos.y][pos.x]));
+    }
+
+    if (array.hasChildren()) {
+      stage_data.addChild(CubeTraits<TYPE>::key(), array);
+    }
+  }
+};
+
+
+// bodyと種類ごとの項目を読む
+void readBody(const ci::JsonTree& params, Stage& stage) {
+  int body_version = Json::getValue(params, "body_version", int(BODY_PLAIN));
+  if ((body_version != BODY_PLAIN) && (body_version != BODY_RLE)) {
+    throw std::runtime_error("StageSerializer: unsupported body_version " + NumberFormat::toString(body_version));
+  }
+
+  stage.body.clear();
   stage.size = ci::Vec2i::zero();
     
   int z = 0;
@@ -129,11 +303,17 @@ Stage deserialize(const std::string& path) {
     std::vector<Stage::Cube> line;
 
     int x = 0;
-    for (const auto& p : rows) {
-      ci::Vec3i cube_pos(x, p.getValue<int>(), z);
-      line.emplace_back(cube_pos);
+    if (rows.getNodeType() == ci::JsonTree::NODE_VALUE) {
+      decodeRow(rows.getValue<std::string>(), z, line);
+      x = int(line.size());
+    }
+    else {
+      for (const auto& p : rows) {
+        ci::Vec3i cube_pos(x, Json::toValue<int>(p), z);
+        line.emplace_back(cube_pos);
 
-      x += 1;
+        x += 1;
+      }
     }
     stage.body.push_back(std::move(line));
 
@@ -142,6 +322,13 @@ Stage deserialize(const std::string& path) {
   }
   stage.size.y = z;
 
+  SpecialReader reader = { params, stage };
+  forEachCubeType(reader);
+  stage.updateSpecialCubes();
+}
+
+// 色や速度などのステージ全体の値を読む
+void readParams(const ci::JsonTree& params, Stage& stage) {
   stage.color    = Json::getColor<float>(params["color"]);
   stage.bg_color = Json::getColor<float>(params["bg_color"]);
 
@@ -154,172 +341,75 @@ Stage deserialize(const std::string& path) {
 
   stage.camera = Json::getValue(params, "camera", std::string("normal"));
   stage.light_tween = Json::getValue(params, "light_tween", std::string("default"));
-    
-  if (params.hasChild("items")) {
-    for (const auto& p : params["items"]) {
-      const auto pos = Json::getVec3<int>(p);
-      auto* cube = stage.getCube(pos);
-      if (cube) {
-        cube->type = Stage::Cube::ITEM;
-      }
-    }
-  }
-    
-  if (params.hasChild("moving")) {
-    for (const auto& p : params["moving"]) {
-      const auto pos = Json::getVec3<int>(p["entry"]);
-      auto* cube = stage.getCube(pos);
-      if (cube) {
-        cube->type = Stage::Cube::MOVING;
-
-        // 文字列の状態で編集するため
-        // 移動パターンを取り出して変換している
-        std::ostringstream pattern;
-        size_t index = 0;
-        for (const auto& value : p["pattern"]) {
-          if (index > 0) pattern << ", ";
-          pattern << value.getValue<int>();
-          index += 1;
-        }
-        cube->pattern = pattern.str();
-      }
-    }
-  }
-    
-  if (params.hasChild("switches")) {
-    for (const auto& p : params["switches"]) {
-      const auto pos = Json::getVec3<int>(p["position"]);
-      auto* cube = stage.getCube(pos);
-      if (cube) {
-        cube->type = Stage::Cube::SWITCH;
-
-        // 文字列の状態で編集するため
-        // 移動パターンを取り出して変換している
-        for (const auto& value : p["target"]) {
-          std::ostringstream target;
-          size_t index = 0;
-          for (const auto& v : value) {
-            if (index > 0) target << ", ";
-            target << v.getValue<int>();
-            index += 1;
-          }
-          cube->target.push_back(target.str());
-        }
-      }
-    }
-  }
-
-  if (params.hasChild("falling")) {
-    for (const auto& p : params["falling"]) {
-      const auto pos = Json::getVec3<int>(p["entry"]);
-
-      const float interval = p["interval"].getValue<float>();
-      const float delay    = p["delay"].getValue<float>();
-
-      auto* cube = stage.getCube(pos);
-      if (cube) {
-        cube->type = Stage::Cube::FALLING;
-        cube->interval = interval;
-        cube->delay    = delay;
-      }      
-    }
-  }
-
-  if (params.hasChild("oneways")) {
-    for (const auto& p : params["oneways"]) {
-      const auto pos = Json::getVec3<int>(p["position"]);
-
-      const auto direction = p["direction"].getValue<std::string>();
-      const auto power     = p["power"].getValue<int>();
+}
 
-      auto* cube = stage.getCube(pos);
-      if (cube) {
-        cube->type = Stage::Cube::ONEWAY;
-        cube->direction = direction;
-        cube->power     = power;
-      }      
-    }
-  }
+Stage makeStage(const ci::JsonTree& params) {
+  Stage stage;
+  readBody(params, stage);
+  readParams(params, stage);
 
   return stage;
 }
 
+Stage deserialize(const std::string& path) {
+  return makeStage(Json::readFromFile(path));
+}
 
-void serialize(const Stage& stage, const std::string& path) {
-  ci::JsonTree stage_data = ci::JsonTree::makeObject("stage");
-    
-  auto body     = ci::JsonTree::makeArray("body");
-  auto items    = ci::JsonTree::makeArray("items");
-  auto moving   = ci::JsonTree::makeArray("moving");
-  auto switches = ci::JsonTree::makeArray("switches");
-  auto falling  = ci::JsonTree::makeArray("falling");
-  auto oneways  = ci::JsonTree::makeArray("oneways");
-    
+
+// bodyと種類ごとの項目を書く
+void writeBody(const Stage& stage, JsonWriter::Value& stage_data, const int body_version = BODY_PLAIN) {
+  auto body = JsonWriter::Value::makeArray();
   for (const auto& rows : stage.body) {
-    body.pushBack(jsonArrayFromStageBody(rows));
-        
-    for (const auto& cube : rows) {
-      switch (cube.type) {
-      case Stage::Cube::ITEM:
-        items.pushBack(jsonArrayFromVec3(cube.pos));
-        break;
-
-      case Stage::Cube::MOVING:
-        moving.pushBack(makeMoving(cube.pos, cube.pattern));
-        break;
-
-      case Stage::Cube::SWITCH:
-        switches.pushBack(makeSwitch(cube.pos, cube.target));
-        break;
-
-      case Stage::Cube::FALLING:
-        falling.pushBack(makeFalling(cube.pos, cube.interval, cube.delay));
-        break;
-
-      case Stage::Cube::ONEWAY:
-        oneways.pushBack(makeOneway(cube.pos, cube.direction, cube.power));
-        break;
-      }
+    if (body_version == BODY_RLE) {
+      body.pushBack(encodeRow(rows));
+    }
+    else {
+      body.pushBack(jsonArrayFromStageBody(rows));
     }
   }
-
-  stage_data.addChild(body);
-
-  if (items.hasChildren()) {
-    stage_data.addChild(items);
-  }
-  if (moving.hasChildren()) {
-    stage_data.addChild(moving);
-  }
-  if (switches.hasChildren()) {
-    stage_data.addChild(switches);
-  }
-  if (falling.hasChildren()) {
-    stage_data.addChild(falling);
-  }
-  if (oneways.hasChildren()) {
-    stage_data.addChild(oneways);
+  stage_data.addChild("body", body);
+  if (body_version == BODY_RLE) {
+    stage_data.addChild("body_version", int(BODY_RLE));
   }
 
-  stage_data.addChild(jsonArrayFromColor("color", stage.color)["color"]);
-  stage_data.addChild(jsonArrayFromColor("bg_color", stage.bg_color)["bg_color"]);
+  SpecialWriter writer = { stage, stage_data };
+  forEachCubeType(writer);
+}
+
+// 色や速度などのステージ全体の値を書く
+void writeParams(const Stage& stage, JsonWriter::Value& stage_data) {
+  stage_data.addChild("color", jsonArrayFromColor(stage.color));
+  stage_data.addChild("bg_color", jsonArrayFromColor(stage.bg_color));
     
-  stage_data.addChild(ci::JsonTree("x_offset", stage.x_offset))
-    .addChild(ci::JsonTree("pickable", stage.pickable));
+  stage_data.addChild("x_offset", stage.x_offset)
+    .addChild("pickable", stage.pickable);
 
   if (stage.build_speed > 0.0f) {
-    stage_data.addChild(ci::JsonTree("build_speed", stage.build_speed));
+    stage_data.addChild("build_speed", stage.build_speed);
   }
   if (stage.collapse_speed > 0.0f) {
-    stage_data.addChild(ci::JsonTree("collapse_speed", stage.collapse_speed));
+    stage_data.addChild("collapse_speed", stage.collapse_speed);
   }
   if (stage.auto_collapse > 0.0f) {
-    stage_data.addChild(ci::JsonTree("auto_collapse", stage.auto_collapse));
+    stage_data.addChild("auto_collapse", stage.auto_collapse);
   }
-  stage_data.addChild(ci::JsonTree("camera", stage.camera));
-  stage_data.addChild(ci::JsonTree("light_tween", stage.light_tween));
+  stage_data.addChild("camera", stage.camera);
+  stage_data.addChild("light_tween", stage.light_tween);
+}
+
+// JSONの文字列にする
+std::string write(const Stage& stage, const int body_version = BODY_PLAIN) {
+  auto stage_data = JsonWriter::Value::makeObject();
+  writeBody(stage, stage_data, body_version);
+  writeParams(stage, stage_data);
     
-  stage_data.write(path);
+  return stage_data.write();
+}
+
+// 書き終えてから置き換える(失敗したら例外で、元のファイルはそのまま)
+void serialize(const Stage& stage, const std::string& path, const int body_version = BODY_PLAIN) {
+  auto text = write(stage, body_version);
+  FileUtil::writeAtomic(path, [&text](std::ostream& file) { file << text; }, std::ios::out);
 }
 
 }
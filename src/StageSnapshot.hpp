@@ -0,0 +1,176 @@
+﻿#pragma once
+
+//
+// 編集中のステージの読み取り専用の写し
+// 別スレッドで保存・サムネイル・検査などをする時に、編集を止めずに一貫した内容を渡す
+//
+//   StageSnapshots snapshots;
+//   snapshots.markCell(pos);                    // 編集したら印を付ける
+//   auto snapshot = snapshots.take(stage);      // メインスレッドで取る
+//   std::async(..., [snapshot]() { auto copy = snapshot->toStage(); ... });
+//
+// TIPS:行ごとにshared_ptrで持ち、変わっていない行は前の写しと共有する
+//      編集した行だけを写すので、何も変わっていなければ同じ写しを返す
+//      写しは作った後に書き換えないので、どのスレッドから読んでもよい
+//      変わった時は行の表(shared_ptrの配列)を作り直すので、行の数に比例する手間はかかる
+//      (Stage自身は行をそのまま持つので、編集の印を付け忘れると古い写しが返る。
+//       大きさの変化だけはtakeが自分で気付く)
+//
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+#include "Stage.hpp"
+
+
+namespace ngs {
+
+class StageSnapshot : private boost::noncopyable {
+public:
+  using Row = std::vector<Stage::Cube>;
+  using RowRef = std::shared_ptr<const Row>;
+
+
+  StageSnapshot(const Stage& params, std::vector<RowRef>&& rows, const size_t version) :
+    rows_(std::move(rows)),
+    version_(version)
+  {
+    params_.copyParams(params);
+    params_.size = params.size;
+  }
+
+
+  const Stage::Cube* getCube(const ci::Vec2i& pos) const {
+    if ((pos.y < 0) || (pos.y >= int(rows_.size()))) return nullptr;
+
+    const auto& row = *rows_[pos.y];
+    if ((pos.x < 0) || (pos.x >= int(row.size()))) return nullptr;
+
+    return &row[pos.x];
+  }
+
+  const std::vector<RowRef>& getRows() const {
+    return rows_;
+  }
+
+  // 色や速度などの値と大きさ(bodyは空)
+  const Stage& getParams() const {
+    return params_;
+  }
+
+  // 写しを取るたびに増える(同じ番号なら同じ内容)
+  size_t getVersion() const {
+    return version_;
+  }
+
+  // 編集できるStageに戻す
+  // TIPS:全ての行を写すので、メインスレッドではなく読む側のスレッドで呼ぶ
+  Stage toStage() const {
+    Stage stage;
+    stage.copyParams(params_);
+    stage.size = params_.size;
+
+    stage.body.reserve(rows_.size());
+    for (const auto& row : rows_) {
+      stage.body.push_back(*row);
+    }
+    stage.updateSpecialCubes();
+
+    return stage;
+  }
+
+
+private:
+  Stage params_;
+  std::vector<RowRef> rows_;
+  size_t version_;
+
+};
+
+
+// 編集の印から写しを作る
+class StageSnapshots : private boost::noncopyable {
+public:
+  StageSnapshots() :
+    full_(true),
+    params_dirty_(false),
+    version_(0),
+    num_copied_(0)
+  {}
+
+
+  // 全ての行を写し直す(読み込み・全消去・行や列の挿入など)
+  void invalidate() {
+    full_ = true;
+  }
+
+  void markCell(const ci::Vec2i& pos) {
+    dirty_rows_.push_back(pos.y);
+  }
+
+  void markParams() {
+    params_dirty_ = true;
+  }
+
+  // stageの今の内容の写し
+  std::shared_ptr<const StageSnapshot> take(const Stage& stage) {
+    num_copied_ = 0;
+    if (!snapshot_
+        || (snapshot_->getRows().size() != stage.body.size())
+        || (snapshot_->getParams().size != stage.size)) {
+      full_ = true;
+    }
+    if (snapshot_ && !full_ && !params_dirty_ && dirty_rows_.empty()) return snapshot_;
+
+    std::vector<StageSnapshot::RowRef> rows;
+    if (full_) {
+      rows.reserve(stage.body.size());
+      for (const auto& row : stage.body) {
+        rows.push_back(std::make_shared<const StageSnapshot::Row>(row));
+      }
+      num_copied_ = rows.size();
+    }
+    else {
+      rows = snapshot_->getRows();
+
+      // 同じ行を何度も編集していても1回だけ写す
+      std::sort(dirty_rows_.begin(), dirty_rows_.end());
+      dirty_rows_.erase(std::unique(dirty_rows_.begin(), dirty_rows_.end()), dirty_rows_.end());
+      for (auto z : dirty_rows_) {
+        if ((z < 0) || (z >= int(rows.size()))) continue;
+
+        rows[z] = std::make_shared<const StageSnapshot::Row>(stage.body[z]);
+        num_copied_ += 1;
+      }
+    }
+
+    version_ += 1;
+    snapshot_ = std::make_shared<const StageSnapshot>(stage, std::move(rows), version_);
+
+    full_ = false;
+    params_dirty_ = false;
+    dirty_rows_.clear();
+
+    return snapshot_;
+  }
+
+  // 直前のtakeで写した行の数
+  size_t getNumCopied() const {
+    return num_copied_;
+  }
+
+
+private:
+  std::shared_ptr<const StageSnapshot> snapshot_;
+
+  bool full_;
+  bool params_dirty_;
+  std::vector<int> dirty_rows_;
+
+  size_t version_;
+  size_t num_copied_;
+
+};
+
+}
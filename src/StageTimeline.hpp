@@ -0,0 +1,218 @@
+﻿#pragma once
+
+//
+// movingとfallingの動きをキーフレームの列にしておき、時刻tの位置を引く
+//
+//   moving  patternはテンキーの向き(8:奥 2:手前 4:左 6:右 0:止まる)を1歩ずつ繰り返す
+//           同じ向きが続く所は1区間にまとめる
+//   falling delay秒まで上で待ち、interval秒かけて元の位置へ落ちる
+//
+// TIPS:キーフレームは時刻順なので二分探索で引く(キューブが多くても1つあたりlog)
+//      キューブの値が変わった時だけ作り直す
+//
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <boost/noncopyable.hpp>
+#include "Stage.hpp"
+#include "NumberFormat.hpp"
+
+
+namespace ngs {
+
+class StageTimeline : private boost::noncopyable {
+public:
+  struct Keyframe {
+    float time;
+    // x, zはセルの位置。yは高さ
+    ci::Vec3f pos;
+  };
+
+  struct Track {
+    int type;
+    ci::Vec2i cell;
+
+    // 作った時の値(変わっていなければ作り直さない)
+    int height;
+    std::string pattern;
+    float interval;
+    float delay;
+
+    std::vector<Keyframe> keys;
+    // 繰り返す長さ(0なら繰り返さない)と、1周でずれる量
+    float period;
+    ci::Vec3f shift;
+  };
+
+
+  StageTimeline() :
+    step_(0.0f)
+  {}
+
+
+  // ステージの変更に合わせて作り直す
+  // stepはmovingの1歩の秒数。作り直したトラックの数を返す
+  size_t update(const Stage& stage, const float step) {
+    if (step != step_) {
+      moving_.clear();
+      falling_.clear();
+      step_ = step;
+    }
+
+    size_t num = updateTracks(stage, Stage::Cube::MOVING, moving_);
+    num += updateTracks(stage, Stage::Cube::FALLING, falling_);
+    return num;
+  }
+
+  const std::vector<Track>& getMoving() const {
+    return moving_;
+  }
+
+  const std::vector<Track>& getFalling() const {
+    return falling_;
+  }
+
+
+  // 時刻tの位置
+  static ci::Vec3f evaluate(const Track& track, float t) {
+    const auto& keys = track.keys;
+    if ((keys.size() == 1) || (t <= keys.front().time)) return keys.front().pos;
+
+    ci::Vec3f shift = ci::Vec3f::zero();
+    if (track.period > 0.0f) {
+      float cycle = std::floor(t / track.period);
+      t -= cycle * track.period;
+      shift = track.shift * cycle;
+    }
+
+    auto it = std::upper_bound(keys.begin(), keys.end(), t, [](const float time, const Keyframe& key) {
+        return time < key.time;
+      });
+    if (it == keys.end()) return keys.back().pos + shift;
+
+    const auto& next = *it;
+    const auto& prev = *(it - 1);
+    float rate = (t - prev.time) / (next.time - prev.time);
+    return prev.pos.lerp(rate, next.pos) + shift;
+  }
+
+  // patternの1歩分の移動(x, z)
+  // TIPS:エディタの表示(180度回転)でゲームと同じ向きになるよう、左は+x
+  static ci::Vec3f getStepDirection(const int value) {
+    switch (value) {
+    case 8: return ci::Vec3f(0, 0, 1);
+    case 2: return ci::Vec3f(0, 0, -1);
+    case 4: return ci::Vec3f(1, 0, 0);
+    case 6: return ci::Vec3f(-1, 0, 0);
+    }
+    return ci::Vec3f::zero();
+  }
+
+  // fallingが落ち始める高さ(キューブの高さからの差)
+  static float getFallHeight() {
+    return 4.0f;
+  }
+
+
+private:
+  float step_;
+  std::vector<Track> moving_;
+  std::vector<Track> falling_;
+
+
+  static bool isSame(const Track& track, const Stage::Cube& cube) {
+    return (track.height == cube.pos.y)
+      && (track.pattern == cube.pattern)
+      && (track.interval == cube.interval)
+      && (track.delay == cube.delay);
+  }
+
+  // special_cubesと同じ並びで作るので、前回のトラックは二分探索で見つかる
+  size_t updateTracks(const Stage& stage, const int type, std::vector<Track>& tracks) const {
+    size_t num = 0;
+
+    std::vector<Track> new_tracks;
+    for (const auto& cell : stage.getSpecialCubes(type)) {
+      const auto& cube = stage.body[cell.y][cell.x];
+
+      auto it = std::lower_bound(tracks.begin(), tracks.end(), cell, [](const Track& track, const ci::Vec2i& pos) {
+          return Stage::lessPosition(track.cell, pos);
+        });
+      if ((it != tracks.end()) && (it->cell == cell) && isSame(*it, cube)) {
+        new_tracks.push_back(std::move(*it));
+        continue;
+      }
+
+      new_tracks.push_back((type == Stage::Cube::MOVING) ? makeMoving(cube) : makeFalling(cube));
+      num += 1;
+    }
+    tracks = std::move(new_tracks);
+
+    return num;
+  }
+
+  Track makeTrack(const Stage::Cube& cube) const {
+    Track track;
+    track.type     = cube.type;
+    track.cell     = ci::Vec2i(cube.pos.x, cube.pos.z);
+    track.height   = cube.pos.y;
+    track.pattern  = cube.pattern;
+    track.interval = cube.interval;
+    track.delay    = cube.delay;
+    track.period   = 0.0f;
+    track.shift    = ci::Vec3f::zero();
+    return track;
+  }
+
+  Track makeMoving(const Stage::Cube& cube) const {
+    auto track = makeTrack(cube);
+
+    ci::Vec3f pos(cube.pos);
+    float time = 0.0f;
+    Keyframe start = { time, pos };
+    track.keys.push_back(start);
+
+    // 向きが変わる所にだけキーフレームを置く
+    auto pattern = NumberFormat::parseIntList(cube.pattern);
+    for (size_t i = 0; i < pattern.size(); ++i) {
+      auto direction = getStepDirection(pattern[i]);
+      if ((i > 0) && (direction != getStepDirection(pattern[i - 1]))) {
+        Keyframe key = { time, pos };
+        track.keys.push_back(key);
+      }
+      pos  += direction;
+      time += step_;
+    }
+
+    if (time > 0.0f) {
+      Keyframe end = { time, pos };
+      track.keys.push_back(end);
+
+      track.period = time;
+      track.shift  = pos - start.pos;
+    }
+    return track;
+  }
+
+  Track makeFalling(const Stage::Cube& cube) const {
+    auto track = makeTrack(cube);
+
+    ci::Vec3f pos(cube.pos);
+    ci::Vec3f top = pos + ci::Vec3f(0, getFallHeight(), 0);
+    float delay    = std::max(cube.delay, 0.0f);
+    float interval = std::max(cube.interval, 0.0f);
+
+    Keyframe keys[] = {
+      { 0.0f, top },
+      { delay, top },
+      { delay + interval, pos },
+    };
+    track.keys.assign(std::begin(keys), std::end(keys));
+    return track;
+  }
+
+};
+
+}
@@ -0,0 +1,222 @@
+﻿#pragma once
+
+//
+// ステージの一括変形
+// "offset=2;mirror;pad=4" のような操作列を読んで順番に適用する
+//
+//   offset=n         x_offsetをnずらす
+//   mirror           左右反転(moving/oneway/switchの向きと座標も直す)
+//   pad=n            奥にn行足す
+//   insert_row=z     z行目の手前に1行挿入する
+//   delete_row=z     z行目を削除する
+//   insert_column=x  x列目の手前に1列挿入する
+//   delete_column=x  x列目を削除する
+//   color=r,g,b      色を変える
+//   bg_color=r,g,b   背景色を変える
+//   convert=a:b      種類aのキューブを種類bにする(none item moving switch falling oneway)
+//
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include "Stage.hpp"
+#include "StageDiff.hpp"
+#include "CubeTraits.hpp"
+#include "NumberFormat.hpp"
+
+
+namespace ngs {
+namespace StageTransform {
+
+using Operation = std::function<void (Stage&)>;
+
+
+int parseType(const std::string& name) {
+  if (name == "none") return Stage::Cube::NONE;
+
+  for (const auto& info : getCubeTypeInfo()) {
+    if (info.name == name) return info.type;
+  }
+  throw std::invalid_argument("unknown cube type: " + name);
+}
+
+int parseInt(const std::string& text) {
+  int value;
+  if (!NumberFormat::fromString(text, value)) throw std::invalid_argument("not a number: " + text);
+  return value;
+}
+
+ci::Color parseColor(const std::string& text) {
+  std::vector<float> values;
+  size_t first = 0;
+  while (true) {
+    auto last = text.find(',', first);
+    float value;
+    if (!NumberFormat::fromString(text.substr(first, last - first), value)) {
+      throw std::invalid_argument("not a color: " + text);
+    }
+    values.push_back(value);
+    if (last == std::string::npos) break;
+    first = last + 1;
+  }
+  if (values.size() != 3) throw std::invalid_argument("not a color: " + text);
+
+  return ci::Color(values[0], values[1], values[2]);
+}
+
+
+void mirror(Stage& stage) {
+  const int width = stage.size.x;
+
+  for (size_t z = 0; z < stage.body.size(); ++z) {
+    auto& row = stage.body[z];
+
+    // 短い行は穴で埋めてから反転する(位置とbodyの添字を揃えるため)
+    while (int(row.size()) < width) {
+      Stage::Cube hole(ci::Vec3f(row.size(), -1, z));
+      row.push_back(hole);
+    }
+    std::reverse(row.begin(), row.end());
+
+    for (auto& cube : row) {
+      cube.pos.x = width - 1 - cube.pos.x;
+
+      // 左右の向き
+      if (cube.type & Stage::Cube::MOVING) {
+        auto pattern = NumberFormat::parseIntList(cube.pattern);
+        for (auto& p : pattern) {
+          if (p == 4)      p = 6;
+          else if (p == 6) p = 4;
+        }
+        cube.pattern = NumberFormat::joinIntList(pattern);
+      }
+      if (cube.type & Stage::Cube::ONEWAY) {
+        if (cube.direction == "left")       cube.direction = "right";
+        else if (cube.direction == "right") cube.direction = "left";
+      }
+      if (cube.type & Stage::Cube::SWITCH) {
+        for (auto& target : cube.target) {
+          auto pos = NumberFormat::parseIntList(target);
+          if (!pos.empty()) pos[0] = width - 1 - pos[0];
+          target = NumberFormat::joinIntList(pos);
+        }
+      }
+    }
+  }
+  stage.updateSpecialCubes();
+}
+
+void convert(Stage& stage, const int from, const int to) {
+  for (auto& row : stage.body) {
+    for (auto& cube : row) {
+      if (cube.type != from) continue;
+
+      // TIPS:エディタで種類を切り替えた時と同じく付随データは空にする
+      cube.cleanup();
+      cube.type = to;
+    }
+  }
+  stage.updateSpecialCubes();
+}
+
+
+Operation parseOperation(const std::string& text) {
+  auto pos = text.find('=');
+  auto name  = text.substr(0, pos);
+  auto value = (pos == std::string::npos) ? std::string() : text.substr(pos + 1);
+
+  if (name == "offset") {
+    int offset = parseInt(value);
+    return [offset](Stage& stage) {
+      stage.x_offset += offset;
+    };
+  }
+  if (name == "mirror") {
+    return mirror;
+  }
+  if (name == "pad") {
+    int rows = parseInt(value);
+    if (rows < 0) throw std::invalid_argument("pad must be positive: " + value);
+    return [rows](Stage& stage) {
+      stage.size.y += rows;
+      stage.resize();
+    };
+  }
+  if (name == "insert_row") {
+    int z = parseInt(value);
+    return [z](Stage& stage) {
+      stage.insertRow(z);
+    };
+  }
+  if (name == "delete_row") {
+    int z = parseInt(value);
+    return [z](Stage& stage) {
+      stage.deleteRow(z);
+    };
+  }
+  if (name == "insert_column") {
+    int x = parseInt(value);
+    return [x](Stage& stage) {
+      stage.insertColumn(x);
+    };
+  }
+  if (name == "delete_column") {
+    int x = parseInt(value);
+    return [x](Stage& stage) {
+      stage.deleteColumn(x);
+    };
+  }
+  if (name == "color") {
+    auto color = parseColor(value);
+    return [color](Stage& stage) {
+      stage.color = color;
+    };
+  }
+  if (name == "bg_color") {
+    auto color = parseColor(value);
+    return [color](Stage& stage) {
+      stage.bg_color = color;
+    };
+  }
+  if (name == "convert") {
+    auto separator = value.find(':');
+    if (separator == std::string::npos) throw std::invalid_argument("convert=from:to");
+    int from = parseType(value.substr(0, separator));
+    int to   = parseType(value.substr(separator + 1));
+    return [from, to](Stage& stage) {
+      convert(stage, from, to);
+    };
+  }
+
+  throw std::invalid_argument("unknown operation: " + text);
+}
+
+// ';'区切りの操作列を読む
+// TIPS:全ての操作を読めてからファイルに触るため、先に全部解釈しておく
+std::vector<Operation> parse(const std::string& text) {
+  std::vector<Operation> operations;
+
+  size_t first = 0;
+  while (first <= text.size()) {
+    auto last = text.find(';', first);
+    auto op = text.substr(first, last - first);
+    if (!op.empty()) operations.push_back(parseOperation(op));
+
+    if (last == std::string::npos) break;
+    first = last + 1;
+  }
+
+  return operations;
+}
+
+void apply(const std::vector<Operation>& operations, Stage& stage) {
+  for (const auto& op : operations) {
+    op(stage);
+  }
+  stage.validate();
+}
+
+}
+}
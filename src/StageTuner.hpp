@@ -0,0 +1,368 @@
+﻿#pragma once
+
+//
+// build_speed collapse_speed auto_collapseの調整
+// 行が組み上がって崩れていく様子とプレイヤーの進み方を単純なモデルで計算し、
+// 値の組み合わせを総当たりして目標に一番近いものを選ぶ
+//
+//   "margin=2.5;pace=0.55;build_speed=0.4:0.7:0.01;walk=0.3"
+//
+//   walk climb         1セル進む秒数と、1段上る時に足す秒数
+//   margin             行が崩れるまでに次の行へ移る余裕の目標(秒)
+//   pace               1行あたりの所要時間の目標(秒)
+//   build_speed collapse_speed auto_collapse   調べる範囲(min:max:step)
+//
+// モデル:
+//   z行目はz * build_speed秒に組み上がり、auto_collapse + z * collapse_speed秒に崩れる
+//   プレイヤーは穴を避けた最短経路を歩き、組み上がっていない行の手前では待つ
+//   余裕はz行目が崩れる時刻から、z+1行目に着く時刻を引いたもの
+//   一番少ない余裕と1行あたりの所要時間を、それぞれの目標と比べて採点する
+//
+// TIPS:特殊なキューブは普通の床として扱う(動きや仕掛けは見ない)
+//      スイッチで高さが変わるセルだけは、どの高さからでも歩けるものとする
+//      最短経路は値によらないので、ステージごとに1回だけ求める
+//      同点なら今の値に近い方、次に組み合わせの番号が小さい方を優先するので、結果はスレッドの数によらない
+//
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#include "Stage.hpp"
+#include "NumberFormat.hpp"
+
+
+namespace ngs {
+namespace StageTuner {
+
+struct Range {
+  float min;
+  float max;
+  float step;
+};
+
+struct Params {
+  float walk;
+  float climb;
+
+  // 負なら較正用のステージから決める
+  float margin;
+  float pace;
+
+  Range build_speed;
+  Range collapse_speed;
+  Range auto_collapse;
+
+  Params() :
+    walk(0.3f),
+    climb(0.1f),
+    margin(-1.0f),
+    pace(-1.0f)
+  {
+    Range build    = { 0.3f, 0.8f, 0.01f };
+    Range collapse = { 0.3f, 1.0f, 0.01f };
+    Range start    = { 2.0f, 10.0f, 0.1f };
+    build_speed    = build;
+    collapse_speed = collapse;
+    auto_collapse  = start;
+  }
+};
+
+// 1つの値の組み合わせで動かした結果
+struct Result {
+  float build_speed;
+  float collapse_speed;
+  float auto_collapse;
+
+  float min_margin;
+  // 余裕が一番少ない行
+  int tight_row;
+  // 最後の行に着くまでの秒数と、1行あたりの秒数
+  float duration;
+  float pace;
+  float score;
+};
+
+// 手前の行からそれぞれの行まで歩く秒数(最短経路)
+using Route = std::vector<float>;
+
+
+Range parseRange(const std::string& name, const std::string& text, const float default_step) {
+  std::vector<float> values;
+  size_t first = 0;
+  while (true) {
+    auto last = text.find(':', first);
+    values.push_back(NumberFormat::parseValue<float>(name, text.substr(first, last - first)));
+    if (last == std::string::npos) break;
+    first = last + 1;
+  }
+  if (values.size() > 3) throw std::invalid_argument(name + ": min:max:step " + text);
+
+  Range range = { values[0], (values.size() > 1) ? values[1] : values[0], (values.size() > 2) ? values[2] : default_step };
+  if ((range.min <= 0.0f) || (range.max < range.min) || (range.step <= 0.0f)) {
+    throw std::invalid_argument(name + ": bad range " + text);
+  }
+  return range;
+}
+
+// 知らない項目名ならfalse
+bool parseParam(const std::string& name, const std::string& value, Params& params) {
+  if (name == "walk")   { params.walk   = NumberFormat::parseValue<float>(name, value); return true; }
+  if (name == "climb")  { params.climb  = NumberFormat::parseValue<float>(name, value); return true; }
+  if (name == "margin") { params.margin = NumberFormat::parseValue<float>(name, value); return true; }
+  if (name == "pace")   { params.pace   = NumberFormat::parseValue<float>(name, value); return true; }
+
+  if (name == "build_speed")    { params.build_speed    = parseRange(name, value, params.build_speed.step); return true; }
+  if (name == "collapse_speed") { params.collapse_speed = parseRange(name, value, params.collapse_speed.step); return true; }
+  if (name == "auto_collapse")  { params.auto_collapse  = parseRange(name, value, params.auto_collapse.step); return true; }
+
+  return false;
+}
+
+// ';'区切りの条件を読む(書かなかった項目は元の値のまま)
+Params parse(const std::string& text, Params params = Params()) {
+  NumberFormat::parseParams(text, [&params](const std::string& name, const std::string& value) {
+      return parseParam(name, value, params);
+    });
+
+  if (params.walk <= 0.0f) throw std::invalid_argument("walk must be positive");
+  if (params.climb < 0.0f) throw std::invalid_argument("climb must not be negative");
+
+  return params;
+}
+
+
+// 3つの値がどれも設定されているステージだけを扱う
+// TIPS:startlineやfinishlineのように崩れないステージは0になっている
+bool isTunable(const Stage& stage) {
+  return (stage.build_speed > 0.0f) && (stage.collapse_speed > 0.0f) && (stage.auto_collapse > 0.0f);
+}
+
+// 高さの差が1までのセルへ歩けるものとして、手前の行からの最短の秒数を求める
+// たどり着けない行があればエラー
+Route findRoute(const Stage& stage, const Params& params) {
+  const int width  = stage.size.x;
+  const int length = stage.size.y;
+
+  auto height = [&stage](const int x, const int z) {
+    const auto* cube = stage.getCube(ci::Vec3i(x, 0, z));
+    return cube ? cube->pos.y : -1;
+  };
+
+  std::vector<char> switched(width * length, 0);
+  for (const auto& cell : stage.getSpecialCubes(Stage::Cube::SWITCH)) {
+    for (const auto& target : stage.body[cell.y][cell.x].target) {
+      auto values = NumberFormat::parseIntList(target);
+      if (values.size() < 3) continue;
+      if ((values[0] < 0) || (values[0] >= width) || (values[2] < 0) || (values[2] >= length)) continue;
+
+      switched[values[2] * width + values[0]] = 1;
+    }
+  }
+
+  using Node = std::pair<float, int>;
+  std::priority_queue<Node, std::vector<Node>, std::greater<Node> > queue;
+  std::vector<float> times(width * length, std::numeric_limits<float>::max());
+  for (int x = 0; x < width; ++x) {
+    if (height(x, 0) < 0) continue;
+
+    times[x] = 0.0f;
+    queue.push(Node(0.0f, x));
+  }
+
+  const ci::Vec2i offsets[] = { ci::Vec2i(1, 0), ci::Vec2i(-1, 0), ci::Vec2i(0, 1), ci::Vec2i(0, -1) };
+  while (!queue.empty()) {
+    auto node = queue.top();
+    queue.pop();
+    if (node.first > times[node.second]) continue;
+
+    const ci::Vec2i pos(node.second % width, node.second / width);
+    const int h = height(pos.x, pos.y);
+    for (const auto& offset : offsets) {
+      const auto next = pos + offset;
+      if ((next.x < 0) || (next.x >= width) || (next.y < 0) || (next.y >= length)) continue;
+
+      const int next_h = height(next.x, next.y);
+      if (next_h < 0) continue;
+
+      int index = next.y * width + next.x;
+      if ((std::abs(next_h - h) > 1) && !switched[index] && !switched[node.second]) continue;
+
+      float time = node.first + params.walk + ((next_h > h) ? params.climb : 0.0f);
+      if (time >= times[index]) continue;
+
+      times[index] = time;
+      queue.push(Node(time, index));
+    }
+  }
+
+  Route route(length, std::numeric_limits<float>::max());
+  for (int z = 0; z < length; ++z) {
+    for (int x = 0; x < width; ++x) {
+      route[z] = std::min(route[z], times[z * width + x]);
+    }
+    if (route[z] == std::numeric_limits<float>::max()) {
+      throw std::runtime_error("row " + NumberFormat::toString(z) + " is unreachable");
+    }
+  }
+  return route;
+}
+
+// 値の組み合わせ1つを動かして採点する(小さいほど良い)
+// 一番少ない余裕と目標の差に、1行あたりの所要時間と目標の差を足す
+// 余裕が目標より少ない時は、多い時の10倍の重さで数える
+Result simulate(const Route& route, const float build_speed, const float collapse_speed, const float auto_collapse,
+                const float margin, const float pace) {
+  Result result;
+  result.build_speed    = build_speed;
+  result.collapse_speed = collapse_speed;
+  result.auto_collapse  = auto_collapse;
+  result.min_margin     = std::numeric_limits<float>::max();
+  result.tight_row      = 0;
+
+  const int length = int(route.size());
+  float arrive = 0.0f;
+  for (int z = 0; z < length; ++z) {
+    float next = arrive;
+    if ((z + 1) < length) {
+      next = std::max(arrive + route[z + 1] - route[z], (z + 1) * build_speed);
+    }
+
+    float value = auto_collapse + z * collapse_speed - next;
+    if (value < result.min_margin) {
+      result.min_margin = value;
+      result.tight_row  = z;
+    }
+
+    arrive = next;
+  }
+
+  result.duration = arrive;
+  result.pace     = arrive / std::max(length - 1, 1);
+
+  float error = (result.min_margin < margin) ? (margin - result.min_margin) * 10.0f : (result.min_margin - margin);
+  result.score = error + std::abs(result.pace - pace);
+  return result;
+}
+
+// 今の値で動かした結果(較正に使う)
+Result measure(const Stage& stage, const Params& params) {
+  return simulate(findRoute(stage, params), stage.build_speed, stage.collapse_speed, stage.auto_collapse, 0.0f, 0.0f);
+}
+
+size_t getNumSteps(const Range& range) {
+  return size_t(std::floor((range.max - range.min) / range.step + 0.5f)) + 1;
+}
+
+// 比べる時の点数の刻み(これより小さい差は同点とみなす)
+const float SCORE_STEP = 0.001f;
+
+// 比べる順番: 点数 → 今の値からの離れ具合(刻みの数) → 組み合わせの番号
+struct Candidate {
+  Result result;
+  int64_t rank;
+  float change;
+  size_t index;
+};
+
+bool isBetter(const Candidate& a, const Candidate& b) {
+  if (a.rank != b.rank) return a.rank < b.rank;
+  if (a.change != b.change) return a.change < b.change;
+  return a.index < b.index;
+}
+
+// 全ての組み合わせを試して一番良いものを返す
+// TIPS:margin, paceは先に決めておく(負のままだとエラー)
+//      目標に届く組み合わせはいくつもあるので、同点なら今の値に近いものを選ぶ
+Result sweep(const Stage& stage, const Params& params) {
+  if ((params.margin < 0.0f) || (params.pace <= 0.0f)) throw std::invalid_argument("margin and pace are not set");
+
+  const auto route = findRoute(stage, params);
+
+  const size_t num_build    = getNumSteps(params.build_speed);
+  const size_t num_collapse = getNumSteps(params.collapse_speed);
+  const size_t num_start    = getNumSteps(params.auto_collapse);
+  const size_t num = num_build * num_collapse * num_start;
+
+  // build_speedの1段ずつを仕事の単位にする
+  const size_t num_threads = std::min(size_t(std::max(1u, std::thread::hardware_concurrency())), num_build);
+  std::vector<Candidate> bests(num_threads);
+  // TIPS:vector<bool>は複数のスレッドから書けないのでcharで持つ
+  std::vector<char> found(num_threads, 0);
+  std::atomic<size_t> next(0);
+
+  auto getChange = [](const float value, const float current, const Range& range) {
+    return std::abs(value - current) / range.step;
+  };
+
+  auto worker = [&](const size_t thread) {
+    for (size_t b = next++; b < num_build; b = next++) {
+      const float build_speed = params.build_speed.min + b * params.build_speed.step;
+      for (size_t c = 0; c < num_collapse; ++c) {
+        const float collapse_speed = params.collapse_speed.min + c * params.collapse_speed.step;
+        for (size_t a = 0; a < num_start; ++a) {
+          const float auto_collapse = params.auto_collapse.min + a * params.auto_collapse.step;
+
+          Candidate candidate;
+          candidate.result = simulate(route, build_speed, collapse_speed, auto_collapse, params.margin, params.pace);
+          candidate.rank   = int64_t(std::floor(candidate.result.score / SCORE_STEP + 0.5f));
+          candidate.change = getChange(build_speed, stage.build_speed, params.build_speed)
+            + getChange(collapse_speed, stage.collapse_speed, params.collapse_speed)
+            + getChange(auto_collapse, stage.auto_collapse, params.auto_collapse);
+          candidate.index  = (b * num_collapse + c) * num_start + a;
+          if (!found[thread] || isBetter(candidate, bests[thread])) {
+            bests[thread] = candidate;
+            found[thread] = 1;
+          }
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(worker, i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // TIPS:仕事が回ってこなかったスレッドもある
+  size_t best = 0;
+  for (size_t i = 1; i < num_threads; ++i) {
+    if (found[i] && (!found[best] || isBetter(bests[i], bests[best]))) best = i;
+  }
+  return bests[best].result;
+}
+
+// 較正用のステージの今の値から、書かれていない目標を決める(中央値)
+Params calibrate(const std::vector<Result>& results, Params params) {
+  if (results.empty()) throw std::invalid_argument("no stages to calibrate");
+
+  auto median = [](std::vector<float> values) {
+    auto middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    return *middle;
+  };
+
+  std::vector<float> margins;
+  std::vector<float> paces;
+  for (const auto& result : results) {
+    margins.push_back(result.min_margin);
+    paces.push_back(result.pace);
+  }
+
+  if (params.margin < 0.0f) params.margin = std::max(median(margins), 0.0f);
+  if (params.pace <= 0.0f)  params.pace   = median(paces);
+  return params;
+}
+
+}
+}
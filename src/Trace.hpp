@@ -0,0 +1,297 @@
+﻿#pragma once
+
+//
+// 処理の記録(常に有効)
+// スレッドごとのリングバッファに区間の開始・終了や読み書きのバイト数を書き、
+// 必要な時にChromeのトレース形式(chrome://tracing)で書き出す
+//
+//   {
+//     Trace::Scope scope("load", path);
+//     ...
+//   }
+//   Trace::counter("read bytes", size);
+//   Trace::writeChromeJson("trace.json");
+//
+//   // 記録するワーカースレッドは先頭で枠を借り、抜ける時に返す
+//   std::async(..., []() { Trace::ThreadScope thread_scope; ... });
+//
+// TIPS:書き込みはスレッドごとのバッファなのでロックしない
+//      書き出し中に上書きされた分は捨てる(バッファ1周分より古い記録は残らない)
+//      VS2013はthread_localが無いので、スレッドIDのハッシュで空き枠を探して使う
+//      返した枠のバッファは次に借りたスレッドが続きから使う(確保は枠の数まで)
+//
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+
+namespace ngs {
+namespace Trace {
+
+enum {
+  // 記録できるスレッドの数と、1スレッドで残す記録の数
+  MAX_THREADS = 64,
+  BUFFER_SIZE = 4096,
+
+  // 区間に付けるファイル名などの長さ(超えた分は切り捨てる)
+  DETAIL_SIZE = 40,
+};
+
+struct Event {
+  enum Type : char {
+    BEGIN   = 'B',
+    END     = 'E',
+    INSTANT = 'i',
+    COUNTER = 'C',
+  };
+
+  int64_t time;
+  // TIPS:名前は文字列リテラルだけを渡す(ポインタのまま持つ)
+  const char* name;
+  int64_t value;
+  Type type;
+  char detail[DETAIL_SIZE];
+};
+
+struct Buffer {
+  Event events[BUFFER_SIZE];
+  // これまでに書いた数(書くのは持ち主のスレッドだけ)
+  std::atomic<size_t> head;
+};
+
+struct Slot {
+  // スレッドIDのハッシュ(0は空き)
+  // TIPS:書き換えるのは借りたスレッド自身だけ
+  std::atomic<size_t> owner;
+  // 一度確保したら枠を返しても残す
+  std::atomic<Buffer*> buffer;
+};
+
+
+// TIPS:静的初期化より前に使われても大丈夫なよう、ゼロ初期化だけで済む配列にしておく
+Slot slots[MAX_THREADS];
+std::atomic<size_t> dropped;
+const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+
+size_t getThreadId() {
+  size_t id = std::hash<std::thread::id>()(std::this_thread::get_id());
+  return (id == 0) ? 1 : id;
+}
+
+// 呼び出したスレッドが借りている枠
+Slot* findOwnSlot(const size_t id) {
+  for (size_t i = 0; i < MAX_THREADS; ++i) {
+    auto& slot = slots[(id + i) % MAX_THREADS];
+    if (slot.owner.load(std::memory_order_acquire) == id) return &slot;
+  }
+  return nullptr;
+}
+
+// 呼び出したスレッドのバッファ(空き枠が無ければnullptr)
+// 枠にバッファが無い時だけ確保する
+Buffer* findBuffer() {
+  size_t id = getThreadId();
+
+  // TIPS:途中の枠が返されて空いていることがあるので、先に自分の枠を探しきる
+  auto* own = findOwnSlot(id);
+  if (own) return own->buffer.load(std::memory_order_acquire);
+
+  for (size_t i = 0; i < MAX_THREADS; ++i) {
+    auto& slot = slots[(id + i) % MAX_THREADS];
+    size_t empty = 0;
+    if (!slot.owner.compare_exchange_strong(empty, id)) continue;
+
+    auto* buffer = slot.buffer.load(std::memory_order_acquire);
+    if (!buffer) {
+      buffer = new Buffer();
+      buffer->head = 0;
+      slot.buffer.store(buffer, std::memory_order_release);
+    }
+    return buffer;
+  }
+  return nullptr;
+}
+
+// 呼び出したスレッドの枠を空ける(バッファと記録は残す)
+void releaseSlot() {
+  auto* own = findOwnSlot(getThreadId());
+  if (own) own->owner.store(0, std::memory_order_release);
+}
+
+int64_t getTime() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void record(const Event::Type type, const char* name, const int64_t value,
+            const char* detail, const size_t detail_length) {
+  auto* buffer = findBuffer();
+  if (!buffer) {
+    dropped += 1;
+    return;
+  }
+
+  size_t head = buffer->head.load(std::memory_order_relaxed);
+  auto& event = buffer->events[head % BUFFER_SIZE];
+  event.time  = getTime();
+  event.name  = name;
+  event.value = value;
+  event.type  = type;
+
+  size_t length = std::min(detail_length, size_t(DETAIL_SIZE - 1));
+  if (length > 0) std::memcpy(event.detail, detail, length);
+  event.detail[length] = '\0';
+
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+
+void begin(const char* name, const std::string& detail = std::string()) {
+  record(Event::BEGIN, name, 0, detail.data(), detail.size());
+}
+
+void end(const char* name) {
+  record(Event::END, name, 0, nullptr, 0);
+}
+
+void instant(const char* name, const std::string& detail = std::string()) {
+  record(Event::INSTANT, name, 0, detail.data(), detail.size());
+}
+
+// 値の推移(読み書きしたバイト数など)
+void counter(const char* name, const int64_t value) {
+  record(Event::COUNTER, name, value, nullptr, 0);
+}
+
+
+class Scope {
+public:
+  explicit Scope(const char* name, const std::string& detail = std::string()) :
+    name_(name)
+  {
+    begin(name, detail);
+  }
+
+  ~Scope() {
+    end(name_);
+  }
+
+
+private:
+  const char* name_;
+
+  Scope(const Scope&);
+  Scope& operator=(const Scope&);
+
+};
+
+
+// 抜ける時に枠を返す
+// TIPS:記録するワーカースレッドの先頭に置く(Scopeより先に作り、後に壊す)
+class ThreadScope {
+public:
+  ThreadScope() {}
+
+  ~ThreadScope() {
+    releaseSlot();
+  }
+
+
+private:
+  ThreadScope(const ThreadScope&);
+  ThreadScope& operator=(const ThreadScope&);
+
+};
+
+
+// 空き枠が無くて捨てた記録の数
+size_t getNumDropped() {
+  return dropped;
+}
+
+
+std::string escapeJson(const char* text) {
+  std::string result;
+  for (const char* p = text; *p; ++p) {
+    switch (*p) {
+    case '"':  result += "\\\""; break;
+    case '\\': result += "\\\\"; break;
+    case '\n': result += "\\n";  break;
+    case '\t': result += "\\t";  break;
+    default:
+      if (static_cast<unsigned char>(*p) < 0x20) continue;
+      result += *p;
+    }
+  }
+  return result;
+}
+
+// 全スレッドの記録をChromeのトレース形式にする
+// tidは枠の番号(同時に動くスレッドごとに1段になる)
+std::string toChromeJson() {
+  std::ostringstream json;
+  json << "{\"traceEvents\":[";
+
+  bool first = true;
+  for (size_t tid = 0; tid < MAX_THREADS; ++tid) {
+    const auto* buffer = slots[tid].buffer.load(std::memory_order_acquire);
+    if (!buffer) continue;
+
+    size_t head = buffer->head.load(std::memory_order_acquire);
+    size_t begin_index = (head > BUFFER_SIZE) ? head - BUFFER_SIZE : 0;
+
+    std::vector<Event> events;
+    events.reserve(head - begin_index);
+    for (size_t i = begin_index; i < head; ++i) {
+      events.push_back(buffer->events[i % BUFFER_SIZE]);
+      events.back().detail[DETAIL_SIZE - 1] = '\0';
+    }
+
+    // 写している間に持ち主のスレッドが上書きした分(書きかけの1つを含む)を捨てる
+    size_t new_head = buffer->head.load(std::memory_order_acquire);
+    size_t valid_index = ((new_head + 1) > BUFFER_SIZE) ? new_head + 1 - BUFFER_SIZE : 0;
+    size_t skip = (valid_index > begin_index) ? std::min(valid_index - begin_index, events.size()) : 0;
+
+    for (size_t i = skip; i < events.size(); ++i) {
+      const auto& event = events[i];
+
+      json << (first ? "" : ",") << "\n{\"name\":\"" << escapeJson(event.name) << "\""
+           << ",\"ph\":\"" << char(event.type) << "\""
+           << ",\"ts\":" << event.time
+           << ",\"pid\":1,\"tid\":" << tid;
+      if (event.type == Event::COUNTER) {
+        json << ",\"args\":{\"value\":" << event.value << "}";
+      }
+      else if (event.detail[0]) {
+        json << ",\"args\":{\"detail\":\"" << escapeJson(event.detail) << "\"}";
+      }
+      if (event.type == Event::INSTANT) {
+        json << ",\"s\":\"t\"";
+      }
+      json << "}";
+      first = false;
+    }
+  }
+
+  json << "\n]}\n";
+  return json.str();
+}
+
+void writeChromeJson(const std::string& path) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) throw std::runtime_error("Trace: can't write " + path);
+
+  file << toChromeJson();
+}
+
+}
+}
@@ -0,0 +1,856 @@
+﻿
+//
+// ステージデータのコマンドラインツール
+// エディタと同じヘッダを使い、ウインドウやGPU無しで動く
+//
+
+#include "../src/Defines.hpp"
+#include "../src/AllocTrack.hpp"
+#include "../src/Trace.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <algorithm>
+#include "cinder/app/App.h"
+#include "../src/JsonUtil.hpp"
+#include "../src/Stage.hpp"
+#include "../src/StageSerializer.hpp"
+#include "../src/FileUtil.hpp"
+#include "../src/StageDiff.hpp"
+#include "../src/StagePack.hpp"
+#include "../src/StageRasterizer.hpp"
+#include "../src/StageTransform.hpp"
+#include "../src/EditorCore.hpp"
+#include "../src/InputRecord.hpp"
+#include "../src/StageManifest.hpp"
+#include "../src/StageLint.hpp"
+#include "../src/EditorConfig.hpp"
+#include "../src/StageGenerator.hpp"
+#include "../src/StageTuner.hpp"
+#include "../src/StageHeightmap.hpp"
+#include "../src/StageChunks.hpp"
+
+
+namespace ngs {
+namespace StageTool {
+
+using Args = std::vector<std::string>;
+
+struct Command {
+  std::string name;
+  std::string usage;
+  std::function<int (const Args&)> func;
+};
+
+
+// body_versionにはbodyの書き方が入る(書き戻す時に同じ書き方にするため)
+Stage loadStage(const std::string& path, int& body_version) {
+  Trace::Scope trace_scope("load", path);
+
+  boost::system::error_code ec;
+  auto size = boost::filesystem::file_size(path, ec);
+  if (!ec) Trace::counter("read bytes", size);
+
+  auto params = Json::readFromPath(path);
+  body_version = StageSerializer::isRle(params) ? StageSerializer::BODY_RLE : StageSerializer::BODY_PLAIN;
+  return StageSerializer::makeStage(params);
+}
+
+Stage loadStage(const std::string& path) {
+  int body_version;
+  return loadStage(path, body_version);
+}
+
+// 一時ファイルに書いてから置き換える(serializeが行う)
+void writeStage(const Stage& stage, const std::string& path,
+                const int body_version = StageSerializer::BODY_PLAIN) {
+  Trace::Scope trace_scope("save", path);
+
+  StageSerializer::serialize(stage, path, body_version);
+
+  boost::system::error_code ec;
+  auto size = boost::filesystem::file_size(path, ec);
+  if (!ec) Trace::counter("write bytes", size);
+}
+
+
+// 0〜num-1をスレッドに振り分けて実行する
+// funcの出力は完了した順にまとめて表示する
+void parallelFor(const size_t num, const std::function<std::string (size_t)>& func) {
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min(num_threads, num);
+
+  std::atomic<size_t> next(0);
+  std::mutex output_mutex;
+
+  auto worker = [&]() {
+    Trace::ThreadScope thread_scope;
+    for (size_t i = next++; i < num; i = next++) {
+      std::string message;
+      {
+        Trace::Scope trace_scope("item");
+        message = func(i);
+      }
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cout << message << std::flush;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+
+// 差分があれば1を返す(diffコマンドと同じ)
+int diff(const Args& args) {
+  if (args.size() != 2) return -1;
+
+  auto from = loadStage(args[0]);
+  auto to   = loadStage(args[1]);
+
+  auto result = StageDiff::diff(from, to);
+  StageDiff::write(std::cout, result);
+
+  return result.empty() ? 0 : 1;
+}
+
+
+// ステージ名はファイル名(ディレクトリを除く)
+int pack(const Args& args) {
+  if (args.size() < 2) return -1;
+
+  std::vector<std::pair<std::string, Stage> > stages;
+  for (size_t i = 1; i < args.size(); ++i) {
+    auto name = boost::filesystem::path(args[i]).filename().string();
+    stages.push_back(std::make_pair(name, loadStage(args[i])));
+  }
+  StagePack::write(stages, args[0]);
+
+  return 0;
+}
+
+// 索引を表示し、全ステージを展開してチェックサムを確かめる
+int packInfo(const Args& args) {
+  if (args.size() != 1) return -1;
+
+  StagePack::Reader reader(args[0]);
+  int result = 0;
+  const auto& entries = reader.getEntries();
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto& entry = entries[i];
+    std::cout << i << " " << entry.name
+              << " offset " << entry.offset
+              << " size " << entry.size << "/" << entry.raw_size;
+
+    try {
+      auto stage = reader.load(i);
+      std::cout << " " << stage.size.x << "x" << stage.size.y << " ok" << std::endl;
+    }
+    catch (const std::exception& e) {
+      std::cout << " " << e.what() << std::endl;
+      result = 1;
+    }
+  }
+
+  return result;
+}
+
+
+// 全ステージをPNGにする
+// sizeは1セルのピクセル数。ステージ単位でスレッドに振り分ける
+int thumbs(const Args& args) {
+  if (args.size() < 3) return -1;
+
+  boost::filesystem::path out_dir(args[0]);
+  int cell_size = 0;
+  if (!NumberFormat::fromString(args[1], cell_size) || (cell_size < 1)) return -1;
+
+  boost::filesystem::create_directories(out_dir);
+
+  std::atomic<int> result(0);
+  parallelFor(args.size() - 2, [&](const size_t i) {
+      const auto& path = args[i + 2];
+      auto out_path = out_dir / boost::filesystem::path(path).filename().replace_extension(".png");
+
+      try {
+        auto image = StageRasterizer::rasterize(loadStage(path), cell_size);
+        StageRasterizer::writePng(image, out_path.string());
+
+        return out_path.string() + " " + NumberFormat::toString(image.width) + "x" + NumberFormat::toString(image.height) + "\n";
+      }
+      catch (const std::exception& e) {
+        result = 1;
+        return path + ": " + e.what() + "\n";
+      }
+    });
+
+  return result;
+}
+
+
+// 操作列を全ステージに適用する
+// -nなら書き込まずに差分だけ表示する
+int transform(const Args& args) {
+  size_t first = 0;
+  bool dry_run = false;
+  if (!args.empty() && (args[0] == "-n")) {
+    dry_run = true;
+    first = 1;
+  }
+  if (args.size() < (first + 2)) return -1;
+
+  // TIPS:操作が読めなければどのファイルにも触らない
+  const auto operations = StageTransform::parse(args[first]);
+
+  std::atomic<int> result(0);
+  parallelFor(args.size() - first - 1, [&](const size_t i) {
+      const auto& path = args[first + 1 + i];
+
+      std::ostringstream output;
+      try {
+        int body_version;
+        auto stage = loadStage(path, body_version);
+        auto original = stage;
+        StageTransform::apply(operations, stage);
+
+        auto diff = StageDiff::diff(original, stage);
+        output << path << ": " << diff.cells.size() << " cells " << diff.params.size() << " params"
+               << (dry_run ? " (dry run)" : "") << std::endl;
+        if (dry_run) {
+          StageDiff::write(output, diff);
+        }
+        else if (!diff.empty()) {
+          writeStage(stage, path, body_version);
+        }
+      }
+      catch (const std::exception& e) {
+        output << path << ": " << e.what() << std::endl;
+        result = 1;
+      }
+
+      return output.str();
+    });
+
+  return result;
+}
+
+
+// エディタで記録した入力を全速力で再生し、イベントごとの処理時間を表示する
+// repeat回繰り返した全体から集計する
+int replay(const Args& args) {
+  if ((args.size() < 1) || (args.size() > 2)) return -1;
+
+  int repeat = 1;
+  if ((args.size() == 2) && (!NumberFormat::fromString(args[1], repeat) || (repeat < 1))) return -1;
+
+  const auto recording = InputRecord::read(args[0]);
+  const auto start_stage = StageSerializer::makeStage(ci::JsonTree(recording.stage_text));
+
+  // 種類ごとの処理時間(マイクロ秒)
+  std::map<char, std::vector<double> > times;
+  size_t num_edits = 0;
+  double total = 0.0;
+  EditorCore::Session last(start_stage, recording.view);
+
+  for (int r = 0; r < repeat; ++r) {
+    EditorCore::Session session(start_stage, recording.view);
+    num_edits = 0;
+
+    for (const auto& event : recording.events) {
+      double us;
+      {
+        // TIPS:NGS_ALLOC_TRACK付きでビルドした時はイベント処理中の確保も数える
+        AllocTrack::Scope scope("replay");
+
+        auto begin = std::chrono::steady_clock::now();
+        switch (event.type) {
+        case InputRecord::Event::KEY_DOWN:
+          if (session.keyDown(char(event.chara))) num_edits += 1;
+          break;
+
+        case InputRecord::Event::MOUSE_DOWN:
+          session.mouseDown(event.pos);
+          break;
+
+        case InputRecord::Event::MOUSE_MOVE:
+          session.mouseMove(event.pos);
+          break;
+
+        case InputRecord::Event::MOUSE_DRAG:
+          session.mouseDrag(event.pos);
+          break;
+
+        case InputRecord::Event::MOUSE_WHEEL:
+          session.mouseWheel(event.wheel);
+          break;
+        }
+        us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+      }
+
+      times[char(event.type)].push_back(us);
+      total += us;
+    }
+
+    if (r == (repeat - 1)) last = session;
+  }
+
+  std::cout << recording.stage_file << ": " << recording.events.size() << " events x " << repeat
+            << ", " << num_edits << " edits" << std::endl;
+
+  static const std::pair<char, const char*> names[] = {
+    { InputRecord::Event::KEY_DOWN,   "keyDown" },
+    { InputRecord::Event::MOUSE_DOWN, "mouseDown" },
+    { InputRecord::Event::MOUSE_MOVE, "mouseMove" },
+    { InputRecord::Event::MOUSE_DRAG, "mouseDrag" },
+    { InputRecord::Event::MOUSE_WHEEL, "mouseWheel" },
+  };
+  for (const auto& name : names) {
+    auto& t = times[name.first];
+    if (t.empty()) continue;
+
+    std::sort(t.begin(), t.end());
+    double sum = 0.0;
+    for (auto us : t) sum += us;
+
+    std::cout << "  " << std::left << std::setw(10) << name.second << std::right
+              << std::fixed << std::setprecision(2)
+              << " n " << t.size()
+              << " mean " << sum / t.size()
+              << " p50 " << t[t.size() / 2]
+              << " p95 " << t[std::min(t.size() - 1, t.size() * 95 / 100)]
+              << " max " << t.back()
+              << " us" << std::endl;
+  }
+  std::cout << "  total " << total / repeat << " us per run" << std::endl;
+
+  // 再生結果が記録時の編集と合っているかの目安
+  auto diff = StageDiff::diff(start_stage, last.stage);
+  std::cout << "  result: " << diff.cells.size() << " cells " << diff.params.size() << " params changed" << std::endl;
+
+  if (AllocTrack::isEnabled()) {
+    AllocTrack::write(std::cout, AllocTrack::getResults());
+  }
+
+  return 0;
+}
+
+
+// 目録を更新する(変わったファイルだけ読み直す)
+// 引数に無いステージは目録から外れる
+int manifest(const Args& args) {
+  if (args.size() < 2) return -1;
+
+  StageManifest manifest(args[0]);
+  auto num = manifest.update("", Args(args.begin() + 1, args.end()));
+  manifest.write();
+
+  std::cout << args[0] << ": " << manifest.getEntries().size() << " stages, "
+            << num << " updated" << std::endl;
+  return 0;
+}
+
+// 目録から条件に合うステージを探す(ステージファイルは読まない)
+// 見つからなければ1を返す
+int query(const Args& args) {
+  if (args.size() != 2) return -1;
+
+  const StageManifest manifest(args[0]);
+  auto paths = manifest.search(StageManifest::parseQuery(args[1]));
+  for (const auto& path : paths) {
+    const auto* entry = manifest.find(path);
+    std::cout << path << " " << entry->size.x << "x" << entry->size.y;
+    const auto& infos = getCubeTypeInfo();
+    for (size_t i = 0; i < infos.size(); ++i) {
+      if (entry->count[i] > 0) std::cout << " " << infos[i].name << ":" << entry->count[i];
+    }
+    std::cout << std::endl;
+  }
+
+  return paths.empty() ? 1 : 0;
+}
+
+
+// ステージを検査して、1問題1行のタブ区切りで表示する
+//   <path> <x> <z> <error|warning> <rule> <message>
+// ステージ全体の問題はx, zが-1。読めないファイルはrule "load" のエラーにする
+// -cでparams.jsonを指定すると、エディタと同じ名前の一覧を使う
+// エラーがあれば1を返す(警告だけなら0)
+int lint(const Args& args) {
+  size_t first = 0;
+  StageLint::Names names;
+  if (!args.empty() && (args[0] == "-c")) {
+    if (args.size() < 2) return -1;
+
+    auto config = readEditorConfig(args[1]);
+    names = StageLint::Names(config.lint_camera, config.lint_light_tween, config.lint_direction);
+    first = 2;
+  }
+  if (args.size() <= first) return -1;
+
+  std::atomic<int> result(0);
+  parallelFor(args.size() - first, [&](const size_t i) {
+      const auto& path = args[first + i];
+
+      std::ostringstream output;
+      try {
+        StageLint stage_lint(names);
+        stage_lint.update(loadStage(path));
+        for (const auto& issue : stage_lint.getIssues()) {
+          output << path << "\t" << issue.pos.x << "\t" << issue.pos.y
+                 << "\t" << StageLint::getSeverityName(issue.severity)
+                 << "\t" << issue.rule << "\t" << issue.message << "\n";
+        }
+        if (stage_lint.getNumErrors() > 0) result = 1;
+      }
+      catch (const std::exception& e) {
+        output << path << "\t-1\t-1\terror\tload\t" << e.what() << "\n";
+        result = 1;
+      }
+
+      return output.str();
+    });
+
+  return result;
+}
+
+
+// params.jsonのステージ一覧の最後に書き足す
+// TIPS:手で整形したファイルなので、JSONとして書き直さずに文字列として差し込む
+void addStagesToParams(const std::string& path, const std::vector<std::string>& names) {
+  std::string text;
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("can't read " + path);
+    text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  auto key = text.rfind("\"stage\"");
+  auto open  = (key != std::string::npos) ? text.find('[', key) : std::string::npos;
+  auto close = (open != std::string::npos) ? text.find(']', open) : std::string::npos;
+  if (close == std::string::npos) throw std::runtime_error("no stage list in " + path);
+
+  // 最後の要素の行と同じ字下げで足す
+  auto last = text.rfind('"', close);
+  std::string indent = "      ";
+  std::string newline = (text.find("\r\n") != std::string::npos) ? "\r\n" : "\n";
+  if ((last != std::string::npos) && (last > open)) {
+    auto line_head = text.rfind('\n', last) + 1;
+    indent = text.substr(line_head, text.find('"', line_head) - line_head);
+  }
+  else {
+    last = open;
+  }
+
+  std::string lines;
+  for (const auto& name : names) {
+    lines += ((last == open) && lines.empty()) ? newline : "," + newline;
+    lines += indent + "\"" + name + "\"";
+  }
+  text.insert(last + 1, lines);
+
+  // TIPS:エディタの設定ファイルなので、書けなかった時は置き換えずに例外
+  FileUtil::writeAtomic(path, [&text](std::ostream& file) { file << text; });
+}
+
+// 条件に合うステージを作って <out_prefix>番号.json に書き出す
+// 番号は既にあるファイルと重ならないものを使う
+// -pを付けると書き出したファイルをparams.jsonのステージ一覧に足す(params.jsonと同じディレクトリに書くこと)
+int generate(const Args& args) {
+  size_t first = 0;
+  std::string params_path;
+  if (!args.empty() && (args[0] == "-p")) {
+    if (args.size() < 2) return -1;
+    params_path = args[1];
+    first = 2;
+  }
+  if ((args.size() < (first + 2)) || (args.size() > (first + 3))) return -1;
+
+  const boost::filesystem::path prefix(args[first]);
+  int num = 0;
+  if (!NumberFormat::fromString(args[first + 1], num) || (num < 1)) return -1;
+  const auto params = StageGenerator::parse((args.size() > (first + 2)) ? args[first + 2] : std::string());
+
+  auto out_dir = prefix.parent_path().empty() ? boost::filesystem::path(".") : prefix.parent_path();
+  if (!params_path.empty()) {
+    auto params_dir = boost::filesystem::path(params_path).parent_path();
+    if (params_dir.empty()) params_dir = ".";
+    if (!boost::filesystem::equivalent(out_dir, params_dir)) {
+      throw std::invalid_argument("write stages next to " + params_path);
+    }
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  const size_t max_tries = size_t(num) * 1000;
+  auto result = StageGenerator::generate(params, num, max_tries);
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  std::cout << result.tried << " candidates, " << result.unreachable << " unreachable, "
+            << result.invalid << " invalid, " << result.stages.size() << " accepted in "
+            << std::fixed << std::setprecision(3) << sec << " s ("
+            << std::setprecision(0) << result.tried / std::max(sec, 1e-6) << " candidates/s)" << std::endl;
+
+  std::vector<std::string> names;
+  int number = 1;
+  for (const auto& stage : result.stages) {
+    boost::filesystem::path path;
+    do {
+      std::ostringstream name;
+      name << prefix.filename().string() << std::setw(3) << std::setfill('0') << number++ << ".json";
+      path = out_dir / name.str();
+    } while (boost::filesystem::exists(path));
+
+    writeStage(stage, path.string());
+    names.push_back(path.filename().string());
+    std::cout << path.string() << " " << stage.size.x << "x" << stage.size.y << std::endl;
+  }
+
+  if (!params_path.empty() && !names.empty()) {
+    addStagesToParams(params_path, names);
+    std::cout << params_path << ": " << names.size() << " stages added" << std::endl;
+  }
+
+  return (int(result.stages.size()) == num) ? 0 : 1;
+}
+
+
+std::string formatTuneResult(const StageTuner::Result& result) {
+  std::ostringstream output;
+  output << std::fixed << std::setprecision(2)
+         << "build_speed=" << result.build_speed
+         << " collapse_speed=" << result.collapse_speed
+         << " auto_collapse=" << result.auto_collapse
+         << " margin=" << result.min_margin << "(row " << result.tight_row << ")"
+         << " pace=" << result.pace;
+  return output.str();
+}
+
+// build_speed collapse_speed auto_collapseを総当たりして目標に一番近い値を探す
+// 条件に書かなかったmargin, paceは、渡したステージの今の値から決める(中央値)
+// -wを付けると見つけた値を書き戻す
+int tune(const Args& args) {
+  size_t first = 0;
+  bool write = false;
+  std::string conditions;
+  while ((first < args.size()) && !args[first].empty() && (args[first][0] == '-')) {
+    if (args[first] == "-w") {
+      write = true;
+      first += 1;
+    }
+    else if ((args[first] == "-t") && ((first + 1) < args.size())) {
+      conditions = args[first + 1];
+      first += 2;
+    }
+    else {
+      return -1;
+    }
+  }
+  if (args.size() <= first) return -1;
+
+  auto params = StageTuner::parse(conditions);
+
+  struct Entry {
+    std::string path;
+    Stage stage;
+    int body_version;
+  };
+  std::vector<Entry> entries;
+  std::vector<StageTuner::Result> current;
+  int result = 0;
+  for (size_t i = first; i < args.size(); ++i) {
+    try {
+      Entry entry;
+      entry.path  = args[i];
+      entry.stage = loadStage(entry.path, entry.body_version);
+      if (!StageTuner::isTunable(entry.stage)) {
+        std::cout << entry.path << ": skipped (no collapse)" << std::endl;
+        continue;
+      }
+
+      current.push_back(StageTuner::measure(entry.stage, params));
+      entries.push_back(std::move(entry));
+    }
+    catch (const std::exception& e) {
+      std::cout << args[i] << ": " << e.what() << std::endl;
+      result = 1;
+    }
+  }
+  if (entries.empty()) return 1;
+
+  params = StageTuner::calibrate(current, params);
+  std::cout << "target: margin=" << NumberFormat::toString(params.margin)
+            << " pace=" << NumberFormat::toString(params.pace) << std::endl;
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    auto& entry = entries[i];
+
+    auto begin = std::chrono::steady_clock::now();
+    auto best = StageTuner::sweep(entry.stage, params);
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    size_t num = StageTuner::getNumSteps(params.build_speed) * StageTuner::getNumSteps(params.collapse_speed)
+      * StageTuner::getNumSteps(params.auto_collapse);
+    std::cout << entry.path << " (" << num << " combinations in "
+              << std::fixed << std::setprecision(3) << sec << " s)" << std::endl
+              << "  now:  " << formatTuneResult(current[i]) << std::endl
+              << "  best: " << formatTuneResult(best) << std::endl;
+
+    if (!write) continue;
+
+    auto original = entry.stage;
+    entry.stage.build_speed    = best.build_speed;
+    entry.stage.collapse_speed = best.collapse_speed;
+    entry.stage.auto_collapse  = best.auto_collapse;
+    if (!StageDiff::diff(original, entry.stage).empty()) {
+      writeStage(entry.stage, entry.path, entry.body_version);
+    }
+  }
+
+  return result;
+}
+
+
+// 画像からステージを作って <out_dir>/<画像の名前>.json に書き出す
+// 色や速度などはbase.jsonと同じにする
+int heightmap(const Args& args) {
+  size_t first = 0;
+  std::string conditions;
+  if (!args.empty() && (args[0] == "-t")) {
+    if (args.size() < 2) return -1;
+    conditions = args[1];
+    first = 2;
+  }
+  if (args.size() < (first + 3)) return -1;
+
+  // TIPS:条件が読めなければどの画像も変換しない
+  const auto params = StageHeightmap::parse(conditions);
+  const auto base = loadStage(args[first]);
+  const boost::filesystem::path out_dir(args[first + 1]);
+
+  std::atomic<int> result(0);
+  parallelFor(args.size() - first - 2, [&](const size_t i) {
+      const auto& path = args[first + 2 + i];
+      auto out_path = out_dir / boost::filesystem::path(path).filename().replace_extension(".json");
+
+      std::ostringstream output;
+      try {
+        auto begin = std::chrono::steady_clock::now();
+        auto stage = StageHeightmap::convert(StageHeightmap::readImage(path), params, base);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        size_t holes = 0;
+        for (const auto& row : stage.body) {
+          holes += std::count_if(row.begin(), row.end(), [](const Stage::Cube& cube) { return cube.pos.y < 0; });
+        }
+        size_t specials = 0;
+        for (const auto& cubes : stage.special_cubes) {
+          specials += cubes.size();
+        }
+
+        writeStage(stage, out_path.string());
+        output << out_path.string() << " " << stage.size.x << "x" << stage.size.y
+               << " " << holes << " holes " << specials << " special cubes ("
+               << std::fixed << std::setprecision(3) << sec << " s)" << std::endl;
+      }
+      catch (const std::exception& e) {
+        output << path << ": " << e.what() << std::endl;
+        result = 1;
+      }
+
+      return output.str();
+    });
+
+  return result;
+}
+
+
+// bodyの書き方を変えて書き直す(plain:数値の配列 rle:ランレングス)
+int encode(const Args& args) {
+  if (args.size() < 2) return -1;
+
+  int body_version;
+  if (args[0] == "plain") {
+    body_version = StageSerializer::BODY_PLAIN;
+  }
+  else if (args[0] == "rle") {
+    body_version = StageSerializer::BODY_RLE;
+  }
+  else {
+    return -1;
+  }
+
+  std::atomic<int> result(0);
+  parallelFor(args.size() - 1, [&](const size_t i) {
+      const auto& path = args[i + 1];
+      try {
+        auto from_size = boost::filesystem::file_size(path);
+        writeStage(loadStage(path), path, body_version);
+        auto to_size = boost::filesystem::file_size(path);
+
+        return path + " " + NumberFormat::toString(int(from_size)) + " -> " + NumberFormat::toString(int(to_size)) + " bytes\n";
+      }
+      catch (const std::exception& e) {
+        result = 1;
+        return path + ": " + e.what() + "\n";
+      }
+    });
+
+  return result;
+}
+
+
+// ステージをタイルに分けて<out_dir>に書き出す(エディタで少しずつ読み込んで編集する)
+int chunk(const Args& args) {
+  if ((args.size() < 2) || (args.size() > 3)) return -1;
+
+  int chunk_size = StageChunks::DEFAULT_CHUNK_SIZE;
+  if ((args.size() == 3) && (!NumberFormat::fromString(args[2], chunk_size) || (chunk_size < 1))) return -1;
+
+  auto stage = loadStage(args[0]);
+  size_t num = StageChunks::create(stage, args[1], chunk_size);
+
+  std::cout << args[1] << " " << stage.size.x << "x" << stage.size.y
+            << " chunk " << chunk_size << " " << num << " files" << std::endl;
+  return 0;
+}
+
+// タイルに分けたステージを1つのファイルに戻す
+int unchunk(const Args& args) {
+  if (args.size() != 2) return -1;
+
+  StageChunks chunks(args[0], 0);
+  writeStage(chunks.toStage(), args[1]);
+  return 0;
+}
+
+
+// 読み込み・書き出し・描画(CPU)のメモリ確保を数える
+// TIPS:区間はメインスレッドだけで数えるので、スレッドに振り分けずに順番に処理する
+int alloc(const Args& args) {
+  if (args.empty()) return -1;
+
+  for (const auto& path : args) {
+    std::string text;
+    {
+      std::ifstream file(path, std::ios::binary);
+      if (!file) throw std::runtime_error("can't read " + path);
+      text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    Stage stage;
+    {
+      AllocTrack::Scope scope("load");
+      stage = StageSerializer::makeStage(ci::JsonTree(text));
+    }
+    {
+      AllocTrack::Scope scope("save");
+      StageSerializer::write(stage);
+    }
+    {
+      AllocTrack::Scope scope("rasterize");
+      StageRasterizer::rasterize(stage, 4);
+    }
+  }
+
+  AllocTrack::write(std::cout, AllocTrack::getResults());
+  return 0;
+}
+
+
+const std::vector<Command>& getCommands() {
+  static const std::vector<Command> commands = {
+    { "diff", "diff <from.json> <to.json>", diff },
+    { "pack", "pack <out.pack> <stage.json>...", pack },
+    { "packinfo", "packinfo <in.pack>", packInfo },
+    { "thumbs", "thumbs <out_dir> <cell_pixels> <stage.json>...", thumbs },
+    { "transform", "transform [-n] <op;op...> <stage.json>...", transform },
+    { "replay", "replay <in.rec> [repeat]", replay },
+    { "alloc", "alloc <stage.json>...", alloc },
+    { "manifest", "manifest <manifest.txt> <stage.json>...", manifest },
+    { "query", "query <manifest.txt> <cond;cond...>", query },
+    { "lint", "lint [-c params.json] <stage.json>...", lint },
+    { "generate", "generate [-p params.json] <out_prefix> <count> [cond;cond...]", generate },
+    { "tune", "tune [-w] [-t cond;cond...] <stage.json>...", tune },
+    { "heightmap", "heightmap [-t cond;cond...] <base.json> <out_dir> <image>...", heightmap },
+    { "encode", "encode <plain|rle> <stage.json>...", encode },
+    { "chunk", "chunk <stage.json> <out_dir> [chunk_size]", chunk },
+    { "unchunk", "unchunk <chunk_dir> <out.json>", unchunk },
+  };
+
+  return commands;
+}
+
+void printUsage() {
+  std::cerr << "usage: StageTool [-t trace.json] <command> [args...]" << std::endl;
+  for (const auto& command : getCommands()) {
+    std::cerr << "  " << command.usage << std::endl;
+  }
+}
+
+}
+}
+
+
+int main(int argc, char* argv[]) {
+  using namespace ngs;
+  using namespace ngs::StageTool;
+
+  // -tを付けると終わった時にChromeのトレース形式で処理の記録を書き出す
+  int first = 1;
+  std::string trace_path;
+  if ((argc > 2) && (std::string(argv[1]) == "-t")) {
+    trace_path = argv[2];
+    first = 3;
+  }
+
+  if (argc <= first) {
+    printUsage();
+    return 2;
+  }
+
+  std::string name(argv[first]);
+  Args args(argv + first + 1, argv + argc);
+
+  for (const auto& command : getCommands()) {
+    if (command.name != name) continue;
+
+    try {
+      int result;
+      {
+        Trace::Scope trace_scope("command", name);
+        result = command.func(args);
+      }
+      if (!trace_path.empty()) {
+        Trace::writeChromeJson(trace_path);
+      }
+
+      if (result < 0) {
+        std::cerr << "usage: StageTool " << command.usage << std::endl;
+        return 2;
+      }
+      return result;
+    }
+    catch (const std::exception& e) {
+      std::cerr << name << ": " << e.what() << std::endl;
+      return 2;
+    }
+  }
+
+  printUsage();
+  return 2;
+}